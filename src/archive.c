@@ -0,0 +1,272 @@
+/*
+ * archive.c
+ *
+ * Build and read archives of decoded dives, see cochran_archive.h.
+ *
+ * archive create   Decode CAN, WAN or ANA files and memory images into
+ *                  an archive, adding to it if it exists. Dives already
+ *                  in it are skipped, dives of another unit refused
+ * archive list     Every dive in an archive, one per line
+ * archive export   Dives as JSON lines, log and samples
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <libgen.h>
+#include <time.h>
+
+#include "cochran_device.h"
+#include "cochran_log.h"
+#include "cochran_sample.h"
+#include "cochran_memory.h"
+#include "cochran_archive.h"
+
+const char *id_file = NULL;
+long dive_num = -1;
+long fingerprint = -1;
+
+
+void usage(char *progname) {
+	printf("Usage: %s create [-i id_file] archive_file input ...\n", progname);
+	printf("       %s list archive_file\n", progname);
+	printf("       %s export [-n dive_num | -f fingerprint] archive_file\n", progname);
+	printf("Where: -i id_file     ID block for memory images, default is id0 next to each\n");
+	printf("       -n dive_num    The dive numbered dive_num, export does every dive without it\n");
+	printf("       -f fingerprint The dive that started at fingerprint, in hex\n");
+	printf("       archive_file   Added to if it exists, dives it has are skipped,\n");
+	printf("                      it holds the dives of one unit\n");
+	printf("       input          A .can, .wan or .ana file, or a memory image\n");
+	exit(1);
+}
+
+
+static int is_can(const char *file) {
+	size_t len = strlen(file);
+
+	return (len >= 4 && (!strcasecmp(file + len - 4, ".can") || !strcasecmp(file + len - 4, ".wan")
+			|| !strcasecmp(file + len - 4, ".ana")));
+}
+
+
+// The unit's serial from the config0 beside its ID block, 0 if there isn't one
+static unsigned int unit_serial(const unsigned char *id, const char *id_name) {
+	unsigned char config0[512];
+	char path[512], dir[512];
+
+	device_t *device = device_from_id(id, -1);
+	if (!device)
+		return 0;
+
+	snprintf(dir, sizeof(dir), "%s", id_name);
+	snprintf(path, sizeof(path), "%s/config0", dirname(dir));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	ssize_t n = read(fd, config0, sizeof(config0));
+	close(fd);
+
+	return (n == sizeof(config0) ? device_serial_number(device, config0) : 0);
+}
+
+
+static int add_memory(cochran_archive_writer_t *w, const char *file) {
+	char id_path[512];
+	const char *id_name = id_file;
+
+	if (!id_name) {
+		char dir[512];
+		snprintf(dir, sizeof(dir), "%s", file);
+		snprintf(id_path, sizeof(id_path), "%s/id0", dirname(dir));
+		id_name = id_path;
+	}
+
+	unsigned char id[0x43];
+	int fd = open(id_name, O_RDONLY);
+	if (fd < 0 || read(fd, id, sizeof(id)) != sizeof(id)) {
+		printf("Unable to read ID block %s\n%s\n", id_name, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	close(fd);
+
+	cochran_memory_t mem;
+	if (cochran_memory_map(&mem, id, file))
+		return -1;
+
+	int rc = cochran_archive_add_memory(w, &mem, unit_serial(id, id_name));
+	cochran_memory_unmap(&mem);
+
+	return rc;
+}
+
+
+/*
+ * The archive is rewritten whole. It's written next to the old one and
+ * renamed over it, so the old one stays mapped and intact until then.
+ */
+static int cmd_create(int argc, char *argv[]) {
+	const char *archive_file = argv[0];
+	cochran_archive_writer_t w;
+	cochran_archive_t ar = { 0 };
+	unsigned int existing = 0;
+	char temp_file[512];
+	int rc = 0;
+
+	cochran_archive_writer_init(&w);
+
+	if (access(archive_file, F_OK) == 0) {
+		if (cochran_archive_map(&ar, archive_file))
+			return 2;
+		if ((rc = cochran_archive_add_archive(&w, &ar)))
+			printf("%s: Unable to read %s\n", strerror(rc), archive_file);
+		existing = w.dive_count;
+	}
+
+	for (int i = 1; i < argc && !rc; i++) {
+		if (is_can(argv[i]))
+			rc = cochran_archive_add_can(&w, argv[i]);
+		else
+			rc = add_memory(&w, argv[i]);
+
+		if (rc > 0)
+			printf("%s: Unable to add %s%s\n", strerror(rc), argv[i],
+				rc == EINVAL && w.dive_count ? ", an archive holds one unit" : "");
+	}
+
+	if (!rc) {
+		snprintf(temp_file, sizeof(temp_file), "%s.tmp", archive_file);
+		int fd = open(temp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			rc = errno;
+		} else {
+			rc = cochran_archive_write(&w, fd);
+			if (close(fd) && !rc)
+				rc = errno;
+			if (!rc && rename(temp_file, archive_file))
+				rc = errno;
+			if (rc)
+				unlink(temp_file);
+		}
+
+		if (rc)
+			printf("%s: Unable to write %s\n", strerror(rc), archive_file);
+		else
+			printf("%u dives added, %u already there, %u in the archive\n",
+				w.dive_count - existing, w.skipped, w.dive_count);
+	}
+
+	cochran_archive_writer_free(&w);
+	cochran_archive_unmap(&ar);
+	return (rc ? 2 : 0);
+}
+
+
+static int cmd_list(const cochran_archive_t *ar) {
+	cochran_log_t log;
+
+	printf("Model %s, unit K%06u\n", ar->model, ar->serial);
+	printf("  # Dive Fingerprint YYYY/MM/DD hh:mm:ss    BT  Depth Temp\n");
+	printf("=== ==== =========== =================== ===== ====== ====\n");
+
+	for (unsigned int n = 0; n < ar->dive_count; n++) {
+		cochran_archive_log(ar, n, &log);
+		printf("%3u %4u    %08x %04d/%02d/%02d %02d:%02d:%02d %2dh%02d %6.2f %4.1f\n",
+			n, log.dive_num, (uint32_t) log.timestamp_start,
+			log.time_start.tm_year + 1900, log.time_start.tm_mon + 1, log.time_start.tm_mday,
+			log.time_start.tm_hour, log.time_start.tm_min, log.time_start.tm_sec,
+			log.bt / 60, log.bt % 60, log.depth_max, log.temp_min);
+	}
+
+	return 0;
+}
+
+
+// One JSON line per dive, as logbook export gives
+static void export_dive(const cochran_archive_t *ar, unsigned int n) {
+	cochran_log_t log;
+	int count = 0;
+
+	cochran_archive_log(ar, n, &log);
+	cochran_log_print_json(&log, n);
+	printf(",\"samples\":[");
+	cochran_archive_samples(ar, n, cochran_sample_print_json, &count);
+	printf("]}\n");
+}
+
+
+static int cmd_export(const cochran_archive_t *ar) {
+	int n = -1;
+
+	if (dive_num < 0 && fingerprint < 0) {
+		for (unsigned int i = 0; i < ar->dive_count; i++)
+			export_dive(ar, i);
+		return 0;
+	}
+
+	if (dive_num >= 0)
+		n = cochran_archive_find_dive(ar, dive_num);
+	else
+		n = cochran_archive_find_fingerprint(ar, fingerprint);
+
+	if (n < 0) {
+		printf("Dive isn't in the archive\n");
+		return 3;
+	}
+
+	export_dive(ar, n);
+	return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+	if (argc < 2)
+		usage(argv[0]);
+
+	const char *command = argv[1];
+
+	// Options follow the command
+	optind = 2;
+	int c;
+	while ((c = getopt(argc, argv, "i:n:f:")) != -1) {
+		switch (c) {
+		case 'i':
+			id_file = optarg;
+			break;
+		case 'n':
+			dive_num = atol(optarg);
+			break;
+		case 'f':
+			fingerprint = strtol(optarg, NULL, 16);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!strcmp(command, "create")) {
+		if (argc - optind < 2)
+			usage(argv[0]);
+		exit(cmd_create(argc - optind, argv + optind));
+	}
+
+	if ((strcmp(command, "list") && strcmp(command, "export")) || optind != argc - 1)
+		usage(argv[0]);
+
+	cochran_archive_t ar;
+	if (cochran_archive_map(&ar, argv[optind]))
+		exit(2);
+
+	int rc = (!strcmp(command, "list") ? cmd_list(&ar) : cmd_export(&ar));
+
+	cochran_archive_unmap(&ar);
+
+	exit(rc);
+}
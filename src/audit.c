@@ -0,0 +1,498 @@
+/*
+ * audit.c
+ *
+ * Audit the settings of a fleet of dive computers from their snapshots,
+ * directories holding id0 and config0 like data/<model>/K<serial>/ or
+ * what dock writes. Every config0 is mapped and decoded once into a
+ * table per settings schema, stored a column per field, so a query is a
+ * scan down one or two arrays.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cochran_device.h"
+#include "cochran_settings.h"
+
+#define MAX_DEPTH 4				// Directory levels searched for snapshots
+#define MAX_QUERIES 32
+
+typedef struct table_t {
+	const char *name;
+	struct cochran_config *cfg;
+	struct cochran_config_schema schema;
+	int rows, alloc;
+	char **unit;							// Snapshot directory of each row
+	union cochran_config_value **column;	// column[field][row]
+} table_t;
+
+typedef enum op_t { OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE } op_t;
+
+typedef struct query_t {
+	char field[64];
+	op_t op;
+	double value;
+	int index[2];				// Field in each table, -1 if it has none
+} query_t;
+
+table_t tables[] = {
+	{ .name = "EMC", .cfg = emc_cfg },
+	{ .name = "Commander", .cfg = cmd_cfg },
+};
+
+#define TABLE_COUNT (sizeof(tables) / sizeof(tables[0]))
+
+static unsigned int skipped;
+
+
+static double now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+
+static const unsigned char *map_file(const char *dir, const char *name, size_t *size) {
+	char path[512];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	const unsigned char *p = NULL;
+	if (!fstat(fd, &st) && st.st_size > 0) {
+		p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED)
+			p = NULL;
+		*size = st.st_size;
+	}
+	close(fd);
+	return p;
+}
+
+
+static int add_row(table_t *t, const char *dir, const unsigned char *config0, struct cochran_settings *settings) {
+	if (t->rows == t->alloc) {
+		int alloc = t->alloc ? t->alloc * 2 : 64;
+		char **unit = realloc(t->unit, alloc * sizeof(char *));
+		if (!unit)
+			return -1;
+		t->unit = unit;
+		for (int f = 0; f < t->schema.count; f++) {
+			union cochran_config_value *c = realloc(t->column[f], alloc * sizeof(union cochran_config_value));
+			if (!c)
+				return -1;
+			t->column[f] = c;
+		}
+		t->alloc = alloc;
+	}
+
+	cochran_config_decode_page(config0, settings);
+	for (int f = 0; f < t->schema.count; f++)
+		t->column[f][t->rows] = settings->value[f];
+
+	if (!(t->unit[t->rows] = strdup(dir)))
+		return -1;
+	t->rows++;
+	return 0;
+}
+
+
+// Decode one snapshot into the table for its family
+static int load_snapshot(const char *dir, struct cochran_settings *settings) {
+	size_t id_size = 0, config_size = 0;
+	const unsigned char *id = map_file(dir, "id0", &id_size);
+	const unsigned char *config0 = map_file(dir, "config0", &config_size);
+	device_t *device = NULL;
+	int rc = 0;
+
+	if (id && id_size >= ID_MODEL_OFFSET + 3)
+		device = device_from_id(id, -1);
+
+	if (!device || !config0 || config_size < CONFIG_PAGE_SIZE) {
+		skipped++;
+	} else if (device->family == FAMILY_COMMANDER_TM) {
+		skipped++;		// The TM page isn't laid out like cmd_cfg
+	} else {
+		int t = (device->family == FAMILY_EMC ? 0 : 1);
+		rc = add_row(&tables[t], dir, config0, &settings[t]);
+	}
+
+	if (id)
+		munmap((void *) id, id_size);
+	if (config0)
+		munmap((void *) config0, config_size);
+	return rc;
+}
+
+
+// A snapshot, or a directory with snapshots below it
+static int scan(const char *dir, int depth, struct cochran_settings *settings) {
+	char path[512];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s/config0", dir);
+	if (!stat(path, &st))
+		return load_snapshot(dir, settings);
+
+	if (depth >= MAX_DEPTH)
+		return 0;
+
+	DIR *d = opendir(dir);
+	if (!d)
+		return 0;
+
+	struct dirent *e;
+	int rc = 0;
+	while (!rc && (e = readdir(d))) {
+		if (e->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		if (!stat(path, &st) && S_ISDIR(st.st_mode))
+			rc = scan(path, depth + 1, settings);
+	}
+	closedir(d);
+	return rc;
+}
+
+
+static double field_value(const table_t *t, int f, int row) {
+	switch (t->cfg[f].encoding) {
+	case CONFIG_ENC_LE_DECIMAL:
+	case CONFIG_ENC_BE_DECIMAL:
+		return t->column[f][row].rational;
+	default:
+		return t->column[f][row].integer;
+	}
+}
+
+
+static int compare(double a, op_t op, double b) {
+	// Decimals are stored to 1/256
+	int eq = fabs(a - b) < 0.005;
+
+	switch (op) {
+	case OP_LT:	return a < b && !eq;
+	case OP_LE:	return a < b || eq;
+	case OP_GT:	return a > b && !eq;
+	case OP_GE:	return a > b || eq;
+	case OP_EQ:	return eq;
+	case OP_NE:	return !eq;
+	}
+	return 0;
+}
+
+
+static void trim(char *s) {
+	char *p = s;
+	size_t len;
+
+	while (isspace((unsigned char) *p))
+		p++;
+	memmove(s, p, strlen(p) + 1);
+	len = strlen(s);
+	while (len && isspace((unsigned char) s[len - 1]))
+		s[--len] = 0;
+}
+
+
+// "field op value" where op is one of < <= > >= = == !=
+static int parse_query(query_t *q, const char *text) {
+	static const struct { const char *s; op_t op; } ops[] = {
+		{ "<=", OP_LE }, { ">=", OP_GE }, { "!=", OP_NE }, { "==", OP_EQ },
+		{ "<", OP_LT }, { ">", OP_GT }, { "=", OP_EQ },
+	};
+	const char *at = NULL;
+	size_t op_len = 0;
+
+	for (const char *p = text; *p && !at; p++) {
+		for (unsigned int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+			size_t len = strlen(ops[i].s);
+			if (!strncmp(p, ops[i].s, len)) {
+				at = p;
+				op_len = len;
+				q->op = ops[i].op;
+				break;
+			}
+		}
+	}
+
+	if (!at || at - text >= (int) sizeof(q->field))
+		return -1;
+
+	memcpy(q->field, text, at - text);
+	q->field[at - text] = 0;
+	trim(q->field);
+
+	char *end;
+	q->value = strtod(at + op_len, &end);
+	return (end == at + op_len || !*q->field ? -1 : 0);
+}
+
+
+/*
+ * Resolve a query's field in every table, at least one must have it. A
+ * number only resolves in the table it names, a bare one is refused as it
+ * is a different field in each.
+ */
+static int resolve(query_t *q) {
+	int any = 0;
+
+	for (unsigned int t = 0; t < TABLE_COUNT; t++) {
+		q->index[t] = cochran_config_find_field(tables[t].cfg, tables[t].schema.count, q->field, 1);
+		if (q->index[t] == -2) {
+			dprintf(STDERR_FILENO, "\"%s\" matches more than one %s field\n", q->field, tables[t].name);
+			return -1;
+		}
+		if (q->index[t] >= 0)
+			any = 1;
+	}
+
+	if (!any)
+		dprintf(STDERR_FILENO, "No field \"%s\", give part of its label, or emc:<n> or cmdr:<n>\n", q->field);
+	return (any ? 0 : -1);
+}
+
+
+/*
+ * A policy is a preset: field and value per line, # starts a comment. The
+ * field is a piece of its label, or emc:<n> or cmdr:<n>. Each line becomes
+ * an equality query, and a unit is reported for every line it doesn't
+ * match.
+ */
+static int load_policy(const char *file, query_t *queries, int *count) {
+	char line[256];
+	FILE *fp = fopen(file, "r");
+
+	if (!fp) {
+		dprintf(STDERR_FILENO, "%s: Unable to open %s\n", strerror(errno), file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		// Labels have #1 in them, a comment's # isn't followed by a digit
+		for (char *p = line; *p; p++) {
+			if (*p == '#' && !isdigit((unsigned char) p[1])) {
+				*p = 0;
+				break;
+			}
+		}
+		trim(line);
+		if (!*line)
+			continue;
+
+		char *value = strrchr(line, ' ');
+		char *tab = strrchr(line, '\t');
+		if (tab > value)
+			value = tab;
+		if (!value || value - line >= (int) sizeof(queries->field) || *count == MAX_QUERIES) {
+			dprintf(STDERR_FILENO, "Bad policy line \"%s\"\n", line);
+			fclose(fp);
+			return -1;
+		}
+		*value++ = 0;
+		trim(line);
+
+		query_t *q = &queries[(*count)++];
+		memset(q, 0, sizeof(*q));
+		strcpy(q->field, line);
+		q->op = OP_EQ;
+		q->value = atof(value);
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+
+static void print_field(const table_t *t, int f, int row) {
+	printf("  %s=", t->cfg[f].label);
+	if (t->cfg[f].encoding == CONFIG_ENC_LE_DECIMAL || t->cfg[f].encoding == CONFIG_ENC_BE_DECIMAL)
+		printf("%.2f", t->column[f][row].rational);
+	else
+		printf("%d", t->column[f][row].integer);
+}
+
+
+// Units matching every query, with the fields queried
+static int run_queries(const query_t *queries, int count) {
+	int matched = 0;
+
+	for (unsigned int t = 0; t < TABLE_COUNT; t++) {
+		table_t *tb = &tables[t];
+		int usable = 1;
+
+		for (int i = 0; i < count; i++)
+			if (queries[i].index[t] < 0)
+				usable = 0;
+		if (!usable || !tb->rows)
+			continue;
+
+		// Narrow a row selection one column at a time
+		char *hit = malloc(tb->rows);
+		if (!hit)
+			return -1;
+		memset(hit, 1, tb->rows);
+
+		for (int i = 0; i < count; i++) {
+			const query_t *q = &queries[i];
+			for (int r = 0; r < tb->rows; r++)
+				if (hit[r] && !compare(field_value(tb, q->index[t], r), q->op, q->value))
+					hit[r] = 0;
+		}
+
+		for (int r = 0; r < tb->rows; r++) {
+			if (!hit[r])
+				continue;
+			printf("%s %s", tb->unit[r], tb->name);
+			for (int i = 0; i < count; i++)
+				print_field(tb, queries[i].index[t], r);
+			printf("\n");
+			matched++;
+		}
+		free(hit);
+	}
+
+	return matched;
+}
+
+
+// Units that differ from the policy, a line for each field that does
+static int run_policy(const query_t *policy, int count) {
+	int units = 0;
+
+	for (unsigned int t = 0; t < TABLE_COUNT; t++) {
+		table_t *tb = &tables[t];
+
+		for (int r = 0; r < tb->rows; r++) {
+			int differs = 0;
+
+			for (int i = 0; i < count; i++) {
+				int f = policy[i].index[t];
+				if (f < 0 || compare(field_value(tb, f, r), OP_EQ, policy[i].value))
+					continue;
+				if (!differs++)
+					printf("%s %s\n", tb->unit[r], tb->name);
+				printf("  %s: %g, policy %g\n", tb->cfg[f].label, field_value(tb, f, r), policy[i].value);
+			}
+			if (differs)
+				units++;
+		}
+	}
+
+	return units;
+}
+
+
+void usage(const char *name) {
+	printf("Usage: %s [-q query ...] [-p policy] <dir> [dir ...]\n", name);
+	printf("Where:  -q <query> Units where query holds, e.g. \"conservatism < 20\",\n");
+	printf("                   several are all applied. Fields are part of the\n");
+	printf("                   label, or the number settings prints as emc:<n>\n");
+	printf("                   or cmdr:<n>.\n");
+	printf("        -p <file>  Units that differ from a policy, a field and\n");
+	printf("                   value per line. Exits 2 if any do.\n");
+	printf("        <dir>      Snapshot, or directory of snapshots, e.g. data\n");
+}
+
+
+int main(int argc, char *argv[]) {
+	query_t queries[MAX_QUERIES], policy[MAX_QUERIES];
+	int query_count = 0, policy_count = 0;
+
+	int c;
+	while ((c = getopt(argc, argv, "q:p:")) != -1) {
+		switch (c) {
+		case 'q':
+			if (query_count == MAX_QUERIES || parse_query(&queries[query_count], optarg)) {
+				dprintf(STDERR_FILENO, "Bad query \"%s\"\n", optarg);
+				return 1;
+			}
+			query_count++;
+			break;
+		case 'p':
+			if (load_policy(optarg, policy, &policy_count))
+				return 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	struct cochran_settings settings[TABLE_COUNT];
+
+	for (unsigned int t = 0; t < TABLE_COUNT; t++) {
+		table_t *tb = &tables[t];
+		if (cochran_config_schema_init(&tb->schema, tb->cfg)
+				|| cochran_settings_alloc(&settings[t], &tb->schema)
+				|| !(tb->column = calloc(tb->schema.count, sizeof(union cochran_config_value *)))) {
+			dprintf(STDERR_FILENO, "Unable to build the settings schema\n");
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < query_count; i++)
+		if (resolve(&queries[i]))
+			return 1;
+	for (int i = 0; i < policy_count; i++)
+		if (resolve(&policy[i]))
+			return 1;
+
+	double start = now_ms();
+	for (int i = optind; i < argc; i++) {
+		if (scan(argv[i], 0, settings)) {
+			dprintf(STDERR_FILENO, "Out of memory\n");
+			return 1;
+		}
+	}
+	double loaded = now_ms();
+
+	int found = 0;
+	if (query_count)
+		run_queries(queries, query_count);
+	if (policy_count)
+		found = run_policy(policy, policy_count);
+	if (!query_count && !policy_count) {
+		for (unsigned int t = 0; t < TABLE_COUNT; t++)
+			for (int r = 0; r < tables[t].rows; r++)
+				printf("%s %s\n", tables[t].unit[r], tables[t].name);
+	}
+	double done = now_ms();
+
+	fflush(stdout);
+	dprintf(STDERR_FILENO, "%d EMC and %d Commander units (%u skipped) loaded in %.1fms, queried in %.3fms\n",
+		tables[0].rows, tables[1].rows, skipped, loaded - start, done - loaded);
+
+	for (unsigned int t = 0; t < TABLE_COUNT; t++) {
+		for (int f = 0; f < tables[t].schema.count; f++)
+			free(tables[t].column[f]);
+		for (int r = 0; r < tables[t].rows; r++)
+			free(tables[t].unit[r]);
+		free(tables[t].column);
+		free(tables[t].unit);
+		cochran_settings_free(&settings[t]);
+		cochran_config_schema_free(&tables[t].schema);
+	}
+
+	return (policy_count && found ? 2 : 0);
+}
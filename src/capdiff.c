@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "cochran_usbmon.h"
+#include "cochran_settings.h"
+
+/*
+ * capdiff
+ *
+ * Compares usbmon captures of Analyst sessions. Exchanges are paired up
+ * by request, config pages (0x96 reads, with any 0x5a word writes that
+ * follow applied) are diffed and every changed bit is looked up in the
+ * emc_cfg[] and cmd_cfg[] tables. Bits no field claims are flagged.
+ */
+
+#define CONFIG_PAGE 512
+#define CONFIG_PAGES 4
+#define CONFIG_BITS (CONFIG_PAGES * CONFIG_PAGE * 8)
+
+typedef struct schema_t {
+	const char *name;
+	struct cochran_config *cfg;
+	short owner[CONFIG_BITS];	// Index into cfg of the field using each bit, -1 for none
+} schema_t;
+
+typedef struct image_t {
+	const char *file;
+	usbmon_exchanges_t ex;
+	unsigned char page[CONFIG_PAGES][CONFIG_PAGE];
+	int have[CONFIG_PAGES];
+	int writes, lost;			// Word writes applied, and those to pages never read
+} image_t;
+
+schema_t schemas[] = {
+	{ .name = "emc_cfg", .cfg = emc_cfg },
+	{ .name = "cmd_cfg", .cfg = cmd_cfg },
+};
+
+#define SCHEMA_COUNT (sizeof(schemas) / sizeof(schemas[0]))
+
+
+// Which bits of the config pages each field is stored in
+void build_schema(schema_t *s) {
+	for (int b = 0; b < CONFIG_BITS; b++)
+		s->owner[b] = -1;
+
+	for (int i = 0; s->cfg[i].word != -1; i++) {
+		struct cochran_config *c = &s->cfg[i];
+		int offset = c->word * 2, first = 0, last = 15;
+
+		switch (c->encoding) {
+		case CONFIG_ENC_PERCENT:
+			offset += c->byte;
+			last = 7;
+			break;
+		case CONFIG_ENC_BIT_INT:
+			offset += c->byte;
+			first = c->start_bit + 1 - c->bits;
+			last = c->start_bit;
+			break;
+		default:
+			break;
+		}
+
+		for (int b = first; b <= last; b++)
+			if (offset * 8 + b < CONFIG_BITS)
+				s->owner[offset * 8 + b] = i;
+	}
+}
+
+
+// Config pages as read, then with the session's writes applied
+int load_image(image_t *im, int writes) {
+	if (usbmon_load_exchanges(im->file, &im->ex))
+		return -1;
+
+	for (int i = 0; i < im->ex.count; i++) {
+		usbmon_exchange_t *e = &im->ex.ex[i];
+
+		if (e->request_len == 2 && e->request[0] == 0x96 && e->request[1] < CONFIG_PAGES && e->reply_len >= CONFIG_PAGE) {
+			memcpy(im->page[e->request[1]], e->reply, CONFIG_PAGE);
+			im->have[e->request[1]] = 1;
+		} else if (writes && e->request_len == 5 && e->request[0] == 0x5a) {
+			int offset = (e->request[1] + e->request[2] * 256) * 2;
+			int page = offset / CONFIG_PAGE;
+
+			if (page < CONFIG_PAGES && im->have[page]) {
+				memcpy(im->page[page] + offset % CONFIG_PAGE, e->request + 3, 2);
+				im->writes++;
+			} else {
+				im->lost++;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+void print_request(const unsigned char *req, int len) {
+	for (int i = 0; i < len && i < 12; i++)
+		printf("%02x ", req[i]);
+	if (len > 12)
+		printf("... ");
+}
+
+
+// Pair exchanges by request, in order, and report the ones that differ
+void diff_commands(image_t *a, image_t *b) {
+	char *used = calloc(b->ex.count, 1);
+	int same = 0;
+
+	if (!used)
+		return;
+
+	for (int i = 0; i < a->ex.count; i++) {
+		usbmon_exchange_t *x = &a->ex.ex[i], *y = 0;
+
+		for (int j = 0; j < b->ex.count; j++) {
+			usbmon_exchange_t *e = &b->ex.ex[j];
+			if (!used[j] && e->request_len == x->request_len && !memcmp(e->request, x->request, x->request_len)) {
+				used[j] = 1;
+				y = e;
+				break;
+			}
+		}
+
+		if (!y) {
+			printf("  only in first:  ");
+			print_request(x->request, x->request_len);
+			printf("\n");
+		} else if (x->reply_len != y->reply_len || memcmp(x->reply, y->reply, x->reply_len)) {
+			int n = (x->reply_len < y->reply_len ? x->reply_len : y->reply_len), differ = 0;
+			for (int k = 0; k < n; k++)
+				if (x->reply[k] != y->reply[k])
+					differ++;
+
+			printf("  reply differs:  ");
+			print_request(x->request, x->request_len);
+			printf("(%d bytes differ", differ);
+			if (x->reply_len != y->reply_len)
+				printf(", %d vs %d bytes", x->reply_len, y->reply_len);
+			printf(")\n");
+		} else {
+			same++;
+		}
+	}
+
+	for (int j = 0; j < b->ex.count; j++) {
+		if (!used[j]) {
+			printf("  only in second: ");
+			print_request(b->ex.ex[j].request, b->ex.ex[j].request_len);
+			printf("\n");
+		}
+	}
+
+	printf("  %d exchanges identical\n", same);
+	free(used);
+}
+
+
+// Every changed field once, then any changed bits no field owns
+void diff_pages(const unsigned char (*from)[CONFIG_PAGE], const unsigned char (*to)[CONFIG_PAGE], const int *have, int schema_mask) {
+	char *reported[SCHEMA_COUNT];
+	int changes = 0, unmapped = 0;
+
+	for (unsigned int s = 0; s < SCHEMA_COUNT; s++)
+		reported[s] = calloc(512, 1);
+
+	for (int p = 0; p < CONFIG_PAGES; p++) {
+		if (!have[p])
+			continue;
+
+		for (int o = 0; o < CONFIG_PAGE; o++) {
+			unsigned char x = from[p][o] ^ to[p][o];
+			unsigned char owned = 0;
+			int offset = p * CONFIG_PAGE + o;
+
+			if (!x)
+				continue;
+			changes++;
+
+			for (unsigned int s = 0; s < SCHEMA_COUNT; s++) {
+				if (!(schema_mask & (1 << s)))
+					continue;
+
+				for (int bit = 0; bit < 8; bit++) {
+					int f = schemas[s].owner[offset * 8 + bit];
+					if (!(x & (1 << bit)) || f < 0)
+						continue;
+
+					owned |= 1 << bit;
+					if (reported[s] && reported[s][f])
+						continue;
+					if (reported[s])
+						reported[s][f] = 1;
+
+					struct cochran_config *c = &schemas[s].cfg[f];
+					int w = c->word * 2 - p * CONFIG_PAGE;
+					printf("  config%d word 0x%04x [%02x %02x -> %02x %02x]  %s: %s\n", p, c->word,
+						from[p][w], from[p][w + 1], to[p][w], to[p][w + 1], schemas[s].name, c->label);
+				}
+			}
+
+			if (x & ~owned) {
+				printf("  config%d byte 0x%03x [%02x -> %02x] bits %02x  UNMAPPED\n", p, o,
+					from[p][o], to[p][o], x & ~owned);
+				unmapped++;
+			}
+		}
+	}
+
+	if (!changes)
+		printf("  config pages identical\n");
+	else if (unmapped)
+		printf("  %d changed bytes, %d with unmapped bits\n", changes, unmapped);
+
+	for (unsigned int s = 0; s < SCHEMA_COUNT; s++)
+		free(reported[s]);
+}
+
+
+void usage(const char *name) {
+	printf("Usage: %s [-e|-c] [-r] [-w] <base> [capture ...]\n", name);
+	printf("Where:  -e         Map changes with emc_cfg only\n");
+	printf("        -c         Map changes with cmd_cfg only\n");
+	printf("        -r         Compare config as read, ignoring writes\n");
+	printf("        -w         Compare each capture's config as read with its writes applied\n");
+	printf("        <base>     Capture the others are compared with\n");
+}
+
+
+int main(int argc, char *argv[]) {
+	int schema_mask = 3, writes = 1, self = 0;
+
+	int c;
+	while ((c = getopt(argc, argv, "ecrw")) != -1) {
+		switch (c) {
+		case 'e':
+			schema_mask = 1;
+			break;
+		case 'c':
+			schema_mask = 2;
+			break;
+		case 'r':
+			writes = 0;
+			break;
+		case 'w':
+			self = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	int count = argc - optind;
+	if (count < 1 || (count < 2 && !self)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (unsigned int s = 0; s < SCHEMA_COUNT; s++)
+		build_schema(&schemas[s]);
+
+	image_t *images = calloc(count, sizeof(image_t));
+	if (!images) {
+		dprintf(STDERR_FILENO, "Out of memory\n");
+		return 1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		images[i].file = argv[optind + i];
+		if (load_image(&images[i], writes && !self))
+			return 1;
+	}
+
+	if (self) {
+		for (int i = 0; i < count; i++) {
+			image_t *im = &images[i], after = { .file = im->file };
+
+			if (load_image(&after, 1))
+				return 1;
+
+			printf("%s: %d writes", im->file, after.writes);
+			if (after.lost)
+				printf(", %d to pages not read", after.lost);
+			printf("\n");
+			diff_pages((const unsigned char (*)[CONFIG_PAGE]) im->page, (const unsigned char (*)[CONFIG_PAGE]) after.page, im->have, schema_mask);
+			usbmon_free_exchanges(&after.ex);
+		}
+		return 0;
+	}
+
+	for (int i = 1; i < count; i++) {
+		image_t *a = &images[0], *b = &images[i];
+		int have[CONFIG_PAGES];
+
+		for (int p = 0; p < CONFIG_PAGES; p++)
+			have[p] = a->have[p] && b->have[p];
+
+		printf("%s -> %s\n", a->file, b->file);
+		diff_commands(a, b);
+		diff_pages((const unsigned char (*)[CONFIG_PAGE]) a->page, (const unsigned char (*)[CONFIG_PAGE]) b->page, have, schema_mask);
+	}
+
+	return 0;
+}
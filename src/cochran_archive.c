@@ -0,0 +1,912 @@
+/*
+ * cochran_archive.c
+ *
+ * Writer and mapped reader for archives of decoded dives.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cochran.h"
+#include "cochran_log.h"
+#include "cochran_sample.h"
+#include "cochran_memory.h"
+#include "cochran_can.h"
+#include "cochran_archive.h"
+
+// Header fields
+#define HDR_VERSION				0x08
+#define HDR_DIVE_COUNT			0x0c
+#define HDR_MODEL				0x10
+#define HDR_SLOT_COUNT			0x14
+#define HDR_RECORD				0x18
+#define HDR_NUMBER_SLOT			0x1c
+#define HDR_FINGERPRINT_SLOT	0x20
+#define HDR_EVENT				0x24
+#define HDR_EVENT_COUNT			0x28
+#define HDR_PROFILE				0x2c
+#define HDR_PROFILE_SIZE		0x30
+#define HDR_SERIAL				0x34
+
+// Record fields
+#define REC_DIVE_NUM			0
+#define REC_REP_DIVE_NUM		4
+#define REC_TIMESTAMP			8		// 64 bits of ticks, the low word is the fingerprint
+#define REC_SIT					16
+#define REC_BT					20
+#define REC_INTERVAL			22
+#define REC_DEPTH_MAX			24		// floats
+#define REC_DEPTH_AVG			28
+#define REC_TEMP_MIN			32
+#define REC_TEMP_AVG			36
+#define REC_TEMP_START			40
+#define REC_O2					44
+#define REC_HE					48
+#define REC_TANK_PRESSURE_START	52
+#define REC_TANK_PRESSURE_END	54
+#define REC_ASCENT_RATE_MAX		56
+#define REC_NDL_MIN				58
+#define REC_DECO_MAX			60
+#define REC_DECO_MISSED			62
+#define REC_PROFILE				64		// From the start of the profiles
+#define REC_PROFILE_SIZE		68
+#define REC_ROWS				72
+#define REC_EVENT_COUNT			76
+#define REC_FLAGS				78
+#define REC_YEAR				80		// Start time as the log has it, ticks aren't all Unix time
+#define REC_MONTH				82		// 1-12
+#define REC_DAY					83
+#define REC_HOUR				84
+#define REC_MINUTE				85
+#define REC_SECOND				86
+#define REC_CONSERVATISM		87
+#define REC_VOLTAGE_START		88		// floats
+#define REC_VOLTAGE_END			92
+#define REC_PROFILE_PRE			96		// The computer's profile pointers
+#define REC_PROFILE_BEGIN		100
+#define REC_PROFILE_END			104
+
+// Row values
+#define COL_DEPTH				0
+#define COL_TEMP				1
+#define COL_TANK_PRESSURE		2
+
+
+static void put16(unsigned char *p, unsigned int v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+
+static void put32(unsigned char *p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+
+static void put_float(unsigned char *p, float f) {
+	uint32_t v;
+	memcpy(&v, &f, sizeof(v));
+	put32(p, v);
+}
+
+
+static float get_float(const unsigned char *p) {
+	uint32_t v = array_uint32_le(p);
+	float f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+
+static uint32_t slot_hash(uint32_t key) {
+	key *= 2654435761u;
+	return key ^ (key >> 16);
+}
+
+
+static uint32_t zigzag(int32_t v) {
+	return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+
+static int32_t unzigzag(uint32_t v) {
+	return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+
+static int32_t fixed(double v) {
+	return (int32_t) (v * ARCHIVE_SCALE + (v < 0 ? -0.5 : 0.5));
+}
+
+
+/*
+ * Writer
+ */
+
+// Make room for need items of width bytes, doubling
+static int grow(void **buf, unsigned int *capacity, unsigned int need, size_t width) {
+	if (need <= *capacity)
+		return 0;
+
+	unsigned int capacity_new = *capacity ? *capacity : 64;
+	while (capacity_new < need)
+		capacity_new *= 2;
+
+	void *p = realloc(*buf, capacity_new * width);
+	if (!p)
+		return ENOMEM;
+
+	*buf = p;
+	*capacity = capacity_new;
+	return 0;
+}
+
+
+static void put_varint(cochran_archive_writer_t *w, uint32_t v) {
+	if (w->error)
+		return;
+	if (grow((void **) &w->profile, &w->profile_capacity, w->profile_size + 5, 1)) {
+		w->error = ENOMEM;
+		return;
+	}
+
+	while (v >= 0x80) {
+		w->profile[w->profile_size++] = v | 0x80;
+		v >>= 7;
+	}
+	w->profile[w->profile_size++] = v;
+}
+
+
+typedef struct archive_dive_t {
+	cochran_archive_writer_t *w;
+	cochran_archive_row_t row;		// Being gathered
+	int have;
+	int tank_pressure;				// The dive logged tank pressure
+} archive_dive_t;
+
+
+static void row_flush(archive_dive_t *dive) {
+	cochran_archive_writer_t *w = dive->w;
+
+	if (!dive->have)
+		return;
+	dive->have = 0;
+
+	if (grow((void **) &w->row, &w->row_capacity, w->rows + 1, sizeof(cochran_archive_row_t))) {
+		w->error = ENOMEM;
+		return;
+	}
+	w->row[w->rows++] = dive->row;
+}
+
+
+static void add_event(cochran_archive_writer_t *w, int time, const char *event) {
+	unsigned int name;
+
+	for (name = 0; name < w->event_count; name++)
+		if (w->event[name] == event || !strcmp(w->event[name], event))
+			break;
+
+	if (name == w->event_count) {
+		// A full table drops the newcomer, 255 is far more than any model has
+		if (w->event_count == ARCHIVE_MAX_EVENTS)
+			return;
+		w->event[w->event_count++] = event;
+	}
+
+	if (grow((void **) &w->dive_event, &w->dive_event_capacity, w->dive_events + 1, sizeof(cochran_archive_event_t))) {
+		w->error = ENOMEM;
+		return;
+	}
+	w->dive_event[w->dive_events].time = time;
+	w->dive_event[w->dive_events].name = name;
+	w->dive_events++;
+}
+
+
+static int archive_sample_cb(int time, cochran_sample_t *sample, void *userdata) {
+	archive_dive_t *dive = (archive_dive_t *) userdata;
+
+	if (time != dive->row.time) {
+		row_flush(dive);
+		dive->row.time = time;
+	}
+
+	switch (sample->type) {
+	case SAMPLE_DEPTH:
+		dive->row.value[COL_DEPTH] = fixed(sample->value.depth);
+		break;
+	case SAMPLE_TEMP:
+		dive->row.value[COL_TEMP] = fixed(sample->value.temp);
+		break;
+	case SAMPLE_TANK_PRESSURE:
+		dive->row.value[COL_TANK_PRESSURE] = fixed(sample->value.tank_pressure);
+		dive->tank_pressure = 1;
+		break;
+	case SAMPLE_EVENT:
+		if (sample->value.event)
+			add_event(dive->w, time, sample->value.event);
+		return 0;
+	default:
+		return 0;
+	}
+
+	dive->have = 1;
+	return 0;
+}
+
+
+int cochran_archive_writer_init(cochran_archive_writer_t *w) {
+	memset(w, 0, sizeof(*w));
+	return 0;
+}
+
+
+void cochran_archive_writer_free(cochran_archive_writer_t *w) {
+	free(w->record);
+	free(w->profile);
+	free(w->row);
+	free(w->dive_event);
+	memset(w, 0, sizeof(*w));
+}
+
+
+/*
+ * Decode a dive's samples, in up to two segments as the profile ring
+ * gives them, and add it. A dive whose number and fingerprint are
+ * already in the archive is skipped, so overlapping downloads and CAN
+ * files can be fed in together. An archive holds one unit, dive
+ * numbers only name a dive within one, so a dive from another model or
+ * serial is refused with EINVAL.
+ * Returns 0, or an errno.
+ */
+int cochran_archive_add_dive(cochran_archive_writer_t *w, const char *model, unsigned int serial, const cochran_log_t *log, const unsigned char *data[2], const unsigned int size[2]) {
+	uint32_t fingerprint = (uint32_t) log->timestamp_start;
+
+	if (w->error)
+		return w->error;
+
+	if (!w->dive_count) {
+		memcpy(w->model, model, sizeof(w->model));
+		w->serial = serial;
+	} else if (strncmp(w->model, model, sizeof(w->model)) || w->serial != serial) {
+		return EINVAL;
+	}
+
+	for (unsigned int n = 0; n < w->dive_count; n++) {
+		const unsigned char *rec = w->record + n * ARCHIVE_RECORD_SIZE;
+		if (array_uint32_le(rec + REC_DIVE_NUM) == log->dive_num
+				&& array_uint32_le(rec + REC_TIMESTAMP) == fingerprint) {
+			w->skipped++;
+			return 0;
+		}
+	}
+
+	if (grow((void **) &w->record, &w->dive_capacity, w->dive_count + 1, ARCHIVE_RECORD_SIZE))
+		return (w->error = ENOMEM);
+
+	archive_dive_t dive = { .w = w };
+	w->rows = 0;
+	w->dive_events = 0;
+
+	if (size[0] + size[1] > 2)
+		cochran_sample_parse_segments((const unsigned char *) model, log, data, size, archive_sample_cb, &dive);
+	row_flush(&dive);
+
+	// Columns, one after another
+	unsigned int profile = w->profile_size;
+	int32_t last;
+
+	put_varint(w, w->rows);
+
+	last = 0;
+	for (unsigned int r = 0; r < w->rows; r++) {
+		put_varint(w, zigzag(w->row[r].time - last));
+		last = w->row[r].time;
+	}
+
+	for (int c = COL_DEPTH; c <= (dive.tank_pressure ? COL_TANK_PRESSURE : COL_TEMP); c++) {
+		last = 0;
+		for (unsigned int r = 0; r < w->rows; r++) {
+			put_varint(w, zigzag(w->row[r].value[c] - last));
+			last = w->row[r].value[c];
+		}
+	}
+
+	put_varint(w, w->dive_events);
+	last = 0;
+	for (unsigned int e = 0; e < w->dive_events; e++) {
+		put_varint(w, zigzag(w->dive_event[e].time - last));
+		put_varint(w, w->dive_event[e].name);
+		last = w->dive_event[e].time;
+	}
+
+	if (w->error)
+		return w->error;
+
+	unsigned char *rec = w->record + w->dive_count * ARCHIVE_RECORD_SIZE;
+	uint64_t timestamp = (uint64_t) (int64_t) log->timestamp_start;
+
+	memset(rec, 0, ARCHIVE_RECORD_SIZE);
+	put32(rec + REC_DIVE_NUM, log->dive_num);
+	put32(rec + REC_REP_DIVE_NUM, log->rep_dive_num);
+	put32(rec + REC_TIMESTAMP, timestamp);
+	put32(rec + REC_TIMESTAMP + 4, timestamp >> 32);
+	put32(rec + REC_SIT, log->sit);
+	put16(rec + REC_BT, log->bt);
+	put16(rec + REC_INTERVAL, log->profile_interval);
+	put_float(rec + REC_DEPTH_MAX, log->depth_max);
+	put_float(rec + REC_DEPTH_AVG, log->depth_avg);
+	put_float(rec + REC_TEMP_MIN, log->temp_min);
+	put_float(rec + REC_TEMP_AVG, log->temp_avg);
+	put_float(rec + REC_TEMP_START, log->temp_start);
+	put_float(rec + REC_O2, log->mix[0].o2);
+	put_float(rec + REC_HE, log->mix[0].he);
+	put16(rec + REC_TANK_PRESSURE_START, log->tank_pressure_start);
+	put16(rec + REC_TANK_PRESSURE_END, log->tank_pressure_end);
+	put16(rec + REC_ASCENT_RATE_MAX, log->ascent_rate_max);
+	put16(rec + REC_NDL_MIN, log->ndl_min);
+	put16(rec + REC_DECO_MAX, log->deco_max);
+	put16(rec + REC_DECO_MISSED, log->deco_missed);
+	put32(rec + REC_PROFILE, profile);
+	put32(rec + REC_PROFILE_SIZE, w->profile_size - profile);
+	put32(rec + REC_ROWS, w->rows);
+	put16(rec + REC_EVENT_COUNT, log->event_count);
+	put16(rec + REC_FLAGS, dive.tank_pressure ? ARCHIVE_TANK_PRESSURE : 0);
+	put16(rec + REC_YEAR, log->time_start.tm_year + 1900);
+	rec[REC_MONTH] = log->time_start.tm_mon + 1;
+	rec[REC_DAY] = log->time_start.tm_mday;
+	rec[REC_HOUR] = log->time_start.tm_hour;
+	rec[REC_MINUTE] = log->time_start.tm_min;
+	rec[REC_SECOND] = log->time_start.tm_sec;
+	rec[REC_CONSERVATISM] = log->conservatism;
+	put_float(rec + REC_VOLTAGE_START, log->voltage_start);
+	put_float(rec + REC_VOLTAGE_END, log->voltage_end);
+	put32(rec + REC_PROFILE_PRE, log->profile_pre);
+	put32(rec + REC_PROFILE_BEGIN, log->profile_begin);
+	put32(rec + REC_PROFILE_END, log->profile_end);
+
+	w->dive_count++;
+	return 0;
+}
+
+
+typedef struct archive_can_t {
+	cochran_archive_writer_t *w;
+	int rc;
+} archive_can_t;
+
+
+static int can_dive_cb(cochran_can_meta_t *meta, const unsigned char *dive, unsigned int dive_size, unsigned int dive_num, int last_dive, void *userdata) {
+	archive_can_t *can = (archive_can_t *) userdata;
+	const unsigned char *data[2] = { dive + meta->profile_offset, NULL };
+	unsigned int size[2] = { 0, 0 };
+	cochran_log_t log;
+
+	(void) dive_num;
+
+	if (last_dive || dive_size < meta->profile_offset)
+		return 0;
+
+	cochran_log_parse(meta->model, dive + meta->log_offset, &log);
+
+	// Trust the logged end unless it's corrupt or runs past the dive, as canfile does
+	size[0] = dive_size - meta->profile_offset;
+	if (log.profile_end != 0xFFFFFFFF && log.profile_end && log.profile_end >= log.profile_pre
+			&& log.profile_end - log.profile_pre < size[0])
+		size[0] = log.profile_end - log.profile_pre;
+
+	return (can->rc = cochran_archive_add_dive(can->w, meta->model, meta->serial, &log, data, size));
+}
+
+
+// Add every dive in a CAN, WAN or ANA file. Returns 0, or an errno.
+int cochran_archive_add_can(cochran_archive_writer_t *w, const char *file) {
+	archive_can_t can = { .w = w };
+	cochran_file_type_t file_type;
+	cochran_can_meta_t meta;
+	unsigned char *cleartext;
+	unsigned int size;
+
+	int rc = cochran_can_load(file, &file_type, &cleartext, &size);
+	if (rc)
+		return rc;
+
+	if (cochran_can_meta(&meta, file_type, cleartext, size))
+		rc = EINVAL;
+	else if (cochran_can_foreach_dive(&meta, cleartext, size, can_dive_cb, &can))
+		rc = can.rc ? can.rc : EINVAL;
+
+	free(cleartext);
+	return rc;
+}
+
+
+// Add every dive in a memory image's logbook, serial is the unit's. Returns 0, or an errno.
+int cochran_archive_add_memory(cochran_archive_writer_t *w, const cochran_memory_t *mem, unsigned int serial) {
+	cochran_log_t log;
+	cochran_profile_t view;
+	int rc;
+
+	for (unsigned int n = 0; n < mem->log_count; n++) {
+		if (!cochran_memory_log(mem, n))
+			continue;
+
+		// The log is parsed even when the profile's been overwritten
+		if (cochran_memory_profile(mem, n, &log, &view))
+			memset(&view, 0, sizeof(view));
+
+		if ((rc = cochran_archive_add_dive(w, mem->model, serial, &log, view.data, view.size)))
+			return rc;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Start from the dives of an existing archive, so adding to it skips the
+ * ones it has. Profiles are copied as they are, their event indexes only
+ * hold for the archive's own table so the writer must be empty. Event
+ * names point into ar, keep it mapped until the write. Returns 0, or an
+ * errno.
+ */
+int cochran_archive_add_archive(cochran_archive_writer_t *w, const cochran_archive_t *ar) {
+	if (w->dive_count || w->event_count)
+		return EINVAL;
+
+	for (unsigned int n = 0; n < ar->dive_count; n++) {
+		const unsigned char *rec = ar->record + n * ARCHIVE_RECORD_SIZE;
+		uint64_t profile = array_uint32_le(rec + REC_PROFILE);
+		uint64_t profile_size = array_uint32_le(rec + REC_PROFILE_SIZE);
+
+		if (profile + profile_size > ar->profile_size)
+			return EINVAL;
+		if (grow((void **) &w->record, &w->dive_capacity, w->dive_count + 1, ARCHIVE_RECORD_SIZE)
+				|| grow((void **) &w->profile, &w->profile_capacity, w->profile_size + profile_size, 1))
+			return (w->error = ENOMEM);
+
+		unsigned char *copy = w->record + w->dive_count * ARCHIVE_RECORD_SIZE;
+		memcpy(copy, rec, ARCHIVE_RECORD_SIZE);
+		put32(copy + REC_PROFILE, w->profile_size);
+		memcpy(w->profile + w->profile_size, ar->profile + profile, profile_size);
+		w->profile_size += profile_size;
+		w->dive_count++;
+	}
+
+	memcpy(w->model, ar->model, sizeof(w->model));
+	w->serial = ar->serial;
+	for (unsigned int i = 0; i < ar->event_count; i++)
+		w->event[i] = ar->event[i];
+	w->event_count = ar->event_count;
+
+	return 0;
+}
+
+
+static int write_all(int fd, const void *buf, size_t len) {
+	const unsigned char *p = (const unsigned char *) buf;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+
+static void slot_insert(unsigned char *slot, unsigned int mask, uint32_t key, unsigned int n) {
+	unsigned int i = slot_hash(key) & mask;
+
+	while (array_uint32_le(slot + i * 4))
+		i = (i + 1) & mask;
+	put32(slot + i * 4, n + 1);
+}
+
+
+// Write the archive to fd. Returns 0, or an errno.
+int cochran_archive_write(cochran_archive_writer_t *w, int fd) {
+	unsigned char header[ARCHIVE_HEADER_SIZE];
+	unsigned int slot_count = 2;
+	uint64_t event_size = 0;
+
+	if (w->error)
+		return w->error;
+
+	while (slot_count < w->dive_count * 2)
+		slot_count *= 2;
+
+	for (unsigned int i = 0; i < w->event_count; i++)
+		event_size += strlen(w->event[i]) + 1;
+
+	uint64_t record = ARCHIVE_HEADER_SIZE;
+	uint64_t number_slot = record + (uint64_t) w->dive_count * ARCHIVE_RECORD_SIZE;
+	uint64_t fingerprint_slot = number_slot + slot_count * 4;
+	uint64_t event = fingerprint_slot + slot_count * 4;
+	uint64_t profile = event + event_size;
+
+	// Offsets are 32 bits
+	if (profile + w->profile_size > 0xffffffff)
+		return EFBIG;
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+	put32(header + HDR_VERSION, ARCHIVE_VERSION);
+	put32(header + HDR_DIVE_COUNT, w->dive_count);
+	memcpy(header + HDR_MODEL, w->model, sizeof(w->model));
+	put32(header + HDR_SLOT_COUNT, slot_count);
+	put32(header + HDR_RECORD, record);
+	put32(header + HDR_NUMBER_SLOT, number_slot);
+	put32(header + HDR_FINGERPRINT_SLOT, fingerprint_slot);
+	put32(header + HDR_EVENT, event);
+	put32(header + HDR_EVENT_COUNT, w->event_count);
+	put32(header + HDR_PROFILE, profile);
+	put32(header + HDR_PROFILE_SIZE, w->profile_size);
+	put32(header + HDR_SERIAL, w->serial);
+
+	unsigned char *slot = calloc(slot_count * 2, 4);
+	if (!slot)
+		return ENOMEM;
+
+	for (unsigned int n = 0; n < w->dive_count; n++) {
+		const unsigned char *rec = w->record + n * ARCHIVE_RECORD_SIZE;
+		slot_insert(slot, slot_count - 1, array_uint32_le(rec + REC_DIVE_NUM), n);
+		slot_insert(slot + slot_count * 4, slot_count - 1, array_uint32_le(rec + REC_TIMESTAMP), n);
+	}
+
+	int rc = write_all(fd, header, sizeof(header));
+	if (!rc)
+		rc = write_all(fd, w->record, w->dive_count * ARCHIVE_RECORD_SIZE);
+	if (!rc)
+		rc = write_all(fd, slot, slot_count * 8);
+	for (unsigned int i = 0; !rc && i < w->event_count; i++)
+		rc = write_all(fd, w->event[i], strlen(w->event[i]) + 1);
+	if (!rc)
+		rc = write_all(fd, w->profile, w->profile_size);
+
+	free(slot);
+	return rc;
+}
+
+
+/*
+ * Reader
+ */
+
+// Check an archive's header and tables, data stays the caller's
+int cochran_archive_init(cochran_archive_t *ar, const unsigned char *data, size_t size) {
+	memset(ar, 0, sizeof(*ar));
+
+	if (size < ARCHIVE_HEADER_SIZE || memcmp(data, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC))) {
+		dprintf(STDERR_FILENO, "Not a dive archive\n");
+		return -1;
+	}
+
+	if (array_uint32_le(data + HDR_VERSION) != ARCHIVE_VERSION) {
+		dprintf(STDERR_FILENO, "Unsupported archive version %u\n", array_uint32_le(data + HDR_VERSION));
+		return -1;
+	}
+
+	uint64_t dive_count = array_uint32_le(data + HDR_DIVE_COUNT);
+	uint64_t slot_count = array_uint32_le(data + HDR_SLOT_COUNT);
+	uint64_t record = array_uint32_le(data + HDR_RECORD);
+	uint64_t number_slot = array_uint32_le(data + HDR_NUMBER_SLOT);
+	uint64_t fingerprint_slot = array_uint32_le(data + HDR_FINGERPRINT_SLOT);
+	uint64_t event = array_uint32_le(data + HDR_EVENT);
+	uint64_t event_count = array_uint32_le(data + HDR_EVENT_COUNT);
+	uint64_t profile = array_uint32_le(data + HDR_PROFILE);
+	uint64_t profile_size = array_uint32_le(data + HDR_PROFILE_SIZE);
+
+	// Every slot table needs an empty slot to end a probe
+	if (slot_count <= dive_count || (slot_count & (slot_count - 1))
+			|| record + dive_count * ARCHIVE_RECORD_SIZE > size
+			|| number_slot + slot_count * 4 > size
+			|| fingerprint_slot + slot_count * 4 > size
+			|| event > profile || profile + profile_size > size
+			|| event_count > ARCHIVE_MAX_EVENTS) {
+		dprintf(STDERR_FILENO, "Dive archive is damaged\n");
+		return -1;
+	}
+
+	// Event names, each ends before the profiles
+	const unsigned char *p = data + event, *end = data + profile;
+	for (unsigned int i = 0; i < event_count; i++) {
+		const unsigned char *nul = memchr(p, 0, end - p);
+		if (!nul) {
+			dprintf(STDERR_FILENO, "Dive archive is damaged\n");
+			return -1;
+		}
+		ar->event[i] = (const char *) p;
+		p = nul + 1;
+	}
+
+	ar->data = data;
+	ar->size = size;
+	ar->dive_count = dive_count;
+	memcpy(ar->model, data + HDR_MODEL, sizeof(ar->model));
+	ar->model[sizeof(ar->model) - 1] = 0;
+	ar->serial = array_uint32_le(data + HDR_SERIAL);
+	ar->slot_mask = slot_count - 1;
+	ar->record = data + record;
+	ar->number_slot = data + number_slot;
+	ar->fingerprint_slot = data + fingerprint_slot;
+	ar->profile = data + profile;
+	ar->profile_size = profile_size;
+	ar->event_count = event_count;
+
+	return 0;
+}
+
+
+int cochran_archive_map(cochran_archive_t *ar, const char *file) {
+	struct stat st;
+
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		dprintf(STDERR_FILENO, "%s: Unable to open %s\n", strerror(errno), file);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		dprintf(STDERR_FILENO, "Archive %s is empty\n", file);
+		close(fd);
+		return -1;
+	}
+
+	unsigned char *data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		dprintf(STDERR_FILENO, "%s: Unable to map %s\n", strerror(errno), file);
+		return -1;
+	}
+
+	if (cochran_archive_init(ar, data, st.st_size)) {
+		munmap(data, st.st_size);
+		return -1;
+	}
+
+	ar->map_size = st.st_size;
+	return 0;
+}
+
+
+void cochran_archive_unmap(cochran_archive_t *ar) {
+	if (ar->map_size)
+		munmap((void *) ar->data, ar->map_size);
+	ar->data = NULL;
+	ar->map_size = 0;
+}
+
+
+static int slot_find(const cochran_archive_t *ar, const unsigned char *slot, unsigned int field, uint32_t key) {
+	unsigned int i = slot_hash(key) & ar->slot_mask;
+
+	for (unsigned int probe = 0; probe <= ar->slot_mask; probe++) {
+		unsigned int n = array_uint32_le(slot + i * 4);
+		if (!n)
+			return -1;
+		if (n <= ar->dive_count && array_uint32_le(ar->record + (n - 1) * ARCHIVE_RECORD_SIZE + field) == key)
+			return n - 1;
+		i = (i + 1) & ar->slot_mask;
+	}
+
+	return -1;
+}
+
+
+// Record of dive number dive_num, -1 if it isn't archived
+int cochran_archive_find_dive(const cochran_archive_t *ar, unsigned int dive_num) {
+	return slot_find(ar, ar->number_slot, REC_DIVE_NUM, dive_num);
+}
+
+
+// Record of the dive that started at fingerprint, -1 if it isn't archived
+int cochran_archive_find_fingerprint(const cochran_archive_t *ar, uint32_t fingerprint) {
+	return slot_find(ar, ar->fingerprint_slot, REC_TIMESTAMP, fingerprint);
+}
+
+
+// The log fields record n keeps, the rest are zero
+int cochran_archive_log(const cochran_archive_t *ar, unsigned int n, cochran_log_t *log) {
+	if (n >= ar->dive_count)
+		return -1;
+
+	const unsigned char *rec = ar->record + n * ARCHIVE_RECORD_SIZE;
+
+	memset(log, 0, sizeof(*log));
+	log->dive_num = array_uint32_le(rec + REC_DIVE_NUM);
+	log->rep_dive_num = array_uint32_le(rec + REC_REP_DIVE_NUM);
+	log->timestamp_start = (time_t) (int64_t) ((uint64_t) array_uint32_le(rec + REC_TIMESTAMP)
+			| (uint64_t) array_uint32_le(rec + REC_TIMESTAMP + 4) << 32);
+	log->time_start.tm_year = array_uint16_le(rec + REC_YEAR) - 1900;
+	log->time_start.tm_mon = rec[REC_MONTH] - 1;
+	log->time_start.tm_mday = rec[REC_DAY];
+	log->time_start.tm_hour = rec[REC_HOUR];
+	log->time_start.tm_min = rec[REC_MINUTE];
+	log->time_start.tm_sec = rec[REC_SECOND];
+	log->conservatism = rec[REC_CONSERVATISM];
+	log->voltage_start = get_float(rec + REC_VOLTAGE_START);
+	log->voltage_end = get_float(rec + REC_VOLTAGE_END);
+	log->profile_pre = array_uint32_le(rec + REC_PROFILE_PRE);
+	log->profile_begin = array_uint32_le(rec + REC_PROFILE_BEGIN);
+	log->profile_end = array_uint32_le(rec + REC_PROFILE_END);
+	log->sit = array_uint32_le(rec + REC_SIT);
+	log->bt = array_uint16_le(rec + REC_BT);
+	log->profile_interval = array_uint16_le(rec + REC_INTERVAL);
+	log->depth_max = get_float(rec + REC_DEPTH_MAX);
+	log->depth_avg = get_float(rec + REC_DEPTH_AVG);
+	log->temp_min = get_float(rec + REC_TEMP_MIN);
+	log->temp_avg = get_float(rec + REC_TEMP_AVG);
+	log->temp_start = get_float(rec + REC_TEMP_START);
+	log->mix[0].o2 = get_float(rec + REC_O2);
+	log->mix[0].he = get_float(rec + REC_HE);
+	log->tank_pressure_start = array_uint16_le(rec + REC_TANK_PRESSURE_START);
+	log->tank_pressure_end = array_uint16_le(rec + REC_TANK_PRESSURE_END);
+	log->ascent_rate_max = array_uint16_le(rec + REC_ASCENT_RATE_MAX);
+	log->ndl_min = array_uint16_le(rec + REC_NDL_MIN);
+	log->deco_max = array_uint16_le(rec + REC_DECO_MAX);
+	log->deco_missed = array_uint16_le(rec + REC_DECO_MISSED);
+	log->event_count = array_uint16_le(rec + REC_EVENT_COUNT);
+
+	return 0;
+}
+
+
+static int get_varint(const unsigned char **p, const unsigned char *end, uint32_t *v) {
+	*v = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (*p == end)
+			return -1;
+		unsigned char b = *(*p)++;
+		*v |= (uint32_t) (b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return 0;
+	}
+	return -1;
+}
+
+
+typedef struct archive_events_t {
+	const unsigned char *p, *end;
+	uint32_t left;
+	int time;
+	const char *name;
+} archive_events_t;
+
+
+// Read the next event, 0 when there are none left, -1 if it's damaged
+static int next_event(const cochran_archive_t *ar, archive_events_t *ev) {
+	uint32_t delta, name;
+
+	if (!ev->left)
+		return 0;
+	if (get_varint(&ev->p, ev->end, &delta) || get_varint(&ev->p, ev->end, &name) || name >= ar->event_count)
+		return -1;
+
+	ev->left--;
+	ev->time += unzigzag(delta);
+	ev->name = ar->event[name];
+	return 1;
+}
+
+
+static int emit(cochran_sample_callback_t callback, void *userdata, int time, cochran_sample_type_t type, double value, const char *event) {
+	cochran_sample_t sample;
+
+	memset(&sample, 0, sizeof(sample));
+	sample.type = type;
+	switch (type) {
+	case SAMPLE_DEPTH:
+		sample.value.depth = value;
+		break;
+	case SAMPLE_TEMP:
+		sample.value.temp = value;
+		break;
+	case SAMPLE_TANK_PRESSURE:
+		sample.value.tank_pressure = value;
+		break;
+	default:
+		sample.value.event = event;
+		break;
+	}
+
+	return callback(time, &sample, userdata);
+}
+
+
+/*
+ * Decode dive n's profile as samples, the same callback the parsers
+ * drive. Every row gives a depth, temp and tank pressure only when
+ * they change and events at their time. Returns 0, -1 if the profile
+ * is damaged or the callback's non zero return.
+ */
+int cochran_archive_samples(const cochran_archive_t *ar, unsigned int n, cochran_sample_callback_t callback, void *userdata) {
+	if (n >= ar->dive_count)
+		return -1;
+
+	const unsigned char *rec = ar->record + n * ARCHIVE_RECORD_SIZE;
+	unsigned int offset = array_uint32_le(rec + REC_PROFILE);
+	unsigned int size = array_uint32_le(rec + REC_PROFILE_SIZE);
+
+	if (offset > ar->profile_size || size > ar->profile_size - offset)
+		return -1;
+
+	const unsigned char *p = ar->profile + offset, *end = p + size;
+	unsigned int columns = (array_uint16_le(rec + REC_FLAGS) & ARCHIVE_TANK_PRESSURE) ? 4 : 3;
+	const unsigned char *column[4];
+	uint32_t rows, v;
+
+	if (get_varint(&p, end, &rows))
+		return -1;
+
+	// Find where each column starts, they're then read side by side
+	for (unsigned int c = 0; c < columns; c++) {
+		column[c] = p;
+		for (uint32_t r = 0; r < rows; r++)
+			if (get_varint(&p, end, &v))
+				return -1;
+	}
+
+	archive_events_t ev = { .end = end };
+	if (get_varint(&p, end, &ev.left))
+		return -1;
+	ev.p = p;
+
+	int32_t value[4] = { 0, 0, 0, 0 };		// time then the row's values
+	int32_t temp = 0, tank_pressure = 0;
+	int have_event = next_event(ar, &ev);
+	int rc = 0;
+
+	for (uint32_t r = 0; r < rows && !rc && have_event >= 0; r++) {
+		for (unsigned int c = 0; c < columns; c++) {
+			get_varint(&column[c], end, &v);
+			value[c] += unzigzag(v);
+		}
+
+		// Events logged before the row, then the row, then the row's own
+		while (!rc && have_event > 0 && ev.time < value[0]) {
+			rc = emit(callback, userdata, ev.time, SAMPLE_EVENT, 0, ev.name);
+			have_event = next_event(ar, &ev);
+		}
+
+		if (!rc)
+			rc = emit(callback, userdata, value[0], SAMPLE_DEPTH, value[1 + COL_DEPTH] / (double) ARCHIVE_SCALE, NULL);
+		if (!rc && (!r || value[1 + COL_TEMP] != temp))
+			rc = emit(callback, userdata, value[0], SAMPLE_TEMP, value[1 + COL_TEMP] / (double) ARCHIVE_SCALE, NULL);
+		if (!rc && columns == 4 && (!r || value[1 + COL_TANK_PRESSURE] != tank_pressure))
+			rc = emit(callback, userdata, value[0], SAMPLE_TANK_PRESSURE, value[1 + COL_TANK_PRESSURE] / (double) ARCHIVE_SCALE, NULL);
+		temp = value[1 + COL_TEMP];
+		tank_pressure = value[1 + COL_TANK_PRESSURE];
+
+		while (!rc && have_event > 0 && ev.time == value[0]) {
+			rc = emit(callback, userdata, ev.time, SAMPLE_EVENT, 0, ev.name);
+			have_event = next_event(ar, &ev);
+		}
+	}
+
+	while (!rc && have_event > 0) {
+		rc = emit(callback, userdata, ev.time, SAMPLE_EVENT, 0, ev.name);
+		have_event = next_event(ar, &ev);
+	}
+
+	return (rc ? rc : (have_event < 0 ? -1 : 0));
+}
@@ -0,0 +1,117 @@
+/*
+ * cochran_archive.h
+ *
+ * A file of decoded dives, built once from CAN, WAN or ANA files or
+ * memory images so readers never see the cipher or a model's sample
+ * format again. It's meant to be mapped, a dive is found by number or
+ * fingerprint (its start timestamp) through a hash slot and its profile
+ * is one contiguous block.
+ *
+ * All values little endian, offsets from the start of the file:
+ *
+ * 0x00 header, ARCHIVE_HEADER_SIZE bytes
+ *   0x00 magic "COCHDIV\0"
+ *   0x08 version
+ *   0x0c dive count
+ *   0x10 model
+ *   0x14 slot count, a power of two at least twice the dive count
+ *   0x18 record, number slot, fingerprint slot and event offsets
+ *   0x28 event count
+ *   0x2c profile offset and size
+ *   0x34 unit serial, 0 when the dives' source didn't say
+ * records, ARCHIVE_RECORD_SIZE bytes a dive, the log summary and where
+ *   its profile is. The start is kept as the log's date and time, its
+ *   timestamp is ticks that only some models count from the Unix epoch.
+ *   Of the log, a record keeps the numbers, start, SIT, BT, depths,
+ *   temps, first mix, tank pressures, ascent rate, NDL, deco, voltage,
+ *   conservatism and profile pointers. The pre-dive timestamp, start
+ *   depth, when minimums and maximums happened, gas consumption, deco
+ *   actual and ceilings, no fly times, altitude, water conductivity,
+ *   alarms, the other mixes and tissues aren't kept and read back as 0.
+ * number slots, then fingerprint slots, a record index + 1 each, 0 is
+ *   empty, collisions take the next slot
+ * events, NUL terminated names the profiles' events index
+ * profiles, a dive's is a row count then the columns of time, depth,
+ *   temp and, if the dive logged it, tank pressure. Each is delta and
+ *   zigzag varint coded, depth, temp and pressure in 1/ARCHIVE_SCALE
+ *   units, fine enough to keep every parser's resolution. Then an event
+ *   count and each event's time delta and name index.
+ *
+ * Profiles keep depth, temp, tank pressure and events, a row per
+ * sample time, values carried forward. Units are the logs', feet, F
+ * and PSI.
+ *
+ * Include <stdint.h>, cochran_log.h, cochran_sample.h and
+ * cochran_memory.h first.
+ */
+
+#define ARCHIVE_MAGIC "COCHDIV"
+#define ARCHIVE_VERSION 3
+#define ARCHIVE_HEADER_SIZE 64
+#define ARCHIVE_RECORD_SIZE 112
+#define ARCHIVE_MAX_EVENTS 255
+#define ARCHIVE_SCALE 256
+
+// Record flags
+#define ARCHIVE_TANK_PRESSURE 1
+
+typedef struct cochran_archive_t {
+	const unsigned char *data;
+	size_t size;
+	unsigned int dive_count;
+	char model[4];
+	unsigned int serial;
+	unsigned int slot_mask;
+	const unsigned char *record;
+	const unsigned char *number_slot;
+	const unsigned char *fingerprint_slot;
+	const unsigned char *profile;
+	unsigned int profile_size;
+	const char *event[ARCHIVE_MAX_EVENTS];
+	unsigned int event_count;
+	size_t map_size;				// Set when cochran_archive_map() mapped the file
+} cochran_archive_t;
+
+// One row of a profile, values carried forward from earlier rows
+typedef struct cochran_archive_row_t {
+	int time;						// seconds
+	int32_t value[3];				// depth, temp, tank pressure in 1/ARCHIVE_SCALE
+} cochran_archive_row_t;
+
+typedef struct cochran_archive_event_t {
+	int time;
+	unsigned int name;				// Index into the event table
+} cochran_archive_event_t;
+
+typedef struct cochran_archive_writer_t {
+	char model[4];
+	unsigned int serial;
+	unsigned char *record;
+	unsigned int dive_count, dive_capacity;
+	unsigned char *profile;
+	unsigned int profile_size, profile_capacity;
+	const char *event[ARCHIVE_MAX_EVENTS];	// The parser's own strings
+	unsigned int event_count;
+	cochran_archive_row_t *row;		// Scratch for the dive being added
+	unsigned int rows, row_capacity;
+	cochran_archive_event_t *dive_event;
+	unsigned int dive_events, dive_event_capacity;
+	unsigned int skipped;			// Dives already in the archive
+	int error;						// Set when an allocation failed
+} cochran_archive_writer_t;
+
+int cochran_archive_writer_init(cochran_archive_writer_t *w);
+void cochran_archive_writer_free(cochran_archive_writer_t *w);
+int cochran_archive_add_dive(cochran_archive_writer_t *w, const char *model, unsigned int serial, const cochran_log_t *log, const unsigned char *data[2], const unsigned int size[2]);
+int cochran_archive_add_can(cochran_archive_writer_t *w, const char *file);
+int cochran_archive_add_memory(cochran_archive_writer_t *w, const cochran_memory_t *mem, unsigned int serial);
+int cochran_archive_add_archive(cochran_archive_writer_t *w, const cochran_archive_t *ar);
+int cochran_archive_write(cochran_archive_writer_t *w, int fd);
+
+int cochran_archive_init(cochran_archive_t *ar, const unsigned char *data, size_t size);
+int cochran_archive_map(cochran_archive_t *ar, const char *file);
+void cochran_archive_unmap(cochran_archive_t *ar);
+int cochran_archive_find_dive(const cochran_archive_t *ar, unsigned int dive_num);
+int cochran_archive_find_fingerprint(const cochran_archive_t *ar, uint32_t fingerprint);
+int cochran_archive_log(const cochran_archive_t *ar, unsigned int n, cochran_log_t *log);
+int cochran_archive_samples(const cochran_archive_t *ar, unsigned int n, cochran_sample_callback_t callback, void *userdata);
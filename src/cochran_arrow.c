@@ -0,0 +1,571 @@
+/*
+ * cochran_arrow.c
+ *
+ * Arrow C Data Interface producer for logbooks and profiles.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "cochran_log.h"
+#include "cochran_sample.h"
+#include "cochran_can.h"
+#include "cochran_arrow.h"
+
+enum {
+	LOG_DIVE_ID, LOG_DIVE, LOG_REP, LOG_START, LOG_SIT, LOG_BT,
+	LOG_DEPTH_MAX, LOG_DEPTH_AVG, LOG_TEMP_MIN, LOG_TEMP_START,
+	LOG_TANK_PRESSURE_START, LOG_TANK_PRESSURE_END, LOG_NDL_MIN, LOG_DECO_MAX,
+	LOG_INTERVAL, LOG_VOLTAGE, LOG_CONSERVATISM, LOG_O2, LOG_HE,
+	LOG_PROFILE_PRE, LOG_PROFILE_BEGIN, LOG_PROFILE_END,
+	LOG_COLUMNS
+};
+
+static const cochran_arrow_column_t logbook_columns[LOG_COLUMNS] = {
+	{ .name = "dive_id",				.format = "I",		.width = 4 },
+	{ .name = "dive",					.format = "I",		.width = 4 },
+	{ .name = "rep",					.format = "I",		.width = 4 },
+	{ .name = "start",					.format = "tss:",	.width = 8 },	// Wall clock, no zone
+	{ .name = "sit",					.format = "I",		.width = 4 },	// minutes
+	{ .name = "bt",						.format = "I",		.width = 4 },	// minutes
+	{ .name = "depth_max",				.format = "f",		.width = 4 },
+	{ .name = "depth_avg",				.format = "f",		.width = 4 },
+	{ .name = "temp_min",				.format = "f",		.width = 4 },
+	{ .name = "temp_start",				.format = "f",		.width = 4 },
+	{ .name = "tank_pressure_start",	.format = "I",		.width = 4 },
+	{ .name = "tank_pressure_end",		.format = "I",		.width = 4 },
+	{ .name = "ndl_min",				.format = "I",		.width = 4 },
+	{ .name = "deco_max",				.format = "I",		.width = 4 },
+	{ .name = "interval",				.format = "i",		.width = 4 },	// seconds
+	{ .name = "voltage",				.format = "f",		.width = 4 },
+	{ .name = "conservatism",			.format = "i",		.width = 4 },
+	{ .name = "o2",						.format = "f",		.width = 4 },
+	{ .name = "he",						.format = "f",		.width = 4 },
+	{ .name = "profile_pre",			.format = "I",		.width = 4 },
+	{ .name = "profile_begin",			.format = "I",		.width = 4 },
+	{ .name = "profile_end",			.format = "I",		.width = 4 },
+};
+
+enum {
+	SMP_DIVE_ID, SMP_TIME, SMP_DEPTH, SMP_TEMP, SMP_ASCENT_RATE, SMP_TANK_PRESSURE, SMP_EVENT,
+	SMP_COLUMNS
+};
+
+static const cochran_arrow_column_t sample_columns[SMP_COLUMNS] = {
+	{ .name = "dive_id",		.format = "I",	.width = 4 },
+	{ .name = "time",			.format = "i",	.width = 4 },	// seconds
+	{ .name = "depth",			.format = "g",	.width = 8, .nullable = 1 },
+	{ .name = "temp",			.format = "g",	.width = 8, .nullable = 1 },
+	{ .name = "ascent_rate",	.format = "g",	.width = 8, .nullable = 1 },
+	{ .name = "tank_pressure",	.format = "g",	.width = 8, .nullable = 1 },
+	{ .name = "event",			.format = "s",	.width = 2, .nullable = 1 },	// Index into the event dictionary
+};
+
+// The sample being gathered, a row of the samples table
+typedef struct arrow_row_t {
+	cochran_arrow_t *ab;
+	unsigned int dive_id;
+	int time;
+	unsigned int have;				// Bit per sample column set
+	double value[SMP_COLUMNS];
+	int event;
+} arrow_row_t;
+
+
+static int table_init(cochran_arrow_table_t *t, const cochran_arrow_column_t *columns, unsigned int count) {
+	memset(t, 0, sizeof(*t));
+
+	t->column = malloc(count * sizeof(cochran_arrow_column_t));
+	if (!t->column)
+		return -1;
+	memcpy(t->column, columns, count * sizeof(cochran_arrow_column_t));
+	t->column_count = count;
+
+	return 0;
+}
+
+
+static void table_clear(cochran_arrow_table_t *t) {
+	for (unsigned int c = 0; c < t->column_count; c++) {
+		t->column[c].data = NULL;
+		t->column[c].validity = NULL;
+		t->column[c].null_count = 0;
+	}
+	t->rows = t->capacity = 0;
+}
+
+
+static void table_free(cochran_arrow_table_t *t) {
+	if (!t->column)
+		return;
+
+	for (unsigned int c = 0; c < t->column_count; c++) {
+		free(t->column[c].data);
+		free(t->column[c].validity);
+	}
+	free(t->column);
+	t->column = NULL;
+}
+
+
+// Room for another row, returns its index or -1
+static int64_t table_row(cochran_arrow_t *ab, cochran_arrow_table_t *t) {
+	if (ab->error)
+		return -1;
+
+	if (t->rows == t->capacity) {
+		int64_t capacity = (t->capacity ? t->capacity * 2 : 4096);
+
+		for (unsigned int c = 0; c < t->column_count; c++) {
+			cochran_arrow_column_t *col = &t->column[c];
+			unsigned char *data = realloc(col->data, capacity * col->width);
+
+			if (!data) {
+				ab->error = ENOMEM;
+				return -1;
+			}
+			col->data = data;
+
+			if (col->nullable) {
+				unsigned char *validity = realloc(col->validity, capacity / 8);
+				if (!validity) {
+					ab->error = ENOMEM;
+					return -1;
+				}
+				memset(validity + t->capacity / 8, 0, (capacity - t->capacity) / 8);
+				col->validity = validity;
+			}
+		}
+		t->capacity = capacity;
+	}
+
+	return t->rows++;
+}
+
+
+static void column_set(cochran_arrow_column_t *col, int64_t row, const void *value) {
+	memcpy(col->data + row * col->width, value, col->width);
+	if (col->validity)
+		col->validity[row / 8] |= 1 << (row % 8);
+}
+
+
+static void column_null(cochran_arrow_column_t *col, int64_t row) {
+	memset(col->data + row * col->width, 0, col->width);
+	col->null_count++;
+}
+
+
+#define SET(t, c, row, type, v) do { type _v = (v); column_set(&(t)->column[c], row, &_v); } while (0)
+
+
+/*
+ * Seconds since 1970 of a broken-down wall clock time, as timegm() without
+ * the zone. Years start in March so the leap day comes last, tm_mon counts
+ * from 0 so March is 2. 2014-06-08 00:00:00 is 1402185600.
+ */
+static int64_t wall_clock(const struct tm *t) {
+	int64_t y = t->tm_year + 1900 - (t->tm_mon < 2);
+	int64_t m = (t->tm_mon + 10) % 12;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	int64_t yoe = y - era * 400;
+	int64_t doy = (153 * m + 2) / 5 + t->tm_mday - 1;
+	int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	int64_t days = era * 146097 + doe - 719468;
+
+	return days * 86400 + t->tm_hour * 3600 + t->tm_min * 60 + t->tm_sec;
+}
+
+
+int cochran_arrow_init(cochran_arrow_t *ab) {
+	memset(ab, 0, sizeof(*ab));
+
+	if (table_init(&ab->logbook, logbook_columns, LOG_COLUMNS)
+			|| table_init(&ab->samples, sample_columns, SMP_COLUMNS)) {
+		cochran_arrow_free(ab);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void cochran_arrow_free(cochran_arrow_t *ab) {
+	table_free(&ab->logbook);
+	table_free(&ab->samples);
+}
+
+
+static void add_log(cochran_arrow_t *ab, unsigned int dive_id, const cochran_log_t *log) {
+	cochran_arrow_table_t *t = &ab->logbook;
+	int64_t r = table_row(ab, t);
+
+	if (r < 0)
+		return;
+
+	SET(t, LOG_DIVE_ID, r, uint32_t, dive_id);
+	SET(t, LOG_DIVE, r, uint32_t, log->dive_num);
+	SET(t, LOG_REP, r, uint32_t, log->rep_dive_num);
+	SET(t, LOG_START, r, int64_t, wall_clock(&log->time_start));
+	SET(t, LOG_SIT, r, uint32_t, log->sit);
+	SET(t, LOG_BT, r, uint32_t, log->bt);
+	SET(t, LOG_DEPTH_MAX, r, float, log->depth_max);
+	SET(t, LOG_DEPTH_AVG, r, float, log->depth_avg);
+	SET(t, LOG_TEMP_MIN, r, float, log->temp_min);
+	SET(t, LOG_TEMP_START, r, float, log->temp_start);
+	SET(t, LOG_TANK_PRESSURE_START, r, uint32_t, log->tank_pressure_start);
+	SET(t, LOG_TANK_PRESSURE_END, r, uint32_t, log->tank_pressure_end);
+	SET(t, LOG_NDL_MIN, r, uint32_t, log->ndl_min);
+	SET(t, LOG_DECO_MAX, r, uint32_t, log->deco_max);
+	SET(t, LOG_INTERVAL, r, int32_t, log->profile_interval);
+	SET(t, LOG_VOLTAGE, r, float, log->voltage_start);
+	SET(t, LOG_CONSERVATISM, r, int32_t, log->conservatism);
+	SET(t, LOG_O2, r, float, log->mix[0].o2);
+	SET(t, LOG_HE, r, float, log->mix[0].he);
+	SET(t, LOG_PROFILE_PRE, r, uint32_t, log->profile_pre);
+	SET(t, LOG_PROFILE_BEGIN, r, uint32_t, log->profile_begin);
+	SET(t, LOG_PROFILE_END, r, uint32_t, log->profile_end);
+}
+
+
+static void row_flush(arrow_row_t *row) {
+	cochran_arrow_table_t *t = &row->ab->samples;
+
+	if (!row->have)
+		return;
+
+	int64_t r = table_row(row->ab, t);
+	if (r >= 0) {
+		SET(t, SMP_DIVE_ID, r, uint32_t, row->dive_id);
+		SET(t, SMP_TIME, r, int32_t, row->time);
+
+		for (int c = SMP_DEPTH; c <= SMP_TANK_PRESSURE; c++) {
+			if (row->have & (1 << c))
+				SET(t, c, r, double, row->value[c]);
+			else
+				column_null(&t->column[c], r);
+		}
+
+		if (row->have & (1 << SMP_EVENT))
+			SET(t, SMP_EVENT, r, int16_t, row->event);
+		else
+			column_null(&t->column[SMP_EVENT], r);
+	}
+
+	row->have = 0;
+}
+
+
+// Dictionary index of an event, the parser hands out the same string for the same event
+static int event_index(cochran_arrow_t *ab, const char *event) {
+	for (unsigned int i = 0; i < ab->event_count; i++)
+		if (ab->event[i] == event)
+			return i;
+
+	if (ab->event_count == ARROW_MAX_EVENTS)
+		return -1;
+
+	ab->event[ab->event_count] = event;
+	return ab->event_count++;
+}
+
+
+static int arrow_sample_cb(int time, cochran_sample_t *sample, void *userdata) {
+	arrow_row_t *row = (arrow_row_t *) userdata;
+	int column;
+	double value;
+
+	if (time != row->time) {
+		row_flush(row);
+		row->time = time;
+	}
+
+	switch (sample->type) {
+	case SAMPLE_DEPTH:
+		column = SMP_DEPTH;
+		value = sample->value.depth;
+		break;
+	case SAMPLE_TEMP:
+		column = SMP_TEMP;
+		value = sample->value.temp;
+		break;
+	case SAMPLE_ASCENT_RATE:
+		column = SMP_ASCENT_RATE;
+		value = sample->value.ascent_rate;
+		break;
+	case SAMPLE_TANK_PRESSURE:
+		column = SMP_TANK_PRESSURE;
+		value = sample->value.tank_pressure;
+		break;
+	case SAMPLE_EVENT:
+		if (!sample->value.event)
+			return 0;
+		// Two events at one time get a row each
+		if (row->have & (1 << SMP_EVENT))
+			row_flush(row);
+		row->event = event_index(row->ab, sample->value.event);
+		if (row->event >= 0)
+			row->have |= 1 << SMP_EVENT;
+		return 0;
+	default:
+		return 0;
+	}
+
+	row->value[column] = value;
+	row->have |= 1 << column;
+	return 0;
+}
+
+
+/*
+ * Add a dive's log and its samples, in up to two segments as the
+ * profile ring gives them. dive_id ties the samples to the logbook row.
+ */
+int cochran_arrow_add_dive(cochran_arrow_t *ab, unsigned int dive_id, const char *model, const cochran_log_t *log, const unsigned char *data[2], const unsigned int size[2]) {
+	arrow_row_t row = { .ab = ab, .dive_id = dive_id };
+
+	add_log(ab, dive_id, log);
+
+	if (size[0] + size[1] > 2)
+		cochran_sample_parse_segments((const unsigned char *) model, log, data, size, arrow_sample_cb, &row);
+	row_flush(&row);
+
+	return ab->error;
+}
+
+
+static void release_schema(struct ArrowSchema *schema) {
+	for (int64_t i = 0; i < schema->n_children; i++) {
+		schema->children[i]->release(schema->children[i]);
+		free(schema->children[i]);
+	}
+	free(schema->children);
+
+	if (schema->dictionary) {
+		schema->dictionary->release(schema->dictionary);
+		free(schema->dictionary);
+	}
+
+	schema->release = NULL;
+}
+
+
+static void release_array(struct ArrowArray *array) {
+	for (int64_t i = 0; i < array->n_buffers; i++)
+		free((void *) array->buffers[i]);
+	free(array->buffers);
+
+	for (int64_t i = 0; i < array->n_children; i++) {
+		array->children[i]->release(array->children[i]);
+		free(array->children[i]);
+	}
+	free(array->children);
+
+	if (array->dictionary) {
+		array->dictionary->release(array->dictionary);
+		free(array->dictionary);
+	}
+
+	array->release = NULL;
+}
+
+
+static int make_node(struct ArrowSchema *schema, struct ArrowArray *array, const char *format, const char *name, int64_t flags, int64_t length, int n_buffers, int n_children) {
+	memset(schema, 0, sizeof(*schema));
+	memset(array, 0, sizeof(*array));
+
+	schema->format = format;
+	schema->name = name;
+	schema->flags = flags;
+	schema->n_children = n_children;
+	schema->release = release_schema;
+
+	array->length = length;
+	array->n_buffers = n_buffers;
+	array->n_children = n_children;
+	array->release = release_array;
+
+	array->buffers = calloc(n_buffers, sizeof(void *));
+	if (n_children) {
+		schema->children = calloc(n_children, sizeof(struct ArrowSchema *));
+		array->children = calloc(n_children, sizeof(struct ArrowArray *));
+	}
+
+	if (!array->buffers || (n_children && (!schema->children || !array->children))) {
+		schema->n_children = array->n_children = 0;
+		return -1;
+	}
+	return 0;
+}
+
+
+// The event strings as a utf8 array, the samples' event column indexes it
+static int make_dictionary(cochran_arrow_t *ab, struct ArrowSchema *schema, struct ArrowArray *array) {
+	unsigned int length = 0;
+
+	if (make_node(schema, array, "u", NULL, 0, ab->event_count, 3, 0))
+		return -1;
+
+	for (unsigned int i = 0; i < ab->event_count; i++)
+		length += strlen(ab->event[i]);
+
+	int32_t *offsets = malloc((ab->event_count + 1) * sizeof(int32_t));
+	char *chars = malloc(length ? length : 1);
+	if (!offsets || !chars) {
+		free(offsets);
+		free(chars);
+		return -1;
+	}
+
+	offsets[0] = 0;
+	for (unsigned int i = 0; i < ab->event_count; i++) {
+		unsigned int n = strlen(ab->event[i]);
+		memcpy(chars + offsets[i], ab->event[i], n);
+		offsets[i + 1] = offsets[i] + n;
+	}
+
+	array->buffers[1] = offsets;
+	array->buffers[2] = chars;
+	return 0;
+}
+
+
+/*
+ * Hand the table's columns over as a struct array. The buffers go with
+ * it, the table starts empty again. Call the release callbacks when done.
+ */
+static int table_export(cochran_arrow_t *ab, cochran_arrow_table_t *t, struct ArrowSchema *schema, struct ArrowArray *array) {
+	if (ab->error)
+		return ab->error;
+
+	if (make_node(schema, array, "+s", "", 0, t->rows, 1, t->column_count))
+		goto fail;
+
+	for (unsigned int c = 0; c < t->column_count; c++) {
+		cochran_arrow_column_t *col = &t->column[c];
+		struct ArrowSchema *cs = malloc(sizeof(struct ArrowSchema));
+		struct ArrowArray *ca = malloc(sizeof(struct ArrowArray));
+
+		schema->children[c] = cs;
+		array->children[c] = ca;
+		if (!cs || !ca || make_node(cs, ca, col->format, col->name, col->nullable ? ARROW_FLAG_NULLABLE : 0, t->rows, 2, 0)) {
+			// Leave the rest out so release only sees what was made
+			schema->n_children = array->n_children = c + (cs && ca);
+			if (!cs || !ca) {
+				free(cs);
+				free(ca);
+			}
+			goto fail;
+		}
+
+		ca->null_count = col->null_count;
+		ca->buffers[0] = col->null_count ? col->validity : NULL;
+		ca->buffers[1] = col->data;
+		if (!col->null_count)
+			free(col->validity);
+		col->data = col->validity = NULL;
+
+		if (c == SMP_EVENT && t == &ab->samples) {
+			cs->dictionary = malloc(sizeof(struct ArrowSchema));
+			ca->dictionary = malloc(sizeof(struct ArrowArray));
+			if (!cs->dictionary || !ca->dictionary || make_dictionary(ab, cs->dictionary, ca->dictionary)) {
+				if (!cs->dictionary || !ca->dictionary) {
+					free(cs->dictionary);
+					free(ca->dictionary);
+					cs->dictionary = NULL;
+					ca->dictionary = NULL;
+				}
+				goto fail;
+			}
+		}
+	}
+
+	table_clear(t);
+	return 0;
+
+fail:
+	if (schema->release)
+		schema->release(schema);
+	if (array->release)
+		array->release(array);
+	table_free(t);
+	ab->error = ENOMEM;
+	return ab->error;
+}
+
+
+int cochran_arrow_export_logbook(cochran_arrow_t *ab, struct ArrowSchema *schema, struct ArrowArray *array) {
+	return table_export(ab, &ab->logbook, schema, array);
+}
+
+
+int cochran_arrow_export_samples(cochran_arrow_t *ab, struct ArrowSchema *schema, struct ArrowArray *array) {
+	int rc = table_export(ab, &ab->samples, schema, array);
+
+	if (!rc)
+		ab->event_count = 0;
+	return rc;
+}
+
+
+static int can_dive_cb(cochran_can_meta_t *meta, const unsigned char *dive, unsigned int dive_size, unsigned int dive_num, int last_dive, void *userdata) {
+	cochran_arrow_t *ab = (cochran_arrow_t *) userdata;
+	const unsigned char *data[2] = { dive + meta->profile_offset, NULL };
+	unsigned int size[2] = { 0, 0 };
+	cochran_log_t log;
+
+	if (last_dive || dive_size < meta->profile_offset)
+		return 0;
+
+	cochran_log_parse(meta->model, dive + meta->log_offset, &log);
+
+	// Trust the logged end unless it's corrupt or runs past the dive, as canfile does
+	size[0] = dive_size - meta->profile_offset;
+	if (log.profile_end != 0xFFFFFFFF && log.profile_end && log.profile_end >= log.profile_pre
+			&& log.profile_end - log.profile_pre < size[0])
+		size[0] = log.profile_end - log.profile_pre;
+
+	return cochran_arrow_add_dive(ab, dive_num, meta->model, &log, data, size);
+}
+
+
+/*
+ * Decode a CAN, WAN or ANA file and export its logbook and samples.
+ * Returns 0, or an errno.
+ */
+int cochran_arrow_read_can(const char *file, struct ArrowSchema *logbook_schema, struct ArrowArray *logbook, struct ArrowSchema *samples_schema, struct ArrowArray *samples) {
+	cochran_file_type_t file_type;
+	unsigned char *cleartext;
+	unsigned int size;
+
+	int rc = cochran_can_load(file, &file_type, &cleartext, &size);
+	if (rc)
+		return rc;
+
+	cochran_arrow_t ab;
+	cochran_can_meta_t meta;
+
+	if (cochran_arrow_init(&ab))
+		rc = ENOMEM;
+
+	if (!rc) {
+		cochran_can_meta(&meta, file_type, cleartext, size);
+		cochran_can_foreach_dive(&meta, cleartext, size, can_dive_cb, &ab);
+
+		rc = ab.error;
+		if (!rc)
+			rc = cochran_arrow_export_logbook(&ab, logbook_schema, logbook);
+		if (!rc && (rc = cochran_arrow_export_samples(&ab, samples_schema, samples))) {
+			logbook_schema->release(logbook_schema);
+			logbook->release(logbook);
+		}
+		cochran_arrow_free(&ab);
+	}
+
+	free(cleartext);
+	return rc;
+}
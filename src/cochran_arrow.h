@@ -0,0 +1,92 @@
+/*
+ * cochran_arrow.h
+ *
+ * Dives as two Arrow tables, handed over through the Arrow C Data
+ * Interface so DuckDB, Polars or pyarrow can take them in-process.
+ *
+ * logbook: dive_id and the cochran_log_t fields, a row per dive
+ * samples: dive_id, time, depth, temp, ascent_rate, tank_pressure and
+ *          event, a row per sample time. Values a time didn't log are
+ *          null, events are dictionary encoded.
+ *
+ * Columns are built in place and exporting hands their buffers to the
+ * ArrowArray, nothing is copied. Units are the logs', feet, F and PSI.
+ *
+ * Include <stdint.h>, cochran_log.h and cochran_can.h first.
+ */
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+	// Array type description
+	const char *format;
+	const char *name;
+	const char *metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema **children;
+	struct ArrowSchema *dictionary;
+
+	// Release callback
+	void (*release)(struct ArrowSchema *);
+	// Opaque producer-specific data
+	void *private_data;
+};
+
+struct ArrowArray {
+	// Array data description
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void **buffers;
+	struct ArrowArray **children;
+	struct ArrowArray *dictionary;
+
+	// Release callback
+	void (*release)(struct ArrowArray *);
+	// Opaque producer-specific data
+	void *private_data;
+};
+
+#endif
+
+#define ARROW_MAX_EVENTS 64
+
+typedef struct cochran_arrow_column_t {
+	const char *name;
+	const char *format;				// Arrow format string
+	unsigned int width;				// Bytes per value
+	int nullable;
+	unsigned char *data;
+	unsigned char *validity;		// A bit per row, nullable columns only
+	int64_t null_count;
+} cochran_arrow_column_t;
+
+typedef struct cochran_arrow_table_t {
+	cochran_arrow_column_t *column;
+	unsigned int column_count;
+	int64_t rows;
+	int64_t capacity;
+} cochran_arrow_table_t;
+
+typedef struct cochran_arrow_t {
+	cochran_arrow_table_t logbook;
+	cochran_arrow_table_t samples;
+	const char *event[ARROW_MAX_EVENTS];	// Event dictionary, the parser's own strings
+	unsigned int event_count;
+	int error;						// Set when an allocation failed
+} cochran_arrow_t;
+
+int cochran_arrow_init(cochran_arrow_t *ab);
+void cochran_arrow_free(cochran_arrow_t *ab);
+int cochran_arrow_add_dive(cochran_arrow_t *ab, unsigned int dive_id, const char *model, const cochran_log_t *log, const unsigned char *data[2], const unsigned int size[2]);
+int cochran_arrow_export_logbook(cochran_arrow_t *ab, struct ArrowSchema *schema, struct ArrowArray *array);
+int cochran_arrow_export_samples(cochran_arrow_t *ab, struct ArrowSchema *schema, struct ArrowArray *array);
+int cochran_arrow_read_can(const char *file, struct ArrowSchema *logbook_schema, struct ArrowArray *logbook, struct ArrowSchema *samples_schema, struct ArrowArray *samples);
@@ -1,6 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include "cochran_can.h"
 #include "cochran.h"
@@ -27,7 +32,7 @@
  * 0x40101: the random modulus, or length of the key to use
  * 0x40102: block 1: Version and date of Analyst and a feature string identifying
  *          the computer features and the features of the file
- * 0x40138: Computer configuration page 1, 512 bytes
+ * 0x40138: Computer configuration page 1, 512 bytes, the unit's config0
  * 0x40338: Computer configuration page 2, 512 bytes
  * 0x40538: Misc data (tissues) 1500 bytes
  * 0x40b14: Ownership data 512 bytes ???
@@ -124,6 +129,7 @@ static int cochran_can_ana_meta(cochran_can_meta_t * meta, const unsigned char *
 	meta->key = cleartext + meta->header_offset + 1;
 	meta->address_size = 3;
 	meta->address_count = 0x10000;
+	meta->serial = 0;
 
 	strncpy(meta->model, cleartext + meta->header_offset + meta->mod + 38, 3);
 
@@ -170,6 +176,27 @@ static int cochran_can_can_meta(cochran_can_meta_t *meta, cochran_file_type_t fi
 	meta->log_size = log_meta.log_size;
 	meta->file_format = cleartext[meta->header_offset];
 
+	/*
+	 * A CAN keeps the unit's config page 0, the serial is where
+	 * device_serial_number() reads it off the unit. WAN files
+	 * haven't been seen to, they leave it 0.
+	 */
+	const unsigned char *config0 = cleartext + meta->header_offset + 0x138;
+	meta->serial = 0;
+	if (file_type == FILE_CAN && meta->header_offset + 0x338 <= cleartext_size) {
+		switch (meta->model[0]) {
+		case '1':	// Commander TM
+			meta->serial = array_uint16_be(config0 + 0x15c);
+			break;
+		case '2':	// Commander
+			meta->serial = array_uint16_be(config0 + 0xaa);
+			break;
+		case '3':	// EMC
+			meta->serial = array_uint32_le(config0 + 0x1e6);
+			break;
+		}
+	}
+
 	// Determine addressing format
 	switch(meta->file_format) {
 	case 0x43:
@@ -544,3 +571,54 @@ int cochran_can_decode_file(cochran_file_type_t file_type, const unsigned char *
 
 	return 1;
 }
+
+
+/*
+ * Read and decode a CAN, WAN or ANA file, the type comes from the
+ * extension. The caller frees *cleartext. Returns 0, or an errno.
+ */
+int cochran_can_load(const char *file, cochran_file_type_t *file_type, unsigned char **cleartext, unsigned int *size) {
+	struct stat st;
+	size_t len = strlen(file);
+	int rc = 0;
+
+	if (len < 4)
+		return EINVAL;
+	if (!strcasecmp(file + len - 4, ".wan"))
+		*file_type = FILE_WAN;
+	else if (!strcasecmp(file + len - 4, ".can"))
+		*file_type = FILE_CAN;
+	else if (!strcasecmp(file + len - 4, ".ana"))
+		*file_type = FILE_ANA;
+	else
+		return EINVAL;
+
+	int fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return errno;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return EINVAL;
+	}
+
+	unsigned char *ciphertext = malloc(st.st_size);
+	*cleartext = malloc(st.st_size);
+	if (!ciphertext || !*cleartext) {
+		rc = ENOMEM;
+	} else if (read(fd, ciphertext, st.st_size) != st.st_size) {
+		rc = EIO;
+	} else if (cochran_can_decode_file(*file_type, ciphertext, st.st_size, *cleartext)) {
+		rc = EINVAL;
+	}
+	close(fd);
+	free(ciphertext);
+
+	if (rc) {
+		free(*cleartext);
+		*cleartext = NULL;
+		return rc;
+	}
+
+	*size = st.st_size;
+	return 0;
+}
@@ -17,6 +17,7 @@ typedef struct cochran_can_meta_t {
     unsigned int log_size;
     unsigned int log_offset;
     unsigned int profile_offset;
+    unsigned int serial;		// The unit's, 0 when the file doesn't keep it
     int decode_address[10];
     int decode_key_offset[10];
 } cochran_can_meta_t;
@@ -26,3 +27,4 @@ typedef int (*cochran_can_foreach_callback_t) (cochran_can_meta_t *meta, const u
 int cochran_can_meta(cochran_can_meta_t *meta, cochran_file_type_t file_type, const unsigned char *cleartext, unsigned int cleartext_size);
 int cochran_can_foreach_dive(cochran_can_meta_t *meta, const unsigned char *cleartext, unsigned int cleartext_size, cochran_can_foreach_callback_t callback, void *userdata);
 int cochran_can_decode_file(cochran_file_type_t file_type, const unsigned char *ciphertext, unsigned int ciphertext_size, unsigned char *cleartext);
+int cochran_can_load(const char *file, cochran_file_type_t *file_type, unsigned char **cleartext, unsigned int *size);
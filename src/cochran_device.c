@@ -0,0 +1,82 @@
+/*
+ * cochran_device.c
+ *
+ * Model table, ID block signatures and serial numbers, see cochran_device.h.
+ */
+
+#include <string.h>
+
+#include "cochran_device.h"
+
+#define array_uint32_le(p) ( (unsigned int) (p)[0] + ((p)[1] << 8) \
+									+ ((p)[2] << 16) + ((p)[3] << 24) )
+#define array_uint16_be(p) ( ((unsigned int) (p)[0] << 8) + (p)[1] )
+
+// family, baud, highbaud, highbaud_byte, ram_address, ram_size, low-baud chunk min and max
+#define F_COMMANDER_TM FAMILY_COMMANDER_TM, 9600, UNSUPPORTED, UNSUPPORTED,  0,          0x10000, 0x400, 0x4000
+#define F_COMMANDER    FAMILY_COMMANDER,    9600, 115200,      0x04,         0,          0x10000, 0x400, 0x8000
+#define F_EMC          FAMILY_EMC,          9600, 806400,      0x05,         0,          0x10000, 0x400, 0x8000
+
+device_t devices[] = {
+	// A full read takes log_size bytes from log_address, the logbook and the profile ring
+	// name            model               family          log_address log_size   profile_begin profile_end
+	{ "Commander TM",  MODEL_COMMANDER_TM, F_COMMANDER_TM, 0x10000,    0x10000,   0x1232b,      0x20000   },
+	{ "Commander I",   MODEL_COMMANDER_I,  F_COMMANDER,    0,          0x100000,  0x20000,      0x100000  },
+	{ "Commander II",  MODEL_COMMANDER_II, F_COMMANDER,    0,          0x100000,  0x20000,      0x100000  },
+	{ "EMC 14",        MODEL_EMC_14,       F_EMC,          0,          0x200000,  0x22000,      0x200000  },
+	{ "EMC 16",        MODEL_EMC_16,       F_EMC,          0,          0x800000,  0x94000,      0x800000  },
+	{ "EMC 20H",       MODEL_EMC_20H,      F_EMC,          0,          0x1000000, 0x94000,      0x1000000 },
+};
+
+const unsigned int device_count = C_ARRAY_SIZE(devices);
+
+
+/*
+ * ID block signatures. The family is the ID command that returns the
+ * block, the code is the three characters at ID_MODEL_OFFSET and the
+ * variant is the byte just before it, which is the only thing that tells
+ * an EMC 16 from an EMC 20H. A variant of -1 matches anything.
+ */
+static const struct {
+	family_id_t family;
+	const char *code;
+	int variant;
+	model_id_t model;
+} id_signatures[] = {
+	{ FAMILY_COMMANDER, "120", -1,  MODEL_COMMANDER_TM },
+	{ FAMILY_COMMANDER, "213", -1,  MODEL_COMMANDER_I },
+	{ FAMILY_COMMANDER, "221", -1,  MODEL_COMMANDER_II },
+	{ FAMILY_EMC,       "303", -1,  MODEL_EMC_14 },
+	{ FAMILY_EMC,       "315", 'A', MODEL_EMC_16 },
+	{ FAMILY_EMC,       "315", -1,  MODEL_EMC_20H },
+};
+
+
+device_t *device_from_id(const unsigned char *id, int family) {
+	for (unsigned int s = 0; s < C_ARRAY_SIZE(id_signatures); s++) {
+		if ((family != -1 && id_signatures[s].family != (family_id_t) family)
+			|| memcmp(id + ID_MODEL_OFFSET, id_signatures[s].code, 3)
+			|| (id_signatures[s].variant != -1 && id[ID_MODEL_OFFSET - 1] != id_signatures[s].variant))
+			continue;
+
+		for (unsigned int d = 0; d < device_count; d++) {
+			if (devices[d].model == id_signatures[s].model)
+				return &devices[d];
+		}
+	}
+	return NULL;
+}
+
+
+// Serial number (the digits after the K on the case) from config page 0
+unsigned int device_serial_number(device_t *device, const unsigned char *config0) {
+	switch (device->family) {
+	case FAMILY_COMMANDER_TM:
+		return array_uint16_be(config0 + 0x15c);
+	case FAMILY_COMMANDER:
+		return array_uint16_be(config0 + 0xaa);
+	case FAMILY_EMC:
+		return array_uint32_le(config0 + 0x1e6);
+	}
+	return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * cochran_device.h
+ *
+ * The models we know, what each one's ID block looks like and where its
+ * logbook and profile ring are. Shared by the download engine and the
+ * readers of memory images and snapshots.
+ */
+
+typedef enum model_id_t {
+	MODEL_UNDEFINED,
+	MODEL_COMMANDER_TM,
+	MODEL_COMMANDER_I,
+	MODEL_COMMANDER_II,
+	MODEL_EMC_14,
+	MODEL_EMC_16,
+	MODEL_EMC_20H,
+} model_id_t;
+
+typedef enum family_id_t {
+	FAMILY_COMMANDER_TM = 0,
+	FAMILY_COMMANDER = 1,
+	FAMILY_EMC = 2,
+} family_id_t;
+
+#define C_ARRAY_SIZE(array) (sizeof (array) / sizeof *(array))
+
+#define UNSUPPORTED  0xFFFFFFFF
+
+// Offset of the three character model code in the ID block
+#define ID_MODEL_OFFSET 0x3e
+
+typedef struct device_t {
+	unsigned char *name;
+	model_id_t model;
+	family_id_t family;
+	unsigned int baud;
+	unsigned int highbaud;
+	unsigned int highbaud_byte;
+	unsigned int ram_address;
+	unsigned int ram_size;
+	unsigned int chunk_min;			// Low-baud read chunk limits
+	unsigned int chunk_max;
+	unsigned int log_address;
+	unsigned int log_size;
+	unsigned int profile_begin;		// Profile ring buffer
+	unsigned int profile_end;
+} device_t;
+
+extern device_t devices[];
+extern const unsigned int device_count;
+
+// The device an ID block belongs to, family is the ID command it came from or -1 for either
+device_t *device_from_id(const unsigned char *id, int family);
+unsigned int device_serial_number(device_t *device, const unsigned char *config0);
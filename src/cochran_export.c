@@ -0,0 +1,433 @@
+/*
+ * cochran_export.c
+ *
+ * Subsurface XML and UDDF writers. Numbers are formatted by hand straight
+ * into the output buffer, they never need escaping, only event names go
+ * through the escaper. Cochran logs in feet, F and PSI, Subsurface wants
+ * metres, C and bar and UDDF SI units, metres, K, Pa and seconds.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "cochran_log.h"
+#include "cochran_sample.h"
+#include "cochran_export.h"
+
+#define METRES(f)	((f) * 0.3048)
+#define CELSIUS(f)	(((f) - 32) / 1.8)
+#define BAR(p)		((p) * 0.0689476)
+#define PASCAL(p)	((p) * 6894.76)
+#define KELVIN(c)	((c) + 273.15)
+
+#define ROW_DEPTH		0x01
+#define ROW_TEMP		0x02
+#define ROW_PRESSURE	0x04
+#define ROW_NDL			0x08
+#define ROW_STOP		0x10
+#define ROW_TTS			0x20
+
+// Samples sharing a time, written as one element
+typedef struct row_t {
+	cochran_export_t *ex;
+	int time;					// seconds
+	unsigned int have;			// ROW_ flags
+	double depth;				// feet, kept between rows for UDDF
+	double temp;				// F
+	double pressure;			// PSI
+	unsigned int ndl;			// minutes
+	unsigned int stop_time;		// minutes
+	int stop_depth;				// feet
+	unsigned int tts;			// minutes
+} row_t;
+
+
+static void export_flush(cochran_export_t *ex) {
+	unsigned int done = 0;
+
+	while (!ex->error && done < ex->len) {
+		ssize_t rc = write(ex->fd, ex->buf + done, ex->len - done);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0) {
+			ex->error = (rc < 0 ? errno : EIO);
+			break;
+		}
+		done += rc;
+	}
+	ex->len = 0;
+}
+
+
+static void put(cochran_export_t *ex, const char *s, unsigned int n) {
+	while (n) {
+		unsigned int chunk = EXPORT_BUFFER_SIZE - ex->len;
+
+		if (!chunk) {
+			export_flush(ex);
+			continue;
+		}
+		if (chunk > n)
+			chunk = n;
+		memcpy(ex->buf + ex->len, s, chunk);
+		ex->len += chunk;
+		s += chunk;
+		n -= chunk;
+	}
+}
+
+
+static void put_str(cochran_export_t *ex, const char *s) {
+	put(ex, s, strlen(s));
+}
+
+
+// Unsigned, zero padded to width digits
+static void put_uint(cochran_export_t *ex, unsigned long v, int width) {
+	char tmp[24];
+	int n = sizeof(tmp);
+
+	do {
+		tmp[--n] = '0' + v % 10;
+		v /= 10;
+		width--;
+	} while (v || width > 0);
+
+	put(ex, tmp + n, sizeof(tmp) - n);
+}
+
+
+// A value rounded to decimals places
+static void put_fixed(cochran_export_t *ex, double v, int decimals) {
+	unsigned long scale = 1;
+
+	for (int i = 0; i < decimals; i++)
+		scale *= 10;
+
+	if (v < 0) {
+		put(ex, "-", 1);
+		v = -v;
+	}
+
+	unsigned long scaled = (unsigned long) (v * scale + 0.5);
+
+	put_uint(ex, scaled / scale, 1);
+	if (decimals) {
+		put(ex, ".", 1);
+		put_uint(ex, scaled % scale, decimals);
+	}
+}
+
+
+// Subsurface durations, "m:ss min"
+static void put_duration(cochran_export_t *ex, unsigned int seconds) {
+	put_uint(ex, seconds / 60, 1);
+	put(ex, ":", 1);
+	put_uint(ex, seconds % 60, 2);
+	put_str(ex, " min");
+}
+
+
+static void put_text(cochran_export_t *ex, const char *s) {
+	for (; *s; s++) {
+		switch (*s) {
+		case '&': put_str(ex, "&amp;"); break;
+		case '<': put_str(ex, "&lt;"); break;
+		case '>': put_str(ex, "&gt;"); break;
+		case '\'': put_str(ex, "&apos;"); break;
+		case '"': put_str(ex, "&quot;"); break;
+		default: put(ex, s, 1); break;
+		}
+	}
+}
+
+
+static void put_day(cochran_export_t *ex, const struct tm *t) {
+	put_uint(ex, t->tm_year + 1900, 4);
+	put(ex, "-", 1);
+	put_uint(ex, t->tm_mon + 1, 2);
+	put(ex, "-", 1);
+	put_uint(ex, t->tm_mday, 2);
+}
+
+
+static void put_clock(cochran_export_t *ex, const struct tm *t) {
+	put_uint(ex, t->tm_hour, 2);
+	put(ex, ":", 1);
+	put_uint(ex, t->tm_min, 2);
+	put(ex, ":", 1);
+	put_uint(ex, t->tm_sec, 2);
+}
+
+
+int cochran_export_format(const char *name, cochran_export_format_t *format) {
+	if (!strcmp(name, "subsurface") || !strcmp(name, "ssrf")) {
+		*format = EXPORT_SUBSURFACE;
+	} else if (!strcmp(name, "uddf")) {
+		*format = EXPORT_UDDF;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+
+int cochran_export_open(cochran_export_t *ex, int fd, cochran_export_format_t format, const char *model, const char *name) {
+	ex->fd = fd;
+	ex->format = format;
+	ex->model = model;
+	ex->name = name;
+	ex->dives = 0;
+	ex->error = 0;
+	ex->len = 0;
+
+	if (format == EXPORT_SUBSURFACE) {
+		put_str(ex, "<divelog program='cochran' version='3'>\n<dives>\n");
+	} else {
+		put_str(ex, "<?xml version='1.0' encoding='utf-8'?>\n<uddf version='3.2.0'>\n"
+			"<generator><name>cochran</name><type>converter</type></generator>\n"
+			"<diver><owner id='owner'><equipment><divecomputer id='dc'><name>Cochran ");
+		put_text(ex, name);
+		put_str(ex, "</name></divecomputer></equipment></owner></diver>\n"
+			"<profiledata>\n<repetitiongroup id='rg'>\n");
+	}
+
+	return ex->error;
+}
+
+
+static void row_subsurface(row_t *row) {
+	cochran_export_t *ex = row->ex;
+
+	put_str(ex, "  <sample time='");
+	put_duration(ex, row->time);
+	put(ex, "'", 1);
+	if (row->have & ROW_DEPTH) {
+		put_str(ex, " depth='");
+		put_fixed(ex, METRES(row->depth), 2);
+		put_str(ex, " m'");
+	}
+	if (row->have & ROW_TEMP) {
+		put_str(ex, " temp='");
+		put_fixed(ex, CELSIUS(row->temp), 1);
+		put_str(ex, " C'");
+	}
+	if (row->have & ROW_PRESSURE) {
+		put_str(ex, " pressure='");
+		put_fixed(ex, BAR(row->pressure), 1);
+		put_str(ex, " bar'");
+	}
+	if (row->have & ROW_NDL) {
+		put_str(ex, " ndl='");
+		put_duration(ex, row->ndl * 60);
+		put(ex, "'", 1);
+	}
+	if (row->have & ROW_STOP) {
+		put_str(ex, " stoptime='");
+		put_duration(ex, row->stop_time * 60);
+		put_str(ex, "' stopdepth='");
+		put_fixed(ex, METRES(row->stop_depth), 1);
+		put_str(ex, " m' in_deco='1'");
+	}
+	if (row->have & ROW_TTS) {
+		put_str(ex, " tts='");
+		put_duration(ex, row->tts * 60);
+		put(ex, "'", 1);
+	}
+	put_str(ex, " />\n");
+}
+
+
+static void row_uddf(row_t *row) {
+	cochran_export_t *ex = row->ex;
+
+	put_str(ex, "<waypoint><divetime>");
+	put_uint(ex, row->time, 1);
+	put_str(ex, "</divetime><depth>");
+	put_fixed(ex, METRES(row->depth), 2);
+	put_str(ex, "</depth>");
+	if (row->have & ROW_TEMP) {
+		put_str(ex, "<temperature>");
+		put_fixed(ex, KELVIN(CELSIUS(row->temp)), 2);
+		put_str(ex, "</temperature>");
+	}
+	if (row->have & ROW_PRESSURE) {
+		put_str(ex, "<tankpressure>");
+		put_fixed(ex, PASCAL(row->pressure), 0);
+		put_str(ex, "</tankpressure>");
+	}
+	if (row->have & ROW_NDL) {
+		put_str(ex, "<nodecotime>");
+		put_uint(ex, row->ndl * 60, 1);
+		put_str(ex, "</nodecotime>");
+	}
+	if (row->have & ROW_STOP) {
+		put_str(ex, "<decostop kind='mandatory' decodepth='");
+		put_fixed(ex, METRES(row->stop_depth), 1);
+		put_str(ex, "' duration='");
+		put_uint(ex, row->stop_time * 60, 1);
+		put_str(ex, "'/>");
+	}
+	put_str(ex, "</waypoint>\n");
+}
+
+
+static void row_flush(row_t *row) {
+	if (!row->have)
+		return;
+
+	if (row->ex->format == EXPORT_SUBSURFACE)
+		row_subsurface(row);
+	else
+		row_uddf(row);
+
+	row->have = 0;
+}
+
+
+static int export_sample_cb(int time, cochran_sample_t *sample, void *userdata) {
+	row_t *row = (row_t *) userdata;
+
+	if (time != row->time) {
+		row_flush(row);
+		row->time = time;
+	}
+
+	switch (sample->type) {
+	case SAMPLE_DEPTH:
+		row->depth = sample->value.depth;
+		row->have |= ROW_DEPTH;
+		break;
+	case SAMPLE_TEMP:
+		row->temp = sample->value.temp;
+		row->have |= ROW_TEMP;
+		break;
+	case SAMPLE_TANK_PRESSURE:
+		row->pressure = sample->value.tank_pressure;
+		row->have |= ROW_PRESSURE;
+		break;
+	case SAMPLE_NDL:
+		row->ndl = sample->value.ndl;
+		row->have |= ROW_NDL;
+		break;
+	case SAMPLE_DECO_FIRST_STOP:
+		row->stop_time = sample->value.deco.time;
+		row->stop_depth = sample->value.deco.ceiling;
+		row->have |= ROW_STOP;
+		break;
+	case SAMPLE_DECO:
+		row->tts = sample->value.deco.time;
+		row->have |= ROW_TTS;
+		break;
+	case SAMPLE_EVENT:
+		// UDDF only has a fixed set of alarms, events go to Subsurface alone
+		if (row->ex->format == EXPORT_SUBSURFACE && sample->value.event) {
+			put_str(row->ex, "  <event time='");
+			put_duration(row->ex, time);
+			put_str(row->ex, "' type='0' name='");
+			put_text(row->ex, sample->value.event);
+			put_str(row->ex, "' />\n");
+		}
+		break;
+	default:
+		// Ascent and consumption rates are derived, tissues and inter-dive events don't fit either format
+		break;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Write a dive, its log and samples in up to two segments as the profile
+ * ring gives them. A dive with no samples gets its log alone.
+ */
+int cochran_export_dive(cochran_export_t *ex, const cochran_log_t *log, const unsigned char *data[2], const unsigned int size[2]) {
+	row_t row = { .ex = ex, .depth = log->depth_start };
+
+	if (ex->error)
+		return ex->error;
+
+	ex->dives++;
+
+	if (ex->format == EXPORT_SUBSURFACE) {
+		put_str(ex, "<dive number='");
+		put_uint(ex, log->dive_num, 1);
+		put_str(ex, "' date='");
+		put_day(ex, &log->time_start);
+		put_str(ex, "' time='");
+		put_clock(ex, &log->time_start);
+		put_str(ex, "' duration='");
+		put_duration(ex, log->bt * 60);
+		put_str(ex, "'>\n");
+
+		if (log->mix[0].o2 > 0) {
+			put_str(ex, " <cylinder o2='");
+			put_fixed(ex, log->mix[0].o2, 1);
+			put(ex, "%'", 2);
+			if (log->mix[0].he > 0) {
+				put_str(ex, " he='");
+				put_fixed(ex, log->mix[0].he, 1);
+				put(ex, "%'", 2);
+			}
+			put_str(ex, " />\n");
+		}
+
+		put_str(ex, " <divecomputer model='Cochran ");
+		put_text(ex, ex->name);
+		put_str(ex, "'>\n  <depth max='");
+		put_fixed(ex, METRES(log->depth_max), 2);
+		put_str(ex, " m' mean='");
+		put_fixed(ex, METRES(log->depth_avg), 2);
+		put_str(ex, " m' />\n  <temperature water='");
+		put_fixed(ex, CELSIUS(log->temp_min), 1);
+		put_str(ex, " C' />\n");
+	} else {
+		put_str(ex, "<dive id='dive");
+		put_uint(ex, ex->dives, 1);
+		put_str(ex, "'>\n<informationbeforedive><divenumber>");
+		put_uint(ex, log->dive_num, 1);
+		put_str(ex, "</divenumber><datetime>");
+		put_day(ex, &log->time_start);
+		put(ex, "T", 1);
+		put_clock(ex, &log->time_start);
+		put_str(ex, "</datetime><surfaceintervalbeforedive><passedtime>");
+		put_uint(ex, log->sit * 60, 1);
+		put_str(ex, "</passedtime></surfaceintervalbeforedive></informationbeforedive>\n<samples>\n");
+	}
+
+	if (size[0] + size[1] > 2)
+		cochran_sample_parse_segments((const unsigned char *) ex->model, log, data, size, export_sample_cb, &row);
+	row_flush(&row);
+
+	if (ex->format == EXPORT_SUBSURFACE) {
+		put_str(ex, " </divecomputer>\n</dive>\n");
+	} else {
+		put_str(ex, "</samples>\n<informationafterdive><greatestdepth>");
+		put_fixed(ex, METRES(log->depth_max), 2);
+		put_str(ex, "</greatestdepth><averagedepth>");
+		put_fixed(ex, METRES(log->depth_avg), 2);
+		put_str(ex, "</averagedepth><diveduration>");
+		put_uint(ex, log->bt * 60, 1);
+		put_str(ex, "</diveduration><lowesttemperature>");
+		put_fixed(ex, KELVIN(CELSIUS(log->temp_min)), 2);
+		put_str(ex, "</lowesttemperature></informationafterdive>\n</dive>\n");
+	}
+
+	return ex->error;
+}
+
+
+// Close the document and write out what's buffered, returns errno of any failed write
+int cochran_export_close(cochran_export_t *ex) {
+	if (ex->format == EXPORT_SUBSURFACE)
+		put_str(ex, "</dives>\n</divelog>\n");
+	else
+		put_str(ex, "</repetitiongroup>\n</profiledata>\n</uddf>\n");
+
+	export_flush(ex);
+	return ex->error;
+}
@@ -0,0 +1,33 @@
+/*
+ * cochran_export.h
+ *
+ * Stream dives out as Subsurface XML or UDDF. Output goes through a
+ * buffer that's written when it fills, so a logbook of thousands of
+ * dives costs a few hundred writes. Samples that share a time are
+ * gathered into one element.
+ *
+ * Include cochran_log.h first.
+ */
+
+#define EXPORT_BUFFER_SIZE 65536
+
+typedef enum cochran_export_format_t {
+	EXPORT_SUBSURFACE,
+	EXPORT_UDDF,
+} cochran_export_format_t;
+
+typedef struct cochran_export_t {
+	int fd;
+	cochran_export_format_t format;
+	const char *model;				// Model code, picks the sample parser
+	const char *name;				// Model name for the divecomputer element
+	unsigned int dives;				// Exported so far
+	int error;						// errno of a failed write, output stops
+	unsigned int len;
+	char buf[EXPORT_BUFFER_SIZE];
+} cochran_export_t;
+
+int cochran_export_format(const char *name, cochran_export_format_t *format);
+int cochran_export_open(cochran_export_t *ex, int fd, cochran_export_format_t format, const char *model, const char *name);
+int cochran_export_dive(cochran_export_t *ex, const cochran_log_t *log, const unsigned char *data[2], const unsigned int size[2]);
+int cochran_export_close(cochran_export_t *ex);
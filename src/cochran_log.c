@@ -69,6 +69,27 @@ void cochran_log_print_short(cochran_log_t *log, int ordinal) {
 }
 
 
+/*
+ * Print the log as a single JSON object (no trailing newline) so callers
+ * can embed it or follow it with sample data.
+ */
+void cochran_log_print_json(cochran_log_t *log, int ordinal) {
+	printf("{\"ordinal\":%d,\"dive\":%d,\"rep\":%d,"
+		"\"date\":\"%04d-%02d-%02d %02d:%02d:%02d\",\"sit\":%d,\"bt\":%d,"
+		"\"depth_max\":%.2f,\"depth_avg\":%.2f,\"temp_min\":%.1f,\"temp_start\":%.1f,"
+		"\"ndl_min\":%d,\"deco_max\":%d,\"interval\":%d,\"voltage\":%.2f,"
+		"\"conservatism\":%d,\"o2\":%.1f,\"he\":%.1f,"
+		"\"profile_pre\":%u,\"profile_begin\":%u,\"profile_end\":%u",
+		ordinal, log->dive_num, log->rep_dive_num,
+		log->time_start.tm_year + 1900, log->time_start.tm_mon + 1, log->time_start.tm_mday,
+		log->time_start.tm_hour, log->time_start.tm_min, log->time_start.tm_sec,
+		log->sit, log->bt,
+		log->depth_max, log->depth_avg, log->temp_min, log->temp_start,
+		log->ndl_min, log->deco_max, log->profile_interval, log->voltage_start,
+		log->conservatism, log->mix[0].o2, log->mix[0].he,
+		log->profile_pre, log->profile_begin, log->profile_end);
+}
+
 void cochran_log_nemesis_parse(const unsigned char *in, cochran_log_t *out) {
 	memset(out, 0, sizeof(cochran_log_t));
 
@@ -350,6 +371,7 @@ int cochran_log_meta(cochran_log_meta_t *meta, const char *model) {
 		{ "221", 256, cochran_log_commander_III_parse,	"Commander" },
 		{ "300", 512, cochran_log_emc_parse,			"EMC" },
 		{ "301", 512, cochran_log_emc_parse,			"EMC" },
+		{ "303", 512, cochran_log_emc_parse,			"EMC" },
 		{ "315", 512, cochran_log_emc_parse,			"EMC" },
 	};
 
@@ -76,6 +76,7 @@ typedef struct cochran_log_meta_t {
 
 void cochran_log_print_short_header(int ordinal);
 void cochran_log_print_short(cochran_log_t *log, int ordinal);
+void cochran_log_print_json(cochran_log_t *log, int ordinal);
 void cochran_log_commander_I_parse(const unsigned char *in, cochran_log_t *out);
 void cochran_log_commander_II_parse(const unsigned char *in, cochran_log_t *out);
 void cochran_log_commander_III_parse(const unsigned char *in, cochran_log_t *out);
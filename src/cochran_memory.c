@@ -0,0 +1,242 @@
+/*
+ * cochran_memory.c
+ *
+ * Logbook and profile ring of a memory image.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cochran_device.h"
+#include "cochran_log.h"
+#include "cochran_memory.h"
+
+int cochran_memory_init(cochran_memory_t *mem, const unsigned char *id, const unsigned char *image, unsigned int size) {
+	memset(mem, 0, sizeof(*mem));
+	memcpy(mem->model, id + ID_MODEL_OFFSET, 3);
+
+	if (cochran_log_meta(&mem->meta, mem->model)) {
+		dprintf(STDERR_FILENO, "Unknown model \"%s\"\n", mem->model);
+		return -1;
+	}
+
+	// The logbook runs from where a full read starts up to the profile ring
+	device_t *device = device_from_id(id, -1);
+	if (!device) {
+		dprintf(STDERR_FILENO, "No memory layout for model \"%s\"\n", mem->model);
+		return -1;
+	}
+
+	mem->image = image;
+	mem->size = size;
+	mem->base = device->log_address;
+	mem->profile_begin = device->profile_begin;
+	mem->profile_end = device->profile_end;
+	mem->log_count = (mem->profile_begin - mem->base) / mem->meta.log_size;
+	return 0;
+}
+
+
+int cochran_memory_map(cochran_memory_t *mem, const unsigned char *id, const char *file) {
+	struct stat st;
+
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		dprintf(STDERR_FILENO, "%s: Unable to open %s\n", strerror(errno), file);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		dprintf(STDERR_FILENO, "Memory file %s is empty\n", file);
+		close(fd);
+		return -1;
+	}
+
+	unsigned char *image = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		dprintf(STDERR_FILENO, "%s: Unable to map %s\n", strerror(errno), file);
+		return -1;
+	}
+
+	if (cochran_memory_init(mem, id, image, st.st_size)) {
+		munmap(image, st.st_size);
+		return -1;
+	}
+
+	mem->map_size = st.st_size;
+	return 0;
+}
+
+
+void cochran_memory_unmap(cochran_memory_t *mem) {
+	if (mem->map_size)
+		munmap((void *) mem->image, mem->map_size);
+	mem->image = NULL;
+	mem->map_size = 0;
+}
+
+
+// Log record n, NULL if it's past the image or was never written
+const unsigned char *cochran_memory_log(const cochran_memory_t *mem, unsigned int n) {
+	unsigned int size = mem->meta.log_size;
+
+	if (n >= mem->log_count || (n + 1) * size > mem->size)
+		return NULL;
+
+	const unsigned char *rec = mem->image + n * size;
+	for (unsigned int i = 0; i < size; i++)
+		if (rec[i] != 0xff)
+			return rec;
+	return NULL;
+}
+
+
+// The dive logged after n, the logbook wraps like the ring. -1 if there isn't one.
+int cochran_memory_next(const cochran_memory_t *mem, unsigned int n) {
+	unsigned int next = (n + 1) % mem->log_count;
+
+	if (next == n || !cochran_memory_log(mem, next))
+		return -1;
+	return next;
+}
+
+
+/*
+ * View of the ring from begin up to end, going round if end is lower.
+ * Fails if either address is outside the ring or past the end of the
+ * image, the dump may not have reached that far.
+ */
+int cochran_memory_view(const cochran_memory_t *mem, unsigned int begin, unsigned int end, cochran_profile_t *view) {
+	memset(view, 0, sizeof(*view));
+
+	if (begin < mem->profile_begin || begin >= mem->profile_end
+			|| end < mem->profile_begin || end > mem->profile_end)
+		return -1;
+
+	view->begin = begin;
+	view->end = end;
+
+	if (begin <= end) {
+		if (end - mem->base > mem->size)
+			return -1;
+		view->data[0] = mem->image + begin - mem->base;
+		view->size[0] = end - begin;
+		return 0;
+	}
+
+	if (mem->profile_end - mem->base > mem->size)
+		return -1;
+	view->data[0] = mem->image + begin - mem->base;
+	view->size[0] = mem->profile_end - begin;
+	view->data[1] = mem->image + mem->profile_begin - mem->base;
+	view->size[1] = end - mem->profile_begin;
+	return 0;
+}
+
+
+/*
+ * Dive n's log and its samples, pre-dive events included. Early models
+ * don't log where the profile ends, the next dive's start is used, so
+ * their latest dive has no profile.
+ */
+int cochran_memory_profile(const cochran_memory_t *mem, unsigned int n, cochran_log_t *log, cochran_profile_t *profile) {
+	const unsigned char *rec = cochran_memory_log(mem, n);
+	cochran_log_t next;
+
+	memset(profile, 0, sizeof(*profile));
+	if (!rec)
+		return -1;
+
+	mem->meta.parser(rec, log);
+
+	unsigned int begin = log->profile_pre ? log->profile_pre : log->profile_begin;
+	unsigned int end = log->profile_end;
+
+	if (!end) {
+		int m = cochran_memory_next(mem, n);
+		if (m < 0)
+			return -1;
+		mem->meta.parser(cochran_memory_log(mem, m), &next);
+		end = next.profile_pre ? next.profile_pre : next.profile_begin;
+	}
+
+	if (begin == end)
+		return -1;
+
+	return cochran_memory_view(mem, begin, end, profile);
+}
+
+
+// The view in one piece, copied into *stitch only when it wrapped. Free *stitch after.
+const unsigned char *cochran_profile_contiguous(const cochran_profile_t *profile, unsigned char **stitch) {
+	*stitch = NULL;
+
+	if (!profile->size[1])
+		return profile->data[0];
+
+	*stitch = malloc(profile->size[0] + profile->size[1]);
+	if (!*stitch)
+		return NULL;
+	memcpy(*stitch, profile->data[0], profile->size[0]);
+	memcpy(*stitch + profile->size[0], profile->data[1], profile->size[1]);
+	return *stitch;
+}
+
+
+/*
+ * Where the logbook's records and the newest dive's profile sit, as
+ * begin/end device address pairs, the parts of an image a download
+ * can least afford to get wrong. The profile is two pairs when it
+ * wrapped. Early models don't log where their latest profile ends, the
+ * newest dive that has one is used. Returns how many pairs were filled.
+ */
+int cochran_memory_recent(const cochran_memory_t *mem, unsigned int ranges[3][2]) {
+	cochran_profile_t profile;
+	cochran_log_t log;
+	unsigned int used = 0, newest = 0, dive_num = 0;
+	int found = 0, count = 0;
+
+	for (unsigned int n = 0; n < mem->log_count; n++) {
+		const unsigned char *rec = cochran_memory_log(mem, n);
+		if (!rec)
+			continue;
+		used = n + 1;
+		mem->meta.parser(rec, &log);
+		if (!found || log.dive_num > dive_num) {
+			newest = n;
+			dive_num = log.dive_num;
+			found = 1;
+		}
+	}
+
+	if (!found)
+		return 0;
+
+	ranges[count][0] = mem->base;
+	ranges[count][1] = mem->base + used * mem->meta.log_size;
+	count++;
+
+	// Walk back from the newest to the first dive with a profile
+	for (unsigned int i = 0, n = newest; i < mem->log_count; i++, n = (n + mem->log_count - 1) % mem->log_count) {
+		if (cochran_memory_profile(mem, n, &log, &profile))
+			continue;
+		ranges[count][0] = profile.begin;
+		ranges[count][1] = profile.size[1] ? mem->profile_end : profile.end;
+		count++;
+		if (profile.size[1]) {
+			ranges[count][0] = mem->profile_begin;
+			ranges[count][1] = profile.end;
+			count++;
+		}
+		break;
+	}
+
+	return count;
+}
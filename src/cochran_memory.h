@@ -0,0 +1,42 @@
+/*
+ * cochran_memory.h
+ *
+ * Dives out of a memory image, as kept in data/<model>/K<serial>/ or
+ * saved by dock. The image starts with the logbook, an array of fixed
+ * size records that's reused from the top when it fills, and further on
+ * is the profile ring the dives' samples are written round. A profile
+ * comes back as a view into the image, in two pieces when it wrapped the
+ * end of the ring, so nothing is copied unless the caller wants it in
+ * one piece.
+ *
+ * Include cochran_log.h first.
+ */
+
+typedef struct cochran_memory_t {
+	const unsigned char *image;
+	unsigned int size;
+	unsigned int base;				// Device address of image[0]
+	unsigned int profile_begin;		// Profile ring, device addresses
+	unsigned int profile_end;
+	unsigned int log_count;			// Records in the logbook
+	char model[4];
+	cochran_log_meta_t meta;
+	size_t map_size;				// Set when cochran_memory_map() mapped the image
+} cochran_memory_t;
+
+// A stretch of the profile ring, size[1] is 0 unless it wrapped
+typedef struct cochran_profile_t {
+	const unsigned char *data[2];
+	unsigned int size[2];
+	unsigned int begin, end;		// Device addresses
+} cochran_profile_t;
+
+int cochran_memory_init(cochran_memory_t *mem, const unsigned char *id, const unsigned char *image, unsigned int size);
+int cochran_memory_map(cochran_memory_t *mem, const unsigned char *id, const char *file);
+void cochran_memory_unmap(cochran_memory_t *mem);
+const unsigned char *cochran_memory_log(const cochran_memory_t *mem, unsigned int n);
+int cochran_memory_next(const cochran_memory_t *mem, unsigned int n);
+int cochran_memory_view(const cochran_memory_t *mem, unsigned int begin, unsigned int end, cochran_profile_t *view);
+int cochran_memory_profile(const cochran_memory_t *mem, unsigned int n, cochran_log_t *log, cochran_profile_t *profile);
+const unsigned char *cochran_profile_contiguous(const cochran_profile_t *profile, unsigned char **stitch);
+int cochran_memory_recent(const cochran_memory_t *mem, unsigned int ranges[3][2]);
@@ -45,6 +45,54 @@ static const cochran_events_t cochran_events[] = {
 };
 
 
+/*
+ * Samples in one piece, or in two when the profile wrapped round the end
+ * of the ring. Parsers look up to SAMPLE_BEHIND bytes back (EMC tissues)
+ * and SAMPLE_AHEAD forward (inter-dive events) of a sample, so only the
+ * bytes either side of the wrap are spliced together, the rest is read
+ * where it lies.
+ */
+#define SAMPLE_BEHIND	64
+#define SAMPLE_AHEAD	32
+#define SAMPLE_SPLICE	(SAMPLE_BEHIND + SAMPLE_AHEAD)
+
+typedef struct sample_input_t {
+	const unsigned char *data[2];
+	unsigned int size[2];
+	unsigned char splice[SAMPLE_SPLICE * 2];	// Tail of data[0] then head of data[1]
+} sample_input_t;
+
+typedef void (*cochran_sample_parser_t) (const cochran_log_t *log, const sample_input_t *in, cochran_sample_callback_t callback, void *userdata);
+
+
+static void sample_input_init(sample_input_t *in, const unsigned char *data[2], const unsigned int size[2]) {
+	in->data[0] = data[0];
+	in->size[0] = size[0];
+	in->data[1] = size[1] ? data[1] : NULL;
+	in->size[1] = size[1];
+
+	if (!in->size[1])
+		return;
+
+	unsigned int tail = (size[0] < SAMPLE_SPLICE ? size[0] : SAMPLE_SPLICE);
+	unsigned int head = (size[1] < SAMPLE_SPLICE ? size[1] : SAMPLE_SPLICE);
+
+	memset(in->splice, 0, sizeof(in->splice));
+	memcpy(in->splice + SAMPLE_SPLICE - tail, data[0] + size[0] - tail, tail);
+	memcpy(in->splice + SAMPLE_SPLICE, data[1], head);
+}
+
+
+// The sample at offset, near the wrap it's in the splice and only lives as long as the parse
+static inline const unsigned char *sample_at(const sample_input_t *in, unsigned int offset) {
+	if (!in->size[1] || offset + SAMPLE_AHEAD <= in->size[0])
+		return in->data[0] + offset;
+	if (offset >= in->size[0] + SAMPLE_BEHIND)
+		return in->data[1] + offset - in->size[0];
+	return in->splice + SAMPLE_SPLICE + offset - in->size[0];
+}
+
+
 /*
 * Bytes expected after a inter-dive event code
 */
@@ -112,14 +160,15 @@ static int cochran_sample_parse_inter_dive (cochran_family_t family, unsigned ch
  * set then the byte is an event byte.
  */
 
-void cochran_sample_parse_nemesis (const cochran_log_t *log, const unsigned char *samples, unsigned int size, cochran_sample_callback_t callback, void *userdata) {
+void cochran_sample_parse_nemesis (const cochran_log_t *log, const sample_input_t *in, cochran_sample_callback_t callback, void *userdata) {
+	unsigned int size = in->size[0] + in->size[1];
 	unsigned int sample_size = 2;
 	unsigned int offset = 0;
 	unsigned int sample_cnt = 0;
 	cochran_sample_t sample = {0};
 
-	double temp = samples[0] / 2.0;
-	double depth = samples[1] / 2.0;
+	double temp = sample_at(in, 0)[0] / 2.0;
+	double depth = sample_at(in, 0)[1] / 2.0;
 	unsigned int tank_pressure = log->tank_pressure_start;
 	unsigned int deco_ceiling = 0;
 	unsigned int deco_time = 0;
@@ -128,13 +177,13 @@ void cochran_sample_parse_nemesis (const cochran_log_t *log, const unsigned char
 	if (callback) {
 		sample.type = SAMPLE_TEMP;
 		sample.value.temp = temp;
-		sample.raw.data = samples;
+		sample.raw.data = sample_at(in, 0);
 		sample.raw.size = 1;
 		callback(0, &sample, userdata);
 
 		sample.type = SAMPLE_DEPTH;
 		sample.value.depth = depth;
-		sample.raw.data = samples + 1;
+		sample.raw.data = sample_at(in, 0) + 1;
 		sample.raw.size = 1;
 		callback(0, &sample, userdata);
 
@@ -147,7 +196,7 @@ void cochran_sample_parse_nemesis (const cochran_log_t *log, const unsigned char
 	offset = 2;
 
 	while (offset < size) {
-		const unsigned char *s = samples + offset;
+		const unsigned char *s = sample_at(in, offset);
 
 		// Check for special sample (event or a temp change for early Commanders
 		if (s[0] & 0x80 && s[0] & 0x60) {
@@ -252,14 +301,15 @@ void cochran_sample_parse_nemesis (const cochran_log_t *log, const unsigned char
  * one or more of bits 0x60 set.
  */
 
-void cochran_sample_parse_I (const cochran_log_t *log, const unsigned char *samples, unsigned int size, cochran_sample_callback_t callback, void *userdata) {
+void cochran_sample_parse_I (const cochran_log_t *log, const sample_input_t *in, cochran_sample_callback_t callback, void *userdata) {
+	unsigned int size = in->size[0] + in->size[1];
 	unsigned int sample_size = 1;
 	unsigned int offset = 0;
 	unsigned int sample_cnt = 0;
 	cochran_sample_t sample = {0};
 
-	double temp = samples[0] / 2.0;
-	double depth = samples[1] / 2.0;
+	double temp = sample_at(in, 0)[0] / 2.0;
+	double depth = sample_at(in, 0)[1] / 2.0;
 	unsigned int deco_ceiling = 0;
 	unsigned int deco_time = 0;
 
@@ -267,13 +317,13 @@ void cochran_sample_parse_I (const cochran_log_t *log, const unsigned char *samp
 	if (callback) {
 		sample.type = SAMPLE_TEMP;
 		sample.value.temp = temp;
-		sample.raw.data = samples;
+		sample.raw.data = sample_at(in, 0);
 		sample.raw.size = 1;
 		callback(0, &sample, userdata);
 
 		sample.type = SAMPLE_DEPTH;
 		sample.value.depth = depth;
-		sample.raw.data = samples + 1;
+		sample.raw.data = sample_at(in, 0) + 1;
 		sample.raw.size = 1;
 		callback(0, &sample, userdata);
 	}
@@ -281,7 +331,7 @@ void cochran_sample_parse_I (const cochran_log_t *log, const unsigned char *samp
 	offset = 2;
 
 	while (offset < size) {
-		const unsigned char *s = samples + offset;
+		const unsigned char *s = sample_at(in, offset);
 
 		// Check for special sample (event or a temp change for early Commanders
 		if (s[0] & 0x80 && s[0] & 0x60) {
@@ -378,26 +428,27 @@ void cochran_sample_parse_I (const cochran_log_t *log, const unsigned char *samp
  * There are no negative temperature values.
  */
 
-void cochran_sample_parse_II(const cochran_log_t *log, const unsigned char *samples, unsigned int size, cochran_sample_callback_t callback, void *userdata) {
+void cochran_sample_parse_II(const cochran_log_t *log, const sample_input_t *in, cochran_sample_callback_t callback, void *userdata) {
+	unsigned int size = in->size[0] + in->size[1];
 	unsigned int sample_size = 2;
 	unsigned int offset = 0;
 	unsigned int sample_cnt = 0;
 	cochran_sample_t sample = {0};
 
 	// process inter-dive event
-	//if (samples[offset] != 0x40) {
-	if (cochran_sample_parse_inter_dive(FAMILY_COMMANDER_II, samples[offset])) {
-		while ( offset < size && (samples[offset] & 0x80) == 0 && samples[offset] != 0x40) {
+	//if (*sample_at(in, offset) != 0x40) {
+	if (cochran_sample_parse_inter_dive(FAMILY_COMMANDER_II, *sample_at(in, offset))) {
+		while ( offset < size && (*sample_at(in, offset) & 0x80) == 0 && *sample_at(in, offset) != 0x40) {
 			int event_size = 0;
 			sample.type = SAMPLE_INTERDIVE;
-			sample.value.interdive.code = samples[offset];
+			sample.value.interdive.code = *sample_at(in, offset);
 			sample.value.interdive.data = 0;
-			event_size = cochran_sample_parse_inter_dive(FAMILY_COMMANDER_II, samples[offset]) + 1;
+			event_size = cochran_sample_parse_inter_dive(FAMILY_COMMANDER_II, *sample_at(in, offset)) + 1;
 			if (offset + event_size < size && event_size > 5) {
-				time_t t = array_uint32_le(samples + offset + 1) + COCHRAN_EPOCH;
+				time_t t = array_uint32_le(sample_at(in, offset) + 1) + COCHRAN_EPOCH;
 				localtime_r(&t, &(sample.value.interdive.time));
 				sample.value.interdive.size = event_size - 5;
-				sample.value.interdive.data = samples + offset + 5;
+				sample.value.interdive.data = sample_at(in, offset) + 5;
 				if (callback) callback(0, &sample, userdata);
 			}
 			offset += event_size;
@@ -422,7 +473,7 @@ void cochran_sample_parse_II(const cochran_log_t *log, const unsigned char *samp
 
 	while (offset < size) {
 		const unsigned char *s;
-		s = samples + offset;
+		s = sample_at(in, offset);
 
 		// Check for an event
 		if (*s & 0x80) {
@@ -558,25 +609,26 @@ void cochran_sample_parse_II(const cochran_log_t *log, const unsigned char *samp
  * fourth and last in the sample rotation (sample_cnt % 4 == 3);
  */
 
-void cochran_sample_parse_gem(const cochran_log_t *log, const unsigned char *samples, unsigned int size, cochran_sample_callback_t callback, void *userdata) {
+void cochran_sample_parse_gem(const cochran_log_t *log, const sample_input_t *in, cochran_sample_callback_t callback, void *userdata) {
+	unsigned int size = in->size[0] + in->size[1];
 	unsigned int sample_size = 2;
 	unsigned int offset = 0;
 	unsigned int sample_cnt = 0;
 	cochran_sample_t sample = {0};
 
 	// process inter-dive event
-	if (samples[offset] != 0x40) {
-		while ( offset < size && (samples[offset] & 0x80) == 0 && samples[offset] != 0x40) {
+	if (*sample_at(in, offset) != 0x40) {
+		while ( offset < size && (*sample_at(in, offset) & 0x80) == 0 && *sample_at(in, offset) != 0x40) {
 			int event_size = 0;
 			sample.type = SAMPLE_INTERDIVE;
-			sample.value.interdive.code = samples[offset];
+			sample.value.interdive.code = *sample_at(in, offset);
 			sample.value.interdive.data = 0;
-			event_size = cochran_sample_parse_inter_dive(FAMILY_COMMANDER_II, samples[offset]) + 1;
+			event_size = cochran_sample_parse_inter_dive(FAMILY_COMMANDER_II, *sample_at(in, offset)) + 1;
 			if (offset + event_size < size && event_size > 5) {
-				time_t t = array_uint32_le(samples + offset + 1) + COCHRAN_EPOCH;
+				time_t t = array_uint32_le(sample_at(in, offset) + 1) + COCHRAN_EPOCH;
 				localtime_r(&t, &(sample.value.interdive.time));
 				sample.value.interdive.size = event_size - 5;
-				sample.value.interdive.data = samples + offset + 5;
+				sample.value.interdive.data = sample_at(in, offset) + 5;
 				if (callback) callback(0, &sample, userdata);
 			}
 			offset += event_size;
@@ -610,7 +662,7 @@ void cochran_sample_parse_gem(const cochran_log_t *log, const unsigned char *sam
 
 	while (offset < size) {
 		const unsigned char *s;
-		s = samples + offset;
+		s = sample_at(in, offset);
 
 		// Check for an event
 		if (*s & 0x80) {
@@ -740,26 +792,27 @@ void cochran_sample_parse_gem(const cochran_log_t *log, const unsigned char *sam
  * Parse sample data, extract events and build a dive
  */
 
-void cochran_sample_parse_emc(const cochran_log_t *log, const unsigned char *samples, unsigned int size, cochran_sample_callback_t callback, void *userdata) {
+void cochran_sample_parse_emc(const cochran_log_t *log, const sample_input_t *in, cochran_sample_callback_t callback, void *userdata) {
+	unsigned int size = in->size[0] + in->size[1];
 	int sample_size = 3;
 	unsigned int offset = 0;
 	unsigned int sample_cnt = 0;
 	cochran_sample_t sample = {0};
 
 	// process inter-dive event
-	if (samples[offset] != 0x40) {
-		while ( offset < size && (samples[offset] & 0x80) == 0 && samples[offset] != 0x40) {
+	if (*sample_at(in, offset) != 0x40) {
+		while ( offset < size && (*sample_at(in, offset) & 0x80) == 0 && *sample_at(in, offset) != 0x40) {
 			int event_size = 0;
 			sample.type = SAMPLE_INTERDIVE;
-			sample.value.interdive.code = samples[offset];
+			sample.value.interdive.code = *sample_at(in, offset);
 			sample.value.interdive.data = 0;
-			event_size = cochran_sample_parse_inter_dive(FAMILY_EMC, samples[offset]) + 1;
+			event_size = cochran_sample_parse_inter_dive(FAMILY_EMC, *sample_at(in, offset)) + 1;
 			if (offset + event_size < size && event_size > 5) {
-				time_t t = array_uint32_le(samples + offset + 1) + COCHRAN_EPOCH;
+				time_t t = array_uint32_le(sample_at(in, offset) + 1) + COCHRAN_EPOCH;
 				localtime_r(&t, &(sample.value.interdive.time));
 				sample.value.interdive.size = event_size - 5;
-				sample.value.interdive.data = samples + offset + 5;
-				sample.raw.data = samples + offset;
+				sample.value.interdive.data = sample_at(in, offset) + 5;
+				sample.raw.data = sample_at(in, offset);
 				sample.raw.size = event_size;
 				if (callback) callback(0, &sample, userdata);
 			}
@@ -790,7 +843,7 @@ void cochran_sample_parse_emc(const cochran_log_t *log, const unsigned char *sam
 	// Process samples
 	while (offset < size) {
 		const unsigned char *s;
-		s = samples + offset;
+		s = sample_at(in, offset);
 
 		// Check for an event
 		if (*s & 0x80) {
@@ -941,6 +994,56 @@ void cochran_sample_parse_emc(const cochran_log_t *log, const unsigned char *sam
 }
 
 
+/*
+ * Sample callback printing each sample as a JSON object, comma separated
+ * so they can go in an array. userdata is an int count of those printed,
+ * start it at 0.
+ */
+int cochran_sample_print_json(int time, cochran_sample_t *sample, void *userdata) {
+	int *count = (int *) userdata;
+	const char *sep = *count ? "," : "";
+
+	switch (sample->type) {
+	case SAMPLE_DEPTH:
+		printf("%s{\"time\":%d,\"depth\":%.2f}", sep, time, sample->value.depth);
+		break;
+	case SAMPLE_TEMP:
+		printf("%s{\"time\":%d,\"temp\":%.1f}", sep, time, sample->value.temp);
+		break;
+	case SAMPLE_ASCENT_RATE:
+		printf("%s{\"time\":%d,\"ascent_rate\":%.2f}", sep, time, sample->value.ascent_rate);
+		break;
+	case SAMPLE_TANK_PRESSURE:
+		printf("%s{\"time\":%d,\"tank_pressure\":%.1f}", sep, time, sample->value.tank_pressure);
+		break;
+	case SAMPLE_GAS_CONSUMPTION_RATE:
+		printf("%s{\"time\":%d,\"gas_consumption_rate\":%.2f}", sep, time, sample->value.gas_consumption_rate);
+		break;
+	case SAMPLE_NDL:
+		printf("%s{\"time\":%d,\"ndl\":%u}", sep, time, sample->value.ndl);
+		break;
+	case SAMPLE_DECO:
+	case SAMPLE_DECO_FIRST_STOP:
+		printf("%s{\"time\":%d,\"%s\":{\"ceiling\":%d,\"time\":%u}}", sep, time,
+			sample->type == SAMPLE_DECO ? "deco" : "deco_first_stop",
+			sample->value.deco.ceiling, sample->value.deco.time);
+		break;
+	case SAMPLE_EVENT:
+		printf("%s{\"time\":%d,\"event\":\"%s\"}", sep, time, sample->value.event);
+		break;
+	case SAMPLE_INTERDIVE:
+		printf("%s{\"time\":%d,\"interdive\":%d}", sep, time, sample->value.interdive.code);
+		break;
+	default:
+		// Tissues and unknowns aren't worth streaming
+		return 0;
+	}
+
+	(*count)++;
+	return 0;
+}
+
+
 cochran_sample_parser_t cochran_sample_get_parser(const unsigned char *model) {
 
 	struct parser_table {
@@ -962,6 +1065,7 @@ cochran_sample_parser_t cochran_sample_get_parser(const unsigned char *model) {
 		{ "221", cochran_sample_parse_II,	"Commander" },
 		{ "300", cochran_sample_parse_emc,	"EMC" },
 		{ "301", cochran_sample_parse_emc,	"EMC" },
+		{ "303", cochran_sample_parse_emc,	"EMC" },
 		{ "315", cochran_sample_parse_emc,	"EMC" },
 	};
 
@@ -978,12 +1082,27 @@ cochran_sample_parser_t cochran_sample_get_parser(const unsigned char *model) {
 
 
 int cochran_sample_parse(const unsigned char *model, const cochran_log_t *log, const unsigned char *samples, unsigned int size, cochran_sample_callback_t callback, void *userdata) {
+	const unsigned char *data[2] = { samples, NULL };
+	unsigned int sizes[2] = { size, 0 };
+
+	return cochran_sample_parse_segments(model, log, data, sizes, callback, userdata);
+}
+
+
+/*
+ * Parse samples in up to two segments, as a profile that wrapped the ring
+ * is, without stitching them together. Raw data pointers handed to the
+ * callback near the wrap are only good until it returns.
+ */
+int cochran_sample_parse_segments(const unsigned char *model, const cochran_log_t *log, const unsigned char *data[2], const unsigned int size[2], cochran_sample_callback_t callback, void *userdata) {
+	sample_input_t in;
 
 	cochran_sample_parser_t parser = cochran_sample_get_parser(model);
 
 	if (!parser)
 		return 1;
 
-	parser(log, samples, size, callback, userdata);
+	sample_input_init(&in, data, size);
+	parser(log, &in, callback, userdata);
 	return 0;
 }
@@ -0,0 +1,886 @@
+/*
+ * cochran_serial.c
+ *
+ * Download engine for Cochran dive computers. It talks to the device
+ * through a transport_t, see cochran_transport.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdlib.h>
+
+#include "cochran_transport.h"
+#include "cochran_device.h"
+#include "cochran_serial.h"
+
+#define uint32_to_array_le(buf, n) ((buf)[0] = (n) & 0xff, \
+									(buf)[1] = ((n) >> 8) & 0xff, \
+									(buf)[2] = ((n) >> 16) & 0xff, \
+									(buf)[3] = ((n) >> 24) & 0xff )
+#define uint24_to_array_le(buf, n) ((buf)[0] = (n) & 0xff, \
+									(buf)[1] = ((n) >> 8) & 0xff, \
+									(buf)[2] = ((n) >> 16) & 0xff )
+#define uint16_to_array_le(buf, n) ((buf)[0] = (n) & 0xff, \
+									(buf)[1] = ((n) >> 8) & 0xff )
+
+static double now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+void printhex(unsigned char *buf, int len)
+{
+	int ptr = 0;
+	int lineptr;
+	unsigned char ascii[17];
+
+	ascii[16] = 0;
+
+	while (ptr < len)
+	{
+		lineptr = 0;
+		dprintf(STDERR_FILENO, "%04x  ", ptr); // print byte count
+		while (ptr < len && lineptr < 16) {
+			if (lineptr == 8)
+				dprintf(STDERR_FILENO, "    %02X ", buf[ptr]);
+			else
+				dprintf(STDERR_FILENO, "%02X ", buf[ptr]);
+
+			// Build ascii representation
+			if (buf[ptr] >31 && buf[ptr] < 127)
+				ascii[lineptr] = buf[ptr];
+			else
+				ascii[lineptr] = '.';
+			ptr++;
+			lineptr++;
+		}
+
+		if (lineptr < 16) ascii[lineptr] = 0;
+		dprintf(STDERR_FILENO, " %s \n", ascii);
+	}
+}
+
+
+int wait_for_aa(transport_t *t) {
+	int ret, count = 0;
+	unsigned char buf[1];
+
+	t->ops->send_break(t, 16);
+	t->ops->flush(t);
+	t->ops->write(t, (const unsigned char *) "\x00", 1);
+	t->ops->sleep(t, 16);
+
+	while (count++ < 200) {
+		ret = t->ops->read(t, buf, 1, 50);
+		if (ret > 0) {
+			return 0;
+			if (buf[0] == 0xaa) return 0;
+		}
+	}
+	return 1;
+}
+
+int write_serial(session_t *session, const unsigned char *buf, unsigned int size, unsigned int hb) {
+
+	if (!session->quiet)
+		dprintf(STDERR_FILENO, "Sending %d byte command\n", size);
+
+	if (hb && wait_for_aa(session->transport))
+		return -1;
+
+	for (unsigned int x = 0; x < size; x++) {
+		if (!session->quiet)
+			dprintf(STDERR_FILENO, "- %02hhx ", buf[x]);
+		if (session->transport->ops->write(session->transport, buf + x, 1) != 1)
+			return errno;
+		session->transport->ops->sleep(session->transport, 16);
+	}
+	if (!session->quiet)
+		dprintf(STDERR_FILENO, "\n");
+
+	return 0;
+}
+
+
+int read_serial(session_t *session, unsigned char *buf, unsigned int size) {
+
+	int result_bytes = size;
+	int readcnt = 0, bufptr = 0, progress = 0;
+	unsigned int idle = 0;
+
+	// Hacker progress bar
+	unsigned int tick_size = size / 64;
+	if (tick_size < 1024) tick_size = 1024;
+	unsigned int ticks = size / tick_size;
+	unsigned char  *blank = "                                                                "; // 64 spaces
+
+	if (ticks > 1 && !session->quiet) {
+		dprintf(STDERR_FILENO, "[%s]\r[", blank + (64 - ticks));
+	}
+
+	while (bufptr < result_bytes)
+	{
+		readcnt = session->transport->ops->read(session->transport, buf + bufptr, result_bytes - bufptr, 16);
+
+		if (readcnt < 0 && errno != 11) dprintf(STDERR_FILENO, "readcnd less than zero: (%d) %s\n", errno, strerror(errno));
+
+		if (readcnt > 0) {
+			if (bufptr == 0 && session->stat)
+				session->stat->first_byte = now_ms() - session->stat->sent;
+			bufptr += readcnt;
+			idle = 0;
+			if (session->progress) session->progress(buf + bufptr, session->progress_data);
+			progress += readcnt;
+			if (progress >= tick_size) {
+				progress -= tick_size;
+				if (!session->quiet)
+					dprintf(STDERR_FILENO, ".");
+			}
+		} else if (session->timeout && (idle += 16) >= session->timeout) {
+			if (!session->quiet)
+				dprintf(STDERR_FILENO, "\nTimed out after %d bytes\n", bufptr);
+			if (session->stat)
+				session->stat->bytes = bufptr;
+			return ETIMEDOUT;
+		}
+
+		// Let data pile up between reads, an empty read has already waited
+		if (readcnt > 0 && bufptr < result_bytes)
+			session->transport->ops->sleep(session->transport, 16);
+	}
+
+	if (!session->quiet)
+		dprintf(STDERR_FILENO, "\nRead %d bytes\n", bufptr);
+	if (session->stat)
+		session->stat->bytes = bufptr;
+	return 0;
+}
+
+
+// Start the telemetry record for a command, NULL when stats are off
+static cmd_stat_t *stat_begin(session_t *session, const unsigned char *cmd, unsigned int size, unsigned int baud) {
+	session_stats_t *stats = session->stats;
+
+	session->stat = NULL;
+	if (!stats)
+		return NULL;
+
+	if (stats->count == stats->alloc) {
+		unsigned int alloc = stats->alloc ? stats->alloc * 2 : 64;
+		cmd_stat_t *cmds = realloc(stats->cmds, alloc * sizeof(cmd_stat_t));
+		if (!cmds)
+			return NULL;
+		stats->cmds = cmds;
+		stats->alloc = alloc;
+	}
+
+	cmd_stat_t *st = &stats->cmds[stats->count++];
+	memset(st, 0, sizeof(*st));
+
+	double now = now_ms();
+	if (stats->count == 1)
+		stats->epoch = now;
+
+	st->cmd = cmd[0];
+	st->address = UNSUPPORTED;
+	st->requested = size;
+	st->baud = baud;
+	st->started = now - stats->epoch;
+	st->total = now;
+
+	session->stat = st;
+	return st;
+}
+
+
+static int stat_end(session_t *session, int rc) {
+	cmd_stat_t *st = session->stat;
+
+	if (st) {
+		st->total = now_ms() - st->total;
+		st->rc = rc;
+		session->stat = NULL;
+	}
+	return rc;
+}
+
+
+// Wake the device and send the command, timing both
+static int send_cmd(session_t *session, cmd_stat_t *st, unsigned char *cmd, unsigned int cmd_size) {
+	double t = now_ms();
+	int rc;
+
+	if (wait_for_aa(session->transport)) {
+		if (!session->quiet)
+			dprintf(STDERR_FILENO, "No response from %s\n", session->port);
+		return -1;		// The device never woke up
+	}
+
+	if (st) {
+		st->wake = now_ms() - t;
+		t = now_ms();
+	}
+
+	if ((rc = write_serial(session, cmd, cmd_size, 0))) {
+		if (!session->quiet)
+			dprintf(STDERR_FILENO, "Error (%d) writing. %s\n", errno, strerror(errno));
+		return rc;
+	}
+
+	if (st) {
+		st->send = now_ms() - t;
+		st->sent = now_ms();		// read_serial() measures first_byte from here
+	}
+	return 0;
+}
+
+
+int do_cmd(session_t *session, unsigned char *cmd, unsigned int cmd_size, unsigned char *buf, unsigned int size) {
+	cmd_stat_t *st = stat_begin(session, cmd, size, session->device->baud);
+	int rc;
+
+	if ((rc = send_cmd(session, st, cmd, cmd_size)))
+		return stat_end(session, rc);
+
+	return stat_end(session, read_serial(session, buf, size));
+}
+
+
+int do_cmd_high_baud(session_t *session, unsigned char *cmd, unsigned int cmd_size, unsigned char *buf, unsigned int size) {
+	device_t *device = session->device;
+	unsigned int highbaud = session->highbaud ? session->highbaud : device->highbaud;
+	cmd_stat_t *st = stat_begin(session, cmd, size, highbaud);
+	transport_t *port = session->transport;
+	double t;
+	int rc;
+
+	if ((rc = send_cmd(session, st, cmd, cmd_size)))
+		return stat_end(session, rc);
+
+	// Change baud
+	t = now_ms();
+	if (port->ops->set_baud(port, highbaud))
+		return stat_end(session, errno);
+	if (st)
+		st->baud_switch = now_ms() - t;
+
+	rc = read_serial(session, buf, size);
+
+	// Change baud
+	t = now_ms();
+	if (port->ops->set_baud(port, device->baud))
+		return stat_end(session, errno);
+	if (st)
+		st->baud_switch += now_ms() - t;
+
+	return stat_end(session, rc);
+}
+
+
+// Telemetry: the command just sent was a repeat of an earlier one
+static void stat_retry(session_t *session) {
+	if (session->stats && session->stats->count)
+		session->stats->cmds[session->stats->count - 1].retries++;
+}
+
+
+// Telemetry: the command just sent read memory from address
+static void stat_address(session_t *session, unsigned int address) {
+	if (session->stats && session->stats->count)
+		session->stats->cmds[session->stats->count - 1].address = address;
+}
+
+
+/*
+ * Low-baud reads go out in chunks, each paying for the break/heartbeat
+ * handshake. Big chunks spread that cost, small ones make a failed chunk
+ * cheap to ask for again, so start at the family's largest chunk, halve
+ * it after each failure and double it again after a few clean reads.
+ * Reads here always time out, a chunk that stalls is retried.
+ */
+#define CHUNK_TIMEOUT	3000		// ms of silence when the session has no timeout
+#define CHUNK_ATTEMPTS	4			// failures in a row before giving up
+#define CHUNK_GROW		2			// clean reads before the chunk doubles
+
+int read_low_baud(session_t *session, unsigned int address, unsigned int read_size, unsigned char *buf, unsigned int size) {
+	device_t *device = session->device;
+	unsigned int chunk_max = device->chunk_max ? device->chunk_max : 0x8000;
+	unsigned int chunk_min = device->chunk_min ? device->chunk_min : chunk_max;
+	unsigned int chunk = chunk_max, clean = 0, failures = 0, done = 0;
+	unsigned int saved_timeout = session->timeout;
+	unsigned char cmd[6];
+	unsigned int cmd_size = 6;
+	int retry = 0, rc = 0;
+
+	if (read_size > size)
+		read_size = size;
+
+	if (!session->timeout)
+		session->timeout = CHUNK_TIMEOUT;
+
+	cmd[0] = 0x05;
+
+	while (done < read_size) {
+		unsigned int len = (read_size - done < chunk ? read_size - done : chunk);
+
+		// Load address and size into command
+		uint24_to_array_le(cmd + 1, address + done);
+		uint16_to_array_le(cmd + 4, len);
+
+		rc = do_cmd(session, cmd, cmd_size, buf + done, len);
+		stat_address(session, address + done);
+		if (retry)
+			stat_retry(session);
+
+		if (!rc) {
+			done += len;
+			failures = 0;
+			retry = 0;
+			if (++clean >= CHUNK_GROW && chunk < chunk_max) {
+				chunk = (chunk * 2 > chunk_max ? chunk_max : chunk * 2);
+				clean = 0;
+			}
+			continue;
+		}
+
+		// -1 means nothing answered, no point asking again
+		if (rc == -1 || ++failures >= CHUNK_ATTEMPTS)
+			break;
+
+		if (!session->quiet)
+			dprintf(STDERR_FILENO, "Chunk at 0x%06x failed, retrying\n", address + done);
+		chunk = (chunk / 2 < chunk_min ? chunk_min : chunk / 2);
+		clean = 0;
+		retry = 1;
+	}
+
+	session->timeout = saved_timeout;
+	return rc;
+}
+
+int read_high_baud(session_t *session, unsigned int address, unsigned int read_size, unsigned char *buf, unsigned int size) {
+	unsigned char cmd[10];
+	unsigned int cmd_size = 10;
+	unsigned int highbaud_byte = session->highbaud ? session->highbaud_byte : session->device->highbaud_byte;
+
+	switch (session->device->family) {
+	case FAMILY_COMMANDER:		// 24 bit command
+		cmd[0] = 0x15;
+		uint24_to_array_le(cmd + 1, address);
+		uint24_to_array_le(cmd + 4, read_size);
+		cmd[7] = highbaud_byte;
+		cmd_size = 8;
+		break;
+	case FAMILY_EMC:				// 32 bit command
+		cmd[0] = 0x15;
+		uint32_to_array_le(cmd + 1, address);
+		uint32_to_array_le(cmd + 5, read_size);
+		cmd[9] = highbaud_byte;
+		break;
+	default:				// Commander TM has no high-speed read
+		return -1;
+	}
+
+	int rc = do_cmd_high_baud(session, cmd, cmd_size, buf, size);
+	stat_address(session, address);
+	return rc;
+}
+
+
+int read_id(session_t *session, unsigned char *buf, unsigned int size) {
+	unsigned char cmd[6];
+	unsigned int cmd_size = 6;
+
+	switch (session->device->family) {
+	case FAMILY_COMMANDER_TM:
+		memcpy(cmd, "\x05\xBD\x7F\x00\x43\x00", cmd_size);
+		break;
+	case FAMILY_COMMANDER:
+		memcpy(cmd, "\x05\xBD\x7F\x00\x43\x00", cmd_size);
+		break;
+	case FAMILY_EMC:
+		memcpy(cmd, "\x05\x9D\xFF\x00\x43\x00", cmd_size);
+		break;
+	default:
+		return -1;
+		break;
+	}
+
+	return do_cmd(session, cmd, cmd_size, buf, size);
+}
+
+
+int read_config0(session_t *session, unsigned char *buf, unsigned int size) {
+	unsigned char cmd[2];
+	unsigned int cmd_size;
+
+	switch (session->device->family) {
+	case FAMILY_COMMANDER_TM:
+		cmd[0] = 0x96;
+		cmd_size = 1;
+		break;
+	case FAMILY_COMMANDER:
+	case FAMILY_EMC:
+		cmd[0] = 0x96;
+		cmd[1] = 0x00;
+		cmd_size = 2;
+		break;
+	default:
+		return -1;
+		break;
+	}
+
+	return do_cmd(session, cmd, cmd_size, buf, size);
+}
+
+
+int read_config1(session_t *session, unsigned char *buf, unsigned int size) {
+	unsigned char cmd[2];
+	unsigned int cmd_size;
+
+	switch (session->device->family) {
+	case FAMILY_COMMANDER_TM:
+		dprintf(STDERR_FILENO, "Device %s doesn't have a second config page.\n", session->device->name);
+		return 0;
+		break;
+	case FAMILY_COMMANDER:
+	case FAMILY_EMC:
+		cmd[0] = 0x96;
+		cmd[1] = 0x01;
+		cmd_size = 2;
+		break;
+	default:
+		return -1;
+		break;
+	}
+
+	return do_cmd(session, cmd, cmd_size, buf, size);
+}
+
+
+// Part of the write protocol, acked by a single 0xaa. The device must be awake.
+static int send_acked(session_t *session, unsigned char *cmd, unsigned int cmd_size) {
+	cmd_stat_t *st = stat_begin(session, cmd, 1, session->device->baud);
+	unsigned char ack = 0;
+	double t = now_ms();
+	int rc;
+
+	if ((rc = write_serial(session, cmd, cmd_size, 0)))
+		return stat_end(session, rc);
+
+	if (st) {
+		st->send = now_ms() - t;
+		st->sent = now_ms();
+	}
+
+	if ((rc = read_serial(session, &ack, 1)))
+		return stat_end(session, rc);
+
+	return stat_end(session, ack == 0xaa ? 0 : EIO);
+}
+
+
+/*
+ * Write words of a config page then read the page back to check them.
+ * Each word is sent as 0x5a <word lo> <word hi> <byte 0> <byte 1>, with
+ * word numbers running on from page to page (256 a page), and 0xc3
+ * commits them. The device acks both with 0xaa.
+ *
+ * Analyst sends one word per wake. Sending several before the commit is
+ * what a preset needs and saves a break and wake per word.
+ */
+int write_config(session_t *session, unsigned int page, const unsigned char *config, const unsigned short *words, unsigned int count) {
+	unsigned char cmd[5], check[512];
+	int rc;
+
+	if (session->device->family == FAMILY_COMMANDER_TM || page > 1) {
+		dprintf(STDERR_FILENO, "Device %s can't write config%u.\n", session->device->name, page);
+		return -1;
+	}
+
+	if (!count)
+		return 0;
+
+	if (wait_for_aa(session->transport)) {
+		if (!session->quiet)
+			dprintf(STDERR_FILENO, "No response from %s\n", session->port);
+		return -1;
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		unsigned int word = page * 256 + words[i];
+
+		cmd[0] = 0x5a;
+		cmd[1] = word & 0xff;
+		cmd[2] = word >> 8;
+		cmd[3] = config[words[i] * 2];
+		cmd[4] = config[words[i] * 2 + 1];
+		if ((rc = send_acked(session, cmd, 5)))
+			return rc;
+	}
+
+	cmd[0] = 0xc3;
+	if ((rc = send_acked(session, cmd, 1)))
+		return rc;
+
+	rc = (page ? read_config1(session, check, sizeof(check)) : read_config0(session, check, sizeof(check)));
+	if (rc)
+		return rc;
+
+	for (unsigned int i = 0; i < count; i++)
+		if (memcmp(check + words[i] * 2, config + words[i] * 2, 2))
+			return EIO;
+
+	return 0;
+}
+
+
+int read_misc(session_t *session, unsigned char *buf, unsigned int size) {
+	unsigned char cmd[6];
+	unsigned int cmd_size = 6;
+
+	memcpy(cmd, "\x05\xE0\x03\x00\xDC\x05", cmd_size);
+
+	// Tell DC to refresh write current state data
+	write_serial(session, "\x89", 1, 1);
+
+	return do_cmd(session, cmd, cmd_size, buf, size);
+}
+
+
+int read_ram(session_t *session, unsigned char *buf, unsigned int size) {
+	// Tell DC to refresh write current state data
+	write_serial(session, "\x89", 1, 1);
+
+	return read_low_baud(session, 0, session->device->ram_size, buf, size);
+}
+
+
+// FNV-1a, plenty to tell two reads of a block apart
+static unsigned long long block_hash(const unsigned char *buf, unsigned int size) {
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	for (unsigned int i = 0; i < size; i++) {
+		h ^= buf[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+
+static int block_erased(const unsigned char *buf, unsigned int size) {
+	for (unsigned int i = 0; i < size; i++)
+		if (buf[i] != 0xff) return 0;
+	return 1;
+}
+
+
+// Read through the fastest path the session has, counting it as a retry when asked
+static int read_again(session_t *session, unsigned int address, unsigned char *buf, unsigned int size, int retry) {
+	int rc;
+
+	if (session->highbaud == UNSUPPORTED)
+		rc = read_low_baud(session, address, size, buf, size);
+	else
+		rc = read_high_baud(session, address, size, buf, size);
+
+	if (retry)
+		stat_retry(session);
+
+	return rc;
+}
+
+
+// Mark the blocks of buf that begin up to end overlaps
+static void mark_blocks(unsigned char *mark, unsigned char value, unsigned int address, unsigned int size, unsigned int begin, unsigned int end) {
+	if (end <= address || begin >= address + size)
+		return;
+	begin = (begin < address ? 0 : begin - address);
+	end = (end > address + size ? size : end - address);
+
+	for (unsigned int b = begin / VERIFY_BLOCK; b * VERIFY_BLOCK < end; b++)
+		if (mark[b] < value)
+			mark[b] = value;
+}
+
+
+/*
+ * Check a downloaded image against the device without downloading it
+ * again. Only suspect blocks are read a second time: those a first pass
+ * chunk covered that failed, was retried or came back short, as the
+ * session's telemetry recorded it, and those holding data in the hot
+ * ranges, begin/end device address pairs the caller knows matter most,
+ * the logbook and the newest dive's profile. Suspect blocks go again in
+ * runs of up to VERIFY_RUN bytes, boundaries that have nothing to do with
+ * the first pass's transfer, and their hashes compared. A block that
+ * differs is fetched a third time by its own address and the two reads
+ * that agree win. buf is repaired in place.
+ *
+ * Without telemetry only the hot ranges are checked.
+ *
+ * Returns EIO when some block never read the same way twice.
+ */
+int verify_read(session_t *session, unsigned int address, unsigned char *buf, unsigned int size, unsigned int (*hot)[2], unsigned int hot_count, verify_result_t *result) {
+	unsigned int blocks = (size + VERIFY_BLOCK - 1) / VERIFY_BLOCK;
+	unsigned char *again = malloc(VERIFY_RUN), *third = malloc(VERIFY_BLOCK);
+	unsigned long long *hashes = malloc(blocks * sizeof(*hashes));
+	unsigned char *suspect = calloc(blocks, 1);		// 1 if it holds data, 2 always
+	int rc = 0;
+
+	memset(result, 0, sizeof(*result));
+
+	if (!again || !third || !hashes || !suspect) {
+		rc = ENOMEM;
+		goto out;
+	}
+
+	for (unsigned int h = 0; h < hot_count; h++)
+		mark_blocks(suspect, 1, address, size, hot[h][0], hot[h][1]);
+
+	// Telemetry so far is the first pass, reads that went wrong are suspect
+	unsigned int commands = session->stats ? session->stats->count : 0;
+	for (unsigned int c = 0; c < commands; c++) {
+		cmd_stat_t *st = &session->stats->cmds[c];
+		if (st->address != UNSUPPORTED && (st->retries || st->rc || st->bytes < st->requested))
+			mark_blocks(suspect, 2, address, size, st->address, st->address + st->requested);
+	}
+
+	for (unsigned int b = 0; b < blocks; b++) {
+		unsigned int len = (b + 1) * VERIFY_BLOCK > size ? size - b * VERIFY_BLOCK : VERIFY_BLOCK;
+		if (suspect[b] == 1 && block_erased(buf + b * VERIFY_BLOCK, len))
+			suspect[b] = 0;
+		hashes[b] = block_hash(buf + b * VERIFY_BLOCK, len);
+		result->blocks += !!suspect[b];
+	}
+
+	unsigned int b = 0;
+	while (b < blocks) {
+		if (!suspect[b]) {
+			b++;
+			continue;
+		}
+
+		// Gather a run of suspect blocks
+		unsigned int first = b;
+		unsigned int start = first * VERIFY_BLOCK, end = start;
+		while (b < blocks && suspect[b] && end - start < VERIFY_RUN) {
+			end = (b + 1) * VERIFY_BLOCK > size ? size : (b + 1) * VERIFY_BLOCK;
+			b++;
+		}
+
+		if ((rc = read_again(session, address + start, again, end - start, 0)))
+			goto out;
+
+		for (unsigned int v = first; v < b; v++) {
+			unsigned int offset = v * VERIFY_BLOCK;
+			unsigned int len = (offset + VERIFY_BLOCK > size ? size - offset : VERIFY_BLOCK);
+			unsigned long long h = block_hash(again + offset - start, len);
+
+			if (h == hashes[v])
+				continue;
+
+			// Tie break with a third read of just this block
+			if ((rc = read_again(session, address + offset, third, len, 1)))
+				goto out;
+
+			unsigned long long t = block_hash(third, len);
+			if (t == hashes[v]) {
+				continue;		// The re-read was the bad one
+			} else if (t == h) {
+				memcpy(buf + offset, third, len);
+				hashes[v] = t;
+				result->repaired++;
+			} else {
+				if (!session->quiet)
+					dprintf(STDERR_FILENO, "Block at 0x%06x read three different ways\n", address + offset);
+				result->failed++;
+			}
+		}
+	}
+
+	if (result->failed)
+		rc = EIO;
+
+out:
+	free(again);
+	free(third);
+	free(hashes);
+	free(suspect);
+	return rc;
+}
+
+
+// An ID block is 0x43 bytes, at 9600 baud a live unit answers well inside this
+#define ID_PROBE_TIMEOUT 500
+
+
+/*
+ * Work out what's on the end of the port. Commanders and EMCs keep the
+ * ID block at different addresses so try each family's ID command until
+ * one returns a Cochran ID block that matches a signature. The block is
+ * left in id.
+ *
+ * A wrong family still answers with 0x43 bytes of something, so probes
+ * run with a short timeout and give up at once if nothing wakes up.
+ */
+device_t *identify_device(session_t *session, unsigned char *id, unsigned int size) {
+	family_id_t probes[] = { FAMILY_COMMANDER, FAMILY_EMC };
+	device_t *saved_device = session->device;
+	unsigned int saved_timeout = session->timeout;
+	device_t *found = NULL;
+
+	if (size <= ID_MODEL_OFFSET + 3)
+		return NULL;
+
+	session->timeout = ID_PROBE_TIMEOUT;
+
+	for (unsigned int p = 0; p < C_ARRAY_SIZE(probes) && !found; p++) {
+		device_t probe = { .name = "probe", .family = probes[p], .baud = 9600 };
+		session->device = &probe;
+
+		int rc = read_id(session, id, size);
+		if (rc == -1)
+			break;		// Nothing answered the wake up
+		if (rc || !memmem(id, size, "COCHRAN", 7))
+			continue;
+
+		found = device_from_id(id, probes[p]);
+		if (!found)
+			dprintf(STDERR_FILENO, "%s: Unknown model code %.3s\n", session->port, id + ID_MODEL_OFFSET);
+	}
+
+	session->device = saved_device;
+	session->timeout = saved_timeout;
+
+	return found;
+}
+
+
+// High-speed rates and the read command byte that asks for them, fastest first
+static const struct {
+	unsigned int baud;
+	unsigned int byte;
+} high_bauds[] = {
+	{ 806400, 0x05 },
+	{ 115200, 0x04 },
+};
+
+
+/*
+ * Pick the fastest high-speed rate the device offers that the local port
+ * can actually be set to. Plenty of USB adapters (and every PTY) refuse
+ * the custom 806400 divisor, those drop to 115200. The result is kept in
+ * the session, session->highbaud is UNSUPPORTED when there's no
+ * high-speed read at all.
+ */
+unsigned int negotiate_baud(session_t *session) {
+	device_t *device = session->device;
+
+	session->highbaud = UNSUPPORTED;
+	session->highbaud_byte = UNSUPPORTED;
+
+	if (device->highbaud == UNSUPPORTED)
+		return UNSUPPORTED;
+
+	for (unsigned int b = 0; b < C_ARRAY_SIZE(high_bauds); b++) {
+		if (high_bauds[b].baud > device->highbaud)
+			continue;
+		if (session->transport->ops->set_baud(session->transport, high_bauds[b].baud))
+			continue;
+		session->highbaud = high_bauds[b].baud;
+		session->highbaud_byte = high_bauds[b].byte;
+		break;
+	}
+
+	session->transport->ops->set_baud(session->transport, device->baud);
+
+	return session->highbaud;
+}
+
+
+static double per_second(unsigned int bytes, double ms) {
+	return ms > 0 ? bytes * 1000.0 / ms : 0;
+}
+
+
+/*
+ * Write the session's telemetry as one JSON object: every command in
+ * order and a summary per command byte, so slow handshakes, baud
+ * switches and slow lines can be told apart.
+ */
+void session_stats_json(session_t *session, int fd) {
+	session_stats_t *stats = session->stats;
+	unsigned int count = stats ? stats->count : 0;
+
+	dprintf(fd, "{\"port\":\"%s\",\"model\":\"%s\",\"commands\":[",
+			session->port ? session->port : "", session->device ? (char *) session->device->name : "");
+
+	for (unsigned int i = 0; i < count; i++) {
+		cmd_stat_t *st = &stats->cmds[i];
+		char first_byte[32] = "null";	// No reply, no delay to report
+
+		if (st->bytes)
+			snprintf(first_byte, sizeof(first_byte), "%.1f", st->first_byte);
+
+		dprintf(fd, "%s\n{\"cmd\":%u,\"requested\":%u,\"bytes\":%u,\"baud\":%u,"
+				"\"start_ms\":%.1f,\"wake_ms\":%.1f,\"send_ms\":%.1f,\"baud_switch_ms\":%.1f,"
+				"\"first_byte_ms\":%s,\"total_ms\":%.1f,\"bytes_per_sec\":%.0f,\"retries\":%u,\"rc\":%d}",
+				i ? "," : "", st->cmd, st->requested, st->bytes, st->baud,
+				st->started, st->wake, st->send, st->baud_switch,
+				first_byte, st->total, per_second(st->bytes, st->total), st->retries, st->rc);
+	}
+
+	// Totals per command byte
+	dprintf(fd, "],\n\"summary\":[");
+	int first = 1;
+	for (unsigned int c = 0; c < 256; c++) {
+		unsigned int n = 0, replied = 0, bytes = 0, retries = 0, failed = 0;
+		double total = 0, wake = 0, baud_switch = 0, first_byte = 0;
+
+		for (unsigned int i = 0; i < count; i++) {
+			cmd_stat_t *st = &stats->cmds[i];
+			if (st->cmd != c)
+				continue;
+			n++;
+			bytes += st->bytes;
+			retries += st->retries;
+			failed += (st->rc != 0);
+			total += st->total;
+			wake += st->wake;
+			baud_switch += st->baud_switch;
+			if (st->bytes) {
+				replied++;
+				first_byte += st->first_byte;
+			}
+		}
+		if (!n)
+			continue;
+
+		char avg_first_byte[32] = "null";
+		if (replied)
+			snprintf(avg_first_byte, sizeof(avg_first_byte), "%.1f", first_byte / replied);
+
+		dprintf(fd, "%s\n{\"cmd\":%u,\"count\":%u,\"bytes\":%u,\"total_ms\":%.1f,"
+				"\"wake_ms\":%.1f,\"baud_switch_ms\":%.1f,\"avg_first_byte_ms\":%s,"
+				"\"bytes_per_sec\":%.0f,\"retries\":%u,\"failed\":%u}",
+				first ? "" : ",", c, n, bytes, total, wake, baud_switch, avg_first_byte,
+				per_second(bytes, total), retries, failed);
+		first = 0;
+	}
+	dprintf(fd, "]}\n");
+}
+
+
+void session_stats_free(session_stats_t *stats) {
+	free(stats->cmds);
+	stats->cmds = NULL;
+	stats->count = stats->alloc = 0;
+}
+
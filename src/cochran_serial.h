@@ -0,0 +1,81 @@
+/*
+ * cochran_serial.h
+ *
+ * Download engine for Cochran dive computers on a serial port. All state
+ * for a connection lives in a session_t so several ports can be driven at
+ * once from different threads.
+ *
+ * Include cochran_transport.h and cochran_device.h first.
+ */
+
+// Called as data lands in the read buffer, end points past the last byte
+typedef void (*read_progress_t) (const unsigned char *end, void *userdata);
+
+// Telemetry for one command exchange, times are ms
+typedef struct cmd_stat_t {
+	unsigned char cmd;			// First command byte
+	unsigned int address;		// Where a memory read started, UNSUPPORTED for other commands
+	unsigned int requested;		// Bytes asked for
+	unsigned int bytes;			// Bytes that arrived
+	unsigned int baud;			// Rate the reply came in at
+	double started;				// Since the first command of the session
+	double wake;				// Break until the device answered
+	double send;				// Writing the command, 16ms a byte
+	double baud_switch;			// set_baud() there and back
+	double first_byte;			// Command sent until the first reply byte, 0 if none came
+	double sent;				// Monotonic ms the command went out
+	double total;
+	unsigned int retries;		// Times the command was sent again
+	int rc;
+} cmd_stat_t;
+
+typedef struct session_stats_t {
+	cmd_stat_t *cmds;
+	unsigned int count;
+	unsigned int alloc;
+	double epoch;				// Monotonic ms of the first command
+} session_stats_t;
+
+typedef struct session_t {
+	device_t *device;
+	transport_t *transport;
+	const char *port;
+	int quiet;					// No command echo or progress bar
+	unsigned int timeout;		// ms of silence before a read gives up, 0 waits forever
+	read_progress_t progress;
+	void *progress_data;
+	unsigned int highbaud;		// Negotiated high-speed rate, 0 uses the device's
+	unsigned int highbaud_byte;
+	session_stats_t *stats;		// Per command telemetry, NULL to skip it
+	cmd_stat_t *stat;			// Command in flight
+} session_t;
+
+// Blocks are verified in this size, re-reads are merged into runs of up to VERIFY_RUN
+#define VERIFY_BLOCK	0x1000
+#define VERIFY_RUN		0x10000
+
+typedef struct verify_result_t {
+	unsigned int blocks;		// Suspect blocks that were read again
+	unsigned int repaired;		// First read was wrong, two later reads agreed
+	unsigned int failed;		// No two reads agreed
+} verify_result_t;
+
+void printhex(unsigned char *buf, int len);
+int wait_for_aa(transport_t *t);
+int write_serial(session_t *session, const unsigned char *buf, unsigned int size, unsigned int hb);
+int read_serial(session_t *session, unsigned char *buf, unsigned int size);
+int do_cmd(session_t *session, unsigned char *cmd, unsigned int cmd_size, unsigned char *buf, unsigned int size);
+int do_cmd_high_baud(session_t *session, unsigned char *cmd, unsigned int cmd_size, unsigned char *buf, unsigned int size);
+int read_low_baud(session_t *session, unsigned int address, unsigned int read_size, unsigned char *buf, unsigned int size);
+int read_high_baud(session_t *session, unsigned int address, unsigned int read_size, unsigned char *buf, unsigned int size);
+int read_id(session_t *session, unsigned char *buf, unsigned int size);
+int read_config0(session_t *session, unsigned char *buf, unsigned int size);
+int read_config1(session_t *session, unsigned char *buf, unsigned int size);
+int write_config(session_t *session, unsigned int page, const unsigned char *config, const unsigned short *words, unsigned int count);
+int read_misc(session_t *session, unsigned char *buf, unsigned int size);
+int read_ram(session_t *session, unsigned char *buf, unsigned int size);
+int verify_read(session_t *session, unsigned int address, unsigned char *buf, unsigned int size, unsigned int (*hot)[2], unsigned int hot_count, verify_result_t *result);
+device_t *identify_device(session_t *session, unsigned char *id, unsigned int size);
+unsigned int negotiate_baud(session_t *session);
+void session_stats_json(session_t *session, int fd);
+void session_stats_free(session_stats_t *stats);
@@ -8,13 +8,12 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <ctype.h>
 #include <math.h>
 
 #include "cochran_settings.h"
 
-extern struct cochran_config emc_cfg[];
-extern struct cochran_config cmd_cfg[];
-
 struct cochran_config_word cochran_config_get_word(const unsigned char *config, int word_num)
 {
 	struct cochran_config_word word;
@@ -26,96 +25,113 @@ struct cochran_config_word cochran_config_get_word(const unsigned char *config,
 }
 
 
-void cochran_config_decode_value(struct cochran_config_word *word, struct cochran_config *cfg,
-	union cochran_config_value *value)
+// Decode one field from its word, shift and mask only matter for bit fields
+static void decode(const unsigned char *data, enum cochran_config_encoding encoding, int byte,
+	unsigned char shift, unsigned char value_mask, union cochran_config_value *value)
 {
-	unsigned char shift, value_mask;
-
 	// Extract the data
-	switch (cfg->encoding) {
+	switch (encoding) {
 	case CONFIG_ENC_LE_INT:		// Little endian integer
-		value->integer = word->data[0] + word->data[1] * 256;
+		value->integer = data[0] + data[1] * 256;
 		break;
 	case CONFIG_ENC_BE_INT:		// Big endian integer
-		value->integer = word->data[1] + word->data[0] * 256;
+		value->integer = data[1] + data[0] * 256;
 		break;
 	case CONFIG_ENC_LE_INT_SEC:		// Little endian integer, take whole two bytes, div by 60
-		value->integer = (word->data[0] + word->data[1] * 256) / 60;
+		value->integer = (data[0] + data[1] * 256) / 60;
 		break;
 	case CONFIG_ENC_BE_INT_SEC:		// Little endian integer, take whole two bytes, div by 60
-		value->integer = (word->data[1] + word->data[0] * 256) / 60;
+		value->integer = (data[1] + data[0] * 256) / 60;
 		break;
 	case CONFIG_ENC_LE_DECIMAL:	// Little endian decimal, take whole two bytes
-		value->rational = round(((float) word->data[0] / 256 + word->data[1]) * 100) / 100;
+		value->rational = round(((float) data[0] / 256 + data[1]) * 100) / 100;
 		break;
 	case CONFIG_ENC_BE_DECIMAL:	// Little endian decimal, take whole two bytes
-		value->rational = round(((float) word->data[1] / 256 + word->data[0]) * 100) / 100;
+		value->rational = round(((float) data[1] / 256 + data[0]) * 100) / 100;
 		break;
 	case CONFIG_ENC_PERCENT:	// Take a whole byte
-		value->integer =  round((float) word->data[cfg->byte] * 100 / 256);
+		value->integer =  round((float) data[byte] * 100 / 256);
 		break;
 	case CONFIG_ENC_BIT_INT:	// Mask bits and shift to a integer
-		shift = cfg->start_bit + 1 - cfg->bits;
-		value_mask = (1 << cfg->bits) - 1;
-		value->integer = word->data[cfg->byte] >> shift & value_mask;
+		value->integer = data[byte] >> shift & value_mask;
 		break;
 	}
 }
 
-void cochran_config_get_value(const unsigned char *config, struct cochran_config *cfg,
-	union cochran_config_value *value)
-{
-	struct cochran_config_word word;
 
-	word = cochran_config_get_word(config, cfg->word);
-	cochran_config_decode_value(&word, cfg, value);
-}
-
-
-void cochran_config_encode_value(struct cochran_config_word *word, struct cochran_config *cfg,
-	union cochran_config_value *value)
+static void encode(unsigned char *data, enum cochran_config_encoding encoding, int byte,
+	unsigned char shift, unsigned char value_mask, const union cochran_config_value *value)
 {
-	unsigned char shift, value_mask, word_mask;
-
-	// Extract the data
-	switch (cfg->encoding) {
+	switch (encoding) {
 	case CONFIG_ENC_LE_INT:		// Little endian integer, take whole two bytes
-		word->data[0] = value->integer & 0xff;
-		word->data[1] = (value->integer >> 8) & 0xff;
+		data[0] = value->integer & 0xff;
+		data[1] = (value->integer >> 8) & 0xff;
 		break;
 	case CONFIG_ENC_BE_INT:		// Little endian integer, take whole two bytes
-		word->data[1] = value->integer & 0xff;
-		word->data[0] = (value->integer >> 8) & 0xff;
+		data[1] = value->integer & 0xff;
+		data[0] = (value->integer >> 8) & 0xff;
 		break;
 	case CONFIG_ENC_LE_INT_SEC:		// Little endian integer, take whole two bytes, mult by 60
-		word->data[0] = (value->integer * 60) & 0xff;
-		word->data[1] = ((value->integer * 60) >> 8) & 0xff;
+		data[0] = (value->integer * 60) & 0xff;
+		data[1] = ((value->integer * 60) >> 8) & 0xff;
 		break;
 	case CONFIG_ENC_BE_INT_SEC:		// Little endian integer, take whole two bytes, mult by 60
-		word->data[1] = (value->integer * 60) & 0xff;
-		word->data[0] = ((value->integer * 60) >> 8) & 0xff;
+		data[1] = (value->integer * 60) & 0xff;
+		data[0] = ((value->integer * 60) >> 8) & 0xff;
 		break;
 	case CONFIG_ENC_LE_DECIMAL:	// Little endian decimal, take whole two bytes
-		word->data[0] = (int) (value->rational * 256) & 0xff;
-		word->data[1] = ((int) (value->rational * 256) >> 8) & 0xff;
+		data[0] = (int) (value->rational * 256) & 0xff;
+		data[1] = ((int) (value->rational * 256) >> 8) & 0xff;
 		break;
 	case CONFIG_ENC_BE_DECIMAL:	// Little endian decimal, take whole two bytes
-		word->data[1] = (int) (value->rational * 256) & 0xff;
-		word->data[0] = ((int) (value->rational * 256) >> 8) & 0xff;
+		data[1] = (int) (value->rational * 256) & 0xff;
+		data[0] = ((int) (value->rational * 256) >> 8) & 0xff;
 		break;
 	case CONFIG_ENC_PERCENT:	// Take a whole byte
-		word->data[cfg->byte] = (float) value->integer / 100 * 256;
+		data[byte] = (float) value->integer / 100 * 256;
 		break;
 	case CONFIG_ENC_BIT_INT:	// Shift/mask integer into a byte
-		shift = cfg->start_bit + 1 - cfg->bits;
-		value_mask = (1 << cfg->bits) - 1;
-		word_mask = ~value_mask & 0xffff;
-		word->data[cfg->byte] &= word_mask;
-		word->data[cfg->byte] |= (value->integer & value_mask) << shift;
+		data[byte] &= ~(value_mask << shift);
+		data[byte] |= (value->integer & value_mask) << shift;
 		break;
 	}
 }
 
+
+static unsigned char field_shift(const struct cochran_config *cfg)
+{
+	return (cfg->encoding == CONFIG_ENC_BIT_INT ? cfg->start_bit + 1 - cfg->bits : 0);
+}
+
+
+static unsigned char field_mask(const struct cochran_config *cfg)
+{
+	return (cfg->encoding == CONFIG_ENC_BIT_INT ? (1 << cfg->bits) - 1 : 0xff);
+}
+
+
+void cochran_config_decode_value(struct cochran_config_word *word, struct cochran_config *cfg,
+	union cochran_config_value *value)
+{
+	decode(word->data, cfg->encoding, cfg->byte, field_shift(cfg), field_mask(cfg), value);
+}
+
+void cochran_config_get_value(const unsigned char *config, struct cochran_config *cfg,
+	union cochran_config_value *value)
+{
+	struct cochran_config_word word;
+
+	word = cochran_config_get_word(config, cfg->word);
+	cochran_config_decode_value(&word, cfg, value);
+}
+
+
+void cochran_config_encode_value(struct cochran_config_word *word, struct cochran_config *cfg,
+	union cochran_config_value *value)
+{
+	encode(word->data, cfg->encoding, cfg->byte, field_shift(cfg), field_mask(cfg), value);
+}
+
 struct cochran_config_word cochran_config_set_value(const unsigned char *config, struct cochran_config *cfg,
 	union cochran_config_value *value)
 {
@@ -189,48 +205,292 @@ void cochran_config_print(struct cochran_config *cfg, union cochran_config_value
 }
 
 
-void main(int argc, char **argv)
+int cochran_config_find_field(struct cochran_config *cfg, int count, const char *name, int partial)
 {
-	unsigned char config[512];
-
-	read(0, config, 512);
-
-	struct cochran_config_word word, orig;
-	union cochran_config_value value;
+	const char *key = (cfg == emc_cfg ? "emc:" : "cmdr:");
+	size_t key_len = strlen(key), len = strlen(name);
+	int found = -1, best = 0, ties = 0;
+	char *end;
+
+	if (!strncasecmp(name, key, key_len) && isdigit((unsigned char) name[key_len])) {
+		long n = strtol(name + key_len, &end, 10);
+		return (!*end && n < count ? n : -1);
+	}
 
-	int x = 0; 
-	while (emc_cfg[x].word != -1) {
-		word = cochran_config_get_word(config, emc_cfg[x].word);
-		cochran_config_get_value(config, &emc_cfg[x], &value);
-		printf("<%2d> %02x %02x ", x, word.data[0], word.data[1]);
-		cochran_config_print(&emc_cfg[x], &value);
-		x++;
+	strtol(name, &end, 10);
+	if (!*name || !*end)
+		return -1;
+
+	// The whole label beats one starting with name, which beats one containing it
+	for (int f = 0; f < count; f++) {
+		const char *label = cfg[f].label;
+		int score = 0;
+
+		if (!strcasecmp(label, name))
+			score = 3;
+		else if (partial && !strncasecmp(label, name, len))
+			score = 2;
+		else if (partial)
+			for (const char *p = label; *p && !score; p++)
+				if (!strncasecmp(p, name, len))
+					score = 1;
+
+		if (score > best) {
+			best = score;
+			found = f;
+			ties = 0;
+		} else if (score && score == best) {
+			ties++;
+		}
 	}
+	return (ties ? -2 : found);
+}
 
-	int i = atoi(argv[1]);
 
-	orig = word = cochran_config_get_word(config, emc_cfg[i].word);
-	cochran_config_get_value(config, &emc_cfg[i], &value);
+// A number, or a toggle's or list's label
+int cochran_config_parse_value(const struct cochran_config *cfg, const char *s, union cochran_config_value *value)
+{
+	char *end;
 
+	memset(value, 0, sizeof(*value));
 
+	if (cfg->edit.type == CONFIG_FIELD_TOGGLE) {
+		if (!strcasecmp(s, cfg->edit.toggle.on_label))
+			return 0;
+		if (!strcasecmp(s, cfg->edit.toggle.off_label)) {
+			value->integer = 1;
+			return 0;
+		}
+	} else if (cfg->edit.type == CONFIG_FIELD_LIST) {
+		for (int i = 0; i < cfg->edit.list.count; i++) {
+			if (!strcasecmp(s, cfg->edit.list.label[i])) {
+				value->integer = (int) cfg->edit.list.value[i];
+				return 0;
+			}
+		}
+	}
 
-	switch (emc_cfg[i].encoding) {
-	case CONFIG_ENC_LE_INT:
-	case CONFIG_ENC_BE_INT:
-	case CONFIG_ENC_PERCENT:
-	case CONFIG_ENC_BIT_INT:
-	case CONFIG_ENC_LE_INT_SEC:
-	case CONFIG_ENC_BE_INT_SEC:
-		value.integer = atoi(argv[2]);
-		break;
+	switch (cfg->encoding) {
 	case CONFIG_ENC_LE_DECIMAL:
 	case CONFIG_ENC_BE_DECIMAL:
-		value.rational = atof(argv[2]);
+		value->rational = strtod(s, &end);
 		break;
+	default:
+		value->integer = strtol(s, &end, 10);
+		break;
+	}
+
+	return (end == s || *end ? -1 : 0);
+}
+
+
+// Whether a value is one the computer offers for the field
+int cochran_config_check_value(const struct cochran_config *cfg, const union cochran_config_value *value)
+{
+	double v;
+
+	if (cfg->encoding == CONFIG_ENC_LE_DECIMAL || cfg->encoding == CONFIG_ENC_BE_DECIMAL)
+		v = value->rational;
+	else
+		v = value->integer;
+
+	switch (cfg->edit.type) {
+	case CONFIG_FIELD_RANGE:
+		// The limits are floats, 99.9 isn't quite
+		return (v > cfg->edit.range.low - 0.001 && v < cfg->edit.range.high + 0.001 ? 0 : -1);
+	case CONFIG_FIELD_TOGGLE:
+		return (v == 0 || v == 1 ? 0 : -1);
+	case CONFIG_FIELD_LIST:
+		for (int i = 0; i < cfg->edit.list.count; i++)
+			if (v == cfg->edit.list.value[i])
+				return 0;
+		return -1;
 	}
 
-	word = cochran_config_set_value(config, &emc_cfg[i], &value);
+	return -1;
+}
+
+
+
+// Sort fields by word, then keep the table order within a word
+static int compare_field(const void *a, const void *b)
+{
+	const struct cochran_config_field *x = a, *y = b;
+
+	if (x->offset != y->offset)
+		return x->offset - y->offset;
+	return x->index - y->index;
+}
+
+
+int cochran_config_schema_init(struct cochran_config_schema *schema, struct cochran_config *cfg)
+{
+	int count = 0;
+
+	while (cfg[count].word != -1)
+		count++;
+
+	memset(schema, 0, sizeof(*schema));
+	schema->cfg = cfg;
+	schema->count = count;
+	schema->field = calloc(count ? count : 1, sizeof(struct cochran_config_field));
+	schema->word = calloc(count ? count : 1, sizeof(struct cochran_config_word_group));
+	if (!schema->field || !schema->word) {
+		cochran_config_schema_free(schema);
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		struct cochran_config_field *f = &schema->field[i];
+
+		if (cfg[i].word * 2 + 2 > CONFIG_PAGE_SIZE) {
+			dprintf(STDERR_FILENO, "Config word 0x%04x outside the page\n", cfg[i].word);
+			cochran_config_schema_free(schema);
+			return -1;
+		}
+
+		f->index = i;
+		f->offset = cfg[i].word * 2;
+		f->encoding = cfg[i].encoding;
+		f->byte = cfg[i].byte;
+		f->shift = field_shift(&cfg[i]);
+		f->mask = field_mask(&cfg[i]);
+	}
+
+	qsort(schema->field, count, sizeof(struct cochran_config_field), compare_field);
+
+	for (int i = 0; i < count; i++) {
+		int offset = schema->field[i].offset;
+		struct cochran_config_word_group *w = 0;
+
+		// The group so far, none before the first field
+		if (schema->word_count)
+			w = &schema->word[schema->word_count - 1];
+
+		if (!w || w->offset != offset) {
+			w = &schema->word[schema->word_count++];
+			w->offset = offset;
+			w->first = i;
+			w->count = 0;
+		}
+		w->count++;
+	}
+
+	return 0;
+}
+
+
+void cochran_config_schema_free(struct cochran_config_schema *schema)
+{
+	free(schema->field);
+	free(schema->word);
+	schema->field = 0;
+	schema->word = 0;
+	schema->count = schema->word_count = 0;
+}
+
+
+int cochran_settings_alloc(struct cochran_settings *settings, const struct cochran_config_schema *schema)
+{
+	settings->schema = schema;
+	settings->value = calloc(schema->count ? schema->count : 1, sizeof(union cochran_config_value));
+
+	return (settings->value ? 0 : -1);
+}
+
+
+void cochran_settings_free(struct cochran_settings *settings)
+{
+	free(settings->value);
+	settings->value = 0;
+}
+
+
+// Every field of a config page, one word at a time
+void cochran_config_decode_page(const unsigned char *page, struct cochran_settings *settings)
+{
+	const struct cochran_config_schema *schema = settings->schema;
+
+	for (int w = 0; w < schema->word_count; w++) {
+		const struct cochran_config_word_group *word = &schema->word[w];
+		const unsigned char *data = page + word->offset;
+
+		for (int i = word->first; i < word->first + word->count; i++) {
+			const struct cochran_config_field *f = &schema->field[i];
+			decode(data, f->encoding, f->byte, f->shift, f->mask, &settings->value[f->index]);
+		}
+	}
+}
+
+
+/*
+ * The reverse. Only fields whose value differs from what the page holds
+ * are written; decimals don't survive a decode and encode unchanged, and
+ * bits no field owns are left as they were.
+ */
+void cochran_config_encode_page(const struct cochran_settings *settings, unsigned char *page)
+{
+	const struct cochran_config_schema *schema = settings->schema;
+
+	for (int w = 0; w < schema->word_count; w++) {
+		const struct cochran_config_word_group *word = &schema->word[w];
+		unsigned char *data = page + word->offset;
+
+		for (int i = word->first; i < word->first + word->count; i++) {
+			const struct cochran_config_field *f = &schema->field[i];
+			union cochran_config_value current;
+
+			decode(data, f->encoding, f->byte, f->shift, f->mask, &current);
+			if (memcmp(&current, &settings->value[f->index], sizeof(current)))
+				encode(data, f->encoding, f->byte, f->shift, f->mask, &settings->value[f->index]);
+		}
+	}
+}
+
+
+void cochran_config_txn_begin(struct cochran_config_txn *txn, const struct cochran_config_schema *schema,
+	const unsigned char *page)
+{
+	txn->schema = schema;
+	memcpy(txn->current, page, CONFIG_PAGE_SIZE);
+	memcpy(txn->target, page, CONFIG_PAGE_SIZE);
+}
+
+
+// Returns 1 when the field's word changed, 0 if it already held the value
+int cochran_config_txn_set(struct cochran_config_txn *txn, int field, union cochran_config_value *value)
+{
+	struct cochran_config *cfg;
+	struct cochran_config_word word;
+	union cochran_config_value current;
+
+	if (field < 0 || field >= txn->schema->count)
+		return -1;
+	cfg = &txn->schema->cfg[field];
+
+	// Decimals don't round trip, leave a field alone if it reads back the same
+	word = cochran_config_get_word(txn->target, cfg->word);
+	cochran_config_decode_value(&word, cfg, &current);
+	if (!memcmp(&current, value, sizeof(current)))
+		return 0;
+
+	cochran_config_encode_value(&word, cfg, value);
+	if (!memcmp(txn->target + cfg->word * 2, word.data, 2))
+		return 0;
+
+	memcpy(txn->target + cfg->word * 2, word.data, 2);
+	return 1;
+}
+
+
+// Word numbers that differ from the device's page, words holds CONFIG_PAGE_WORDS
+int cochran_config_txn_dirty(const struct cochran_config_txn *txn, unsigned short *words)
+{
+	int count = 0;
+
+	for (int w = 0; w < CONFIG_PAGE_WORDS; w++)
+		if (txn->current[w * 2] != txn->target[w * 2] || txn->current[w * 2 + 1] != txn->target[w * 2 + 1])
+			words[count++] = w;
 
-	cochran_config_print_label(&emc_cfg[i]);	
-	printf("\nFrom %02x %02x To %02x %02x\n", orig.data[0], orig.data[1], word.data[0], word.data[1]);
+	return count;
 }
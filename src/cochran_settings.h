@@ -63,3 +63,93 @@ struct cochran_config_word {
 	unsigned char data[3];
 };
 
+
+extern struct cochran_config emc_cfg[];
+extern struct cochran_config cmd_cfg[];
+
+struct cochran_config_word cochran_config_get_word(const unsigned char *config, int word_num);
+void cochran_config_decode_value(struct cochran_config_word *word, struct cochran_config *cfg,
+	union cochran_config_value *value);
+void cochran_config_get_value(const unsigned char *config, struct cochran_config *cfg,
+	union cochran_config_value *value);
+void cochran_config_encode_value(struct cochran_config_word *word, struct cochran_config *cfg,
+	union cochran_config_value *value);
+struct cochran_config_word cochran_config_set_value(const unsigned char *config, struct cochran_config *cfg,
+	union cochran_config_value *value);
+void cochran_config_print_label(struct cochran_config *cfg);
+void cochran_config_print_value(struct cochran_config *cfg, union cochran_config_value *value);
+void cochran_config_print(struct cochran_config *cfg, union cochran_config_value *value);
+
+/*
+*	Fields by name, the whole label or, with partial, a start or piece of
+*	it. The number settings prints for a field is only taken with its
+*	table, "emc:4" or "cmdr:4", a bare one means different fields in each.
+*	Returns -1 when the table has no such field, -2 when a partial label
+*	matches more than one.
+*/
+int cochran_config_find_field(struct cochran_config *cfg, int count, const char *name, int partial);
+int cochran_config_parse_value(const struct cochran_config *cfg, const char *s, union cochran_config_value *value);
+int cochran_config_check_value(const struct cochran_config *cfg, const union cochran_config_value *value);
+
+/*
+*	Schema index. A table's fields grouped by the word they live in, with
+*	the mask and shift of each worked out once, so a whole config page can
+*	be decoded (or encoded) in one pass. Values are indexed like the table.
+*/
+
+#define CONFIG_PAGE_SIZE 512
+
+struct cochran_config_field {
+	int index;					// Into the table
+	unsigned short offset;		// Byte offset of its word in the page
+	enum cochran_config_encoding encoding;
+	unsigned char byte;
+	unsigned char shift;
+	unsigned char mask;
+};
+
+struct cochran_config_word_group {
+	unsigned short offset;		// Byte offset of the word in the page
+	unsigned short first;		// First of its fields
+	unsigned short count;
+};
+
+struct cochran_config_schema {
+	struct cochran_config *cfg;
+	int count;					// Fields in the table
+	struct cochran_config_field *field;
+	struct cochran_config_word_group *word;
+	int word_count;
+};
+
+// Decoded page, value[i] belongs to schema->cfg[i]
+struct cochran_settings {
+	const struct cochran_config_schema *schema;
+	union cochran_config_value *value;
+};
+
+int cochran_config_schema_init(struct cochran_config_schema *schema, struct cochran_config *cfg);
+void cochran_config_schema_free(struct cochran_config_schema *schema);
+int cochran_settings_alloc(struct cochran_settings *settings, const struct cochran_config_schema *schema);
+void cochran_settings_free(struct cochran_settings *settings);
+void cochran_config_decode_page(const unsigned char *page, struct cochran_settings *settings);
+void cochran_config_encode_page(const struct cochran_settings *settings, unsigned char *page);
+
+/*
+*	Settings transaction. The page as the device has it and the page we
+*	want, changed one field at a time. Only words that end up different
+*	need sending, each as a 0x5a word write.
+*/
+
+#define CONFIG_PAGE_WORDS (CONFIG_PAGE_SIZE / 2)
+
+struct cochran_config_txn {
+	const struct cochran_config_schema *schema;
+	unsigned char current[CONFIG_PAGE_SIZE];
+	unsigned char target[CONFIG_PAGE_SIZE];
+};
+
+void cochran_config_txn_begin(struct cochran_config_txn *txn, const struct cochran_config_schema *schema,
+	const unsigned char *page);
+int cochran_config_txn_set(struct cochran_config_txn *txn, int field, union cochran_config_value *value);
+int cochran_config_txn_dirty(const struct cochran_config_txn *txn, unsigned short *words);
@@ -0,0 +1,647 @@
+/*
+ * cochran_transport.c
+ *
+ * Transports for the download engine: termios serial ports, PTYs and an
+ * in-process loopback device.
+ */
+
+#include <stdio.h>
+#include <termios.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/serial.h>
+
+#include "cochran_transport.h"
+
+int open_serial(const char *file) {
+	int fd;
+
+	dprintf(STDERR_FILENO, "Opening %s\n", file);
+
+	struct termios newtio;
+	fd = open(file, O_RDWR | O_NONBLOCK | O_NOCTTY);
+
+	if (fd == -1) {
+		dprintf(STDERR_FILENO, "Unable to open serial port\n");
+		return fd;
+	}
+
+	tcgetattr(fd, &newtio);
+	cfsetospeed(&newtio, B9600);
+	cfsetispeed(&newtio, B9600);
+
+	newtio.c_cflag |= CLOCAL | CREAD;
+
+	// Set N, 8, 1
+	newtio.c_cflag &= ~PARENB;
+	newtio.c_cflag &= ~CSTOPB;
+	newtio.c_cflag &= ~CSIZE;
+	newtio.c_cflag |= CS8;
+
+	// Set no flow control
+	newtio.c_cflag &= ~CRTSCTS;
+	newtio.c_iflag &= ~(IXON | IXOFF | IXANY);
+
+	newtio.c_iflag |= IGNPAR | IGNBRK;
+
+	newtio.c_oflag &= ~(ONLCR | OPOST);
+
+	newtio.c_lflag &= ~(ISIG | ICANON | ECHO);
+
+	tcsetattr(fd, TCSANOW, &newtio);
+
+	return fd;
+}
+
+int msleep(unsigned int millis) {
+	struct timespec ts;
+
+	ts.tv_sec  = (millis / 1000);
+	ts.tv_nsec = (millis % 1000) * 1000000;
+	while (nanosleep (&ts, &ts) != 0) {
+		int errcode = errno;
+		if (errcode != EINTR ) {
+			return errcode;
+		}
+	}
+
+	return 0;
+}
+
+
+
+// UARTs cope with about 2% error between the two ends
+static int baud_in_tolerance(unsigned int wanted, unsigned int actual) {
+	unsigned int diff = wanted > actual ? wanted - actual : actual - wanted;
+
+	return diff * 50 <= wanted;
+}
+
+
+#if defined(__linux__) && defined(TCGETS2)
+// struct termios2 from <asm/termbits.h>, which can't be included next to <termios.h>
+struct termios2 {
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc[19];
+	speed_t c_ispeed;
+	speed_t c_ospeed;
+};
+
+#ifndef BOTHER
+#define BOTHER 0010000
+#endif
+#ifndef IBSHIFT
+#define IBSHIFT 16
+#endif
+
+/*
+ * Set an arbitrary rate with termios2, which every current USB serial
+ * driver honours, and read back what the driver actually achieved.
+ * Returns ENOTTY when the kernel or driver doesn't know termios2.
+ */
+static int set_baud_termios2(int fd, unsigned int baud_rate) {
+	struct termios2 tio;
+
+	if (ioctl(fd, TCGETS2, &tio) != 0)
+		return errno;
+
+	tio.c_cflag &= ~CBAUD;
+	tio.c_cflag |= BOTHER;
+	tio.c_cflag &= ~(CBAUD << IBSHIFT);		// input follows output
+	tio.c_ispeed = baud_rate;
+	tio.c_ospeed = baud_rate;
+
+	if (ioctl(fd, TCSETS2, &tio) != 0)
+		return errno;
+
+	if (ioctl(fd, TCGETS2, &tio) != 0)
+		return errno;
+
+	return baud_in_tolerance(baud_rate, tio.c_ospeed) ? 0 : ERANGE;
+}
+#endif
+
+int set_baud(int fd, unsigned int baud_rate) {
+	speed_t baud;
+	int custom_baud = 0;
+	struct termios tty;
+
+	memset (&tty, 0, sizeof (tty));
+	if (tcgetattr (fd, &tty) != 0) {
+		return errno;
+	}
+
+	msleep(45);	// Give time to process received data
+
+	switch (baud_rate) {
+	case 0:		baud = B0; break;
+	case 50:	baud = B50; break;
+	case 75:	baud = B75; break;
+	case 110:	baud = B110; break;
+	case 134:	baud = B134; break;
+	case 150:	baud = B150; break;
+	case 200:	baud = B200; break;
+	case 300:	baud = B300; break;
+	case 600:	baud = B600; break;
+	case 1200:	baud = B1200; break;
+	case 1800:	baud = B1800; break;
+	case 2400:	baud = B2400; break;
+	case 4800:	baud = B4800; break;
+	case 9600:	baud = B9600; break;
+	case 19200: baud = B19200; break;
+	case 38400: baud = B38400; break;
+#ifdef B57600
+	case 57600: baud = B57600; break;
+#endif
+#ifdef B115200
+	case 115200: baud = B115200; break;
+#endif
+#ifdef B230400
+	case 230400: baud = B230400; break;
+#endif
+#ifdef B460800
+	case 460800: baud = B460800; break;
+#endif
+#ifdef B500000
+	case 500000: baud = B500000; break;
+#endif
+#ifdef B576000
+	case 576000: baud = B576000; break;
+#endif
+#ifdef B921600
+	case 921600: baud = B921600; break;
+#endif
+#ifdef B1000000
+	case 1000000: baud = B1000000; break;
+#endif
+#ifdef B1152000
+	case 1152000: baud = B1152000; break;
+#endif
+#ifdef B1500000
+	case 1500000: baud = B1500000; break;
+#endif
+#ifdef B2000000
+	case 2000000: baud = B2000000; break;
+#endif
+#ifdef B2500000
+	case 2500000: baud = B2500000; break;
+#endif
+#ifdef B3000000
+	case 3000000: baud = B3000000; break;
+#endif
+#ifdef B3500000
+	case 3500000: baud = B3500000; break;
+#endif
+#ifdef B4000000
+	case 4000000: baud = B4000000; break;
+#endif
+	default:
+	    baud = B38400; /* Required for custom baudrates on linux. */
+	    custom_baud = 1;
+	    break;
+	}
+
+	// Set baud
+	if (cfsetispeed (&tty, baud) != 0 ||
+		cfsetospeed (&tty, baud) != 0) {
+		return errno;
+	}
+
+	// Apply the new settings.
+	if (tcsetattr (fd, TCSANOW, &tty) != 0) {
+#if 0 // who cares
+		return errno;
+#endif
+	}
+
+	// set custom baud
+	if (custom_baud) {
+#if defined(__linux__) && defined(TCGETS2)
+		int rc = set_baud_termios2(fd, baud_rate);
+		if (rc != ENOTTY && rc != EINVAL)
+			return rc;
+		// Old kernel or driver, try the custom divisor
+#endif
+#if defined(TIOCGSERIAL) && defined(TIOCSSERIAL) && !defined(__ANDROID__)
+		// Get the current settings.
+		struct serial_struct ss;
+		if (ioctl (fd, TIOCGSERIAL, &ss) != 0) {
+			return errno;
+		}
+
+		// Set the custom divisor.
+		ss.custom_divisor = ss.baud_base / baud_rate;
+		ss.flags &= ~ASYNC_SPD_MASK;
+		ss.flags |= ASYNC_SPD_CUST;
+
+		// Apply the new settings.
+		if (ioctl (fd, TIOCSSERIAL, &ss) != 0) {
+			return errno;
+		}
+
+		// The divisor is an integer, make sure it lands close enough
+		if (ss.custom_divisor == 0 || !baud_in_tolerance(baud_rate, ss.baud_base / ss.custom_divisor)) {
+			return ERANGE;
+		}
+#elif defined(IOSSIOSPEED)
+		speed_t speed = baudrate;
+		if (ioctl (fd, IOSSIOSPEED, &speed) != 0) {
+			return errno;
+		}
+#else
+		// Custom baudrates are not supported.
+		return -1;
+#endif
+	}
+    
+	return 0;
+}
+
+
+/*
+ * termios serial port
+ */
+
+static int serial_read(transport_t *t, unsigned char *buf, unsigned int size, unsigned int timeout) {
+	struct pollfd pfd = { .fd = t->fd, .events = POLLIN };
+
+	int rc = poll(&pfd, 1, timeout);
+	if (rc <= 0)
+		return rc;
+
+	rc = read(t->fd, buf, size);
+	if (rc < 0 && errno == EAGAIN)
+		return 0;
+	return rc;
+}
+
+static int serial_write(transport_t *t, const unsigned char *buf, unsigned int size) {
+	return write(t->fd, buf, size);
+}
+
+static int serial_set_baud(transport_t *t, unsigned int baud) {
+	return set_baud(t->fd, baud);
+}
+
+static int serial_break(transport_t *t, unsigned int millis) {
+	ioctl(t->fd, TIOCSBRK, NULL);
+	msleep(millis);
+	ioctl(t->fd, TIOCCBRK, NULL);
+	return 0;
+}
+
+static int serial_flush(transport_t *t) {
+	return tcflush(t->fd, TCIOFLUSH);
+}
+
+static void serial_sleep(transport_t *t, unsigned int millis) {
+	(void) t;
+	msleep(millis);
+}
+
+static void serial_close(transport_t *t) {
+	close(t->fd);
+}
+
+static const transport_ops_t serial_ops = {
+	"serial", serial_read, serial_write, serial_set_baud, serial_break, serial_flush, serial_sleep, serial_close
+};
+
+
+/*
+ * PTY, the far end is a program so there's no line to break and the
+ * rate is whatever we say it is.
+ */
+
+static int pty_set_baud(transport_t *t, unsigned int baud) {
+	(void) t;
+	(void) baud;
+	return 0;
+}
+
+static int pty_break(transport_t *t, unsigned int millis) {
+	(void) t;
+	(void) millis;
+	return 0;
+}
+
+static const transport_ops_t pty_ops = {
+	"pty", serial_read, serial_write, pty_set_baud, pty_break, serial_flush, serial_sleep, serial_close
+};
+
+// Unix98 PTY slaves
+static int is_pty(int fd) {
+	struct stat st;
+
+	if (fstat(fd, &st) || !S_ISCHR(st.st_mode))
+		return 0;
+	return major(st.st_rdev) >= 136 && major(st.st_rdev) <= 143;
+}
+
+
+/*
+ * Loopback, a Cochran in memory. It answers the wake up with a heartbeat
+ * and then one command with data from the image, the same files dock
+ * and simcochran use. Nothing sleeps so a full download runs at memory
+ * speed. Config word writes change the pages in memory, not the files.
+ */
+
+typedef struct loop_t {
+	unsigned char *id, *config[2], *memory;
+	unsigned int id_size, config_size[2], memory_size;
+	unsigned int base;			// Address of memory[0]
+	int emc;					// 32 bit high-speed command
+	int tm;						// 1 byte config command
+
+	int waking;					// Break seen, waiting for the 0x00
+	int awake;					// Taking a command
+	unsigned char cmd[10];
+	unsigned int cmd_len;
+
+	// What we're sending back
+	int heartbeat;
+	const unsigned char *reply;
+	unsigned int reply_len;
+	unsigned int pad;			// 0xFF past the end of the image
+
+	// Config words written but not yet committed
+	unsigned short pending_word[256];
+	unsigned char pending_data[256][2];
+	unsigned int pending;
+} loop_t;
+
+static unsigned char *load_file(const char *dir, const char *name, unsigned int *size) {
+	char path[256];
+	struct stat st;
+	unsigned char *buf = NULL;
+
+	*size = 0;
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (!fstat(fd, &st) && st.st_size > 0 && (buf = malloc(st.st_size))) {
+		if (read(fd, buf, st.st_size) == st.st_size) {
+			*size = st.st_size;
+		} else {
+			free(buf);
+			buf = NULL;
+		}
+	}
+	close(fd);
+	return buf;
+}
+
+static void loop_reply(loop_t *l, const unsigned char *data, unsigned int data_size, unsigned int offset, unsigned int size) {
+	if (!data || offset >= data_size) {
+		l->reply = NULL;
+		l->reply_len = 0;
+	} else {
+		l->reply = data + offset;
+		l->reply_len = (data_size - offset < size ? data_size - offset : size);
+	}
+	l->pad = size - l->reply_len;
+}
+
+#define array_uint24_le(p) ( (unsigned int) (p)[0] + ((p)[1] << 8) + ((p)[2] << 16) )
+#define array_uint32_le(p) ( (unsigned int) (p)[0] + ((p)[1] << 8) \
+									+ ((p)[2] << 16) + ((unsigned int) (p)[3] << 24) )
+#define array_uint16_le(p) ( (unsigned int) (p)[0] + ((p)[1] << 8) )
+
+// Length of the command starting with byte c
+static unsigned int loop_cmd_size(loop_t *l, unsigned char c) {
+	switch (c) {
+	case 0x05:	return 6;
+	case 0x96:	return l->tm ? 1 : 2;
+	case 0x15:	return l->emc ? 10 : 8;
+	case 0x5a:	return 5;
+	default:	return 1;
+	}
+}
+
+static void loop_command(loop_t *l) {
+	static const unsigned char ack = 0xaa;
+	unsigned char *cmd = l->cmd;
+	unsigned int address, size;
+
+	switch (cmd[0]) {
+	case 0x05:		// Low-baud read, the ID block lives at a family specific address
+		address = array_uint24_le(cmd + 1);
+		size = array_uint16_le(cmd + 4);
+		if (address == (l->emc ? 0xff9d : 0x7fbd) && size == 0x43)
+			loop_reply(l, l->id, l->id_size, 0, size);
+		else if (address == 0xff9d || address == 0x7fbd)
+			loop_reply(l, NULL, 0, 0, size);	// The other family's ID, junk
+		else
+			loop_reply(l, l->memory, l->memory_size, address - l->base, size);
+		break;
+	case 0x96:		// Config page
+		loop_reply(l, l->config[l->tm ? 0 : cmd[1] & 1], l->config_size[l->tm ? 0 : cmd[1] & 1], 0, 512);
+		break;
+	case 0x15:		// High-speed read
+		if (l->emc) {
+			address = array_uint32_le(cmd + 1);
+			size = array_uint32_le(cmd + 5);
+		} else {
+			address = array_uint24_le(cmd + 1);
+			size = array_uint24_le(cmd + 4);
+		}
+		loop_reply(l, l->memory, l->memory_size, address - l->base, size);
+		break;
+	case 0x5a:		// Config word write, held until committed
+		if (l->pending < sizeof(l->pending_word) / sizeof(l->pending_word[0])) {
+			l->pending_word[l->pending] = array_uint16_le(cmd + 1);
+			memcpy(l->pending_data[l->pending++], cmd + 3, 2);
+		}
+		loop_reply(l, &ack, 1, 0, 1);
+		l->awake = 1;		// More writes or the commit follow without a wake
+		l->cmd_len = 0;
+		break;
+	case 0xc3:		// Commit config writes
+		for (unsigned int i = 0; i < l->pending; i++) {
+			unsigned int page = l->pending_word[i] / 256, offset = l->pending_word[i] % 256 * 2;
+			if (page < 2 && l->config[page] && offset + 2 <= l->config_size[page])
+				memcpy(l->config[page] + offset, l->pending_data[i], 2);
+		}
+		l->pending = 0;
+		loop_reply(l, &ack, 1, 0, 1);
+		break;
+	default:		// 0x89 and friends, nothing comes back
+		break;
+	}
+}
+
+static int loop_read(transport_t *t, unsigned char *buf, unsigned int size, unsigned int timeout) {
+	loop_t *l = (loop_t *) t->priv;
+	unsigned int n = 0;
+
+	(void) timeout;
+
+	if (l->heartbeat && n < size) {
+		buf[n++] = 0xaa;
+		l->heartbeat = 0;
+	}
+
+	unsigned int len = (l->reply_len < size - n ? l->reply_len : size - n);
+	if (len) {
+		memcpy(buf + n, l->reply, len);
+		l->reply += len;
+		l->reply_len -= len;
+		n += len;
+	}
+
+	len = (l->pad < size - n ? l->pad : size - n);
+	if (len) {
+		memset(buf + n, 0xff, len);
+		l->pad -= len;
+		n += len;
+	}
+
+	return n;
+}
+
+static int loop_write(transport_t *t, const unsigned char *buf, unsigned int size) {
+	loop_t *l = (loop_t *) t->priv;
+
+	for (unsigned int i = 0; i < size; i++) {
+		if (l->waking) {
+			// Woken by the 0x00 after a break
+			l->waking = 0;
+			if (buf[i] == 0x00) {
+				l->heartbeat = 1;
+				l->awake = 1;
+				l->cmd_len = 0;
+			}
+		} else if (l->awake) {
+			l->cmd[l->cmd_len++] = buf[i];
+			if (l->cmd_len == loop_cmd_size(l, l->cmd[0])) {
+				l->awake = 0;
+				loop_command(l);
+			}
+		}
+	}
+	return size;
+}
+
+static int loop_set_baud(transport_t *t, unsigned int baud) {
+	(void) t;
+	(void) baud;
+	return 0;
+}
+
+static int loop_break(transport_t *t, unsigned int millis) {
+	loop_t *l = (loop_t *) t->priv;
+
+	(void) millis;
+	l->waking = 1;
+	l->awake = 0;
+	l->pending = 0;			// Uncommitted writes are lost
+	return 0;
+}
+
+static int loop_flush(transport_t *t) {
+	loop_t *l = (loop_t *) t->priv;
+
+	l->heartbeat = 0;
+	l->reply_len = 0;
+	l->pad = 0;
+	return 0;
+}
+
+static void loop_sleep(transport_t *t, unsigned int millis) {
+	(void) t;
+	(void) millis;
+}
+
+static void loop_free(loop_t *l) {
+	free(l->id);
+	free(l->config[0]);
+	free(l->config[1]);
+	free(l->memory);
+	free(l);
+}
+
+static void loop_close(transport_t *t) {
+	loop_free((loop_t *) t->priv);
+}
+
+static const transport_ops_t loop_ops = {
+	"loop", loop_read, loop_write, loop_set_baud, loop_break, loop_flush, loop_sleep, loop_close
+};
+
+static loop_t *loop_open(const char *dir) {
+	loop_t *l = calloc(1, sizeof(loop_t));
+	if (!l)
+		return NULL;
+
+	l->id = load_file(dir, "id0", &l->id_size);
+	l->config[0] = load_file(dir, "config0", &l->config_size[0]);
+	l->config[1] = load_file(dir, "config1", &l->config_size[1]);
+	l->memory = load_file(dir, "memory", &l->memory_size);
+
+	if (!l->id || l->id_size < 0x43) {
+		dprintf(STDERR_FILENO, "No ID block in %s\n", dir);
+		loop_free(l);
+		return NULL;
+	}
+
+	// The model code picks the command set, a TM image starts at its logbook
+	l->emc = (l->id[0x3e] == '3');
+	l->tm = !memcmp(l->id + 0x3e, "120", 3);
+	l->base = (l->tm ? 0x10000 : 0);
+
+	return l;
+}
+
+
+/*
+ * Open a serial port, PTY or loop:<dir>
+ */
+transport_t *transport_open(const char *name) {
+	transport_t *t = calloc(1, sizeof(transport_t));
+	if (!t)
+		return NULL;
+
+	t->fd = -1;
+
+	if (!strncmp(name, TRANSPORT_LOOP, strlen(TRANSPORT_LOOP))) {
+		t->ops = &loop_ops;
+		t->priv = loop_open(name + strlen(TRANSPORT_LOOP));
+		if (!t->priv) {
+			free(t);
+			return NULL;
+		}
+		return t;
+	}
+
+	t->fd = open_serial(name);
+	if (t->fd < 0) {
+		free(t);
+		return NULL;
+	}
+	t->ops = (is_pty(t->fd) ? &pty_ops : &serial_ops);
+
+	return t;
+}
+
+
+void transport_close(transport_t *t) {
+	if (!t)
+		return;
+	t->ops->close(t);
+	free(t);
+}
@@ -0,0 +1,38 @@
+/*
+ * cochran_transport.h
+ *
+ * The byte pipe under the download engine. A transport is a termios
+ * serial port, a PTY (e.g. simcochran) or an in-process loopback that
+ * plays a Cochran from a memory image, so the engine can be run at
+ * memory speed without hardware.
+ */
+
+typedef struct transport_t transport_t;
+
+typedef struct transport_ops_t {
+	const char *name;
+	// Bytes read, 0 if nothing arrived within timeout ms, -1 on error
+	int (*read)(transport_t *t, unsigned char *buf, unsigned int size, unsigned int timeout);
+	int (*write)(transport_t *t, const unsigned char *buf, unsigned int size);
+	int (*set_baud)(transport_t *t, unsigned int baud);
+	int (*send_break)(transport_t *t, unsigned int millis);
+	int (*flush)(transport_t *t);
+	void (*sleep)(transport_t *t, unsigned int millis);
+	void (*close)(transport_t *t);
+} transport_ops_t;
+
+struct transport_t {
+	const transport_ops_t *ops;
+	int fd;
+	void *priv;
+};
+
+// Prefix for a loopback transport, loop:<dir> plays id0, config0/1 and memory from dir
+#define TRANSPORT_LOOP "loop:"
+
+transport_t *transport_open(const char *name);
+void transport_close(transport_t *t);
+
+int open_serial(const char *file);
+int msleep(unsigned int millis);
+int set_baud(int fd, unsigned int baud_rate);
@@ -0,0 +1,403 @@
+/*
+ * cochran_usbmon.c
+ *
+ * usbmon text capture and binary transcript reader.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cochran_usbmon.h"
+
+// FTDI bulk in packets start with two modem status bytes
+#define FTDI_PACKET 64
+#define FTDI_STATUS 2
+
+#define MAX_FIELDS 8
+
+// Device bytes that are only heartbeats after this long idle are not part of a reply
+#define HEARTBEAT_GAP 500000
+
+static const signed char hex_value[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+
+// Hex words up to the end of line, returns bytes decoded
+static unsigned int unhex(const char *p, const char *eol, unsigned char *out) {
+	unsigned int len = 0;
+	int nibble = -1;
+
+	for (; p < eol; p++) {
+		int v = hex_value[(unsigned char) *p] - 1;
+
+		if (v < 0) {
+			if (*p == ' ')
+				continue;
+			break;
+		}
+		if (nibble < 0) {
+			nibble = v;
+		} else {
+			out[len++] = (nibble << 4) | v;
+			nibble = -1;
+		}
+	}
+
+	return len;
+}
+
+
+static unsigned int hex_field(const char *p, int len) {
+	unsigned int v = 0;
+
+	for (int i = 0; i < len && hex_value[(unsigned char) p[i]]; i++)
+		v = (v << 4) | (hex_value[(unsigned char) p[i]] - 1);
+
+	return v;
+}
+
+
+// Split a line on spaces, returns the number of fields
+static int split(const char *p, const char *eol, const char **field, int *len) {
+	int n = 0;
+
+	while (n < MAX_FIELDS) {
+		while (p < eol && *p == ' ')
+			p++;
+		if (p == eol)
+			break;
+		field[n] = p;
+		while (p < eol && *p != ' ')
+			p++;
+		len[n] = p - field[n];
+		n++;
+	}
+
+	return n;
+}
+
+
+// Microseconds from seconds.fraction or plain microseconds
+static unsigned long long timestamp(const char *p, int len) {
+	unsigned long long whole = 0, frac = 0, scale = 1000000;
+	int i = 0;
+
+	for (; i < len && p[i] >= '0' && p[i] <= '9'; i++)
+		whole = whole * 10 + p[i] - '0';
+	if (i == len || p[i] != '.')
+		return whole;
+
+	for (i++; i < len && p[i] >= '0' && p[i] <= '9'; i++) {
+		if (scale > 1) {
+			scale /= 10;
+			frac += (p[i] - '0') * scale;
+		}
+	}
+
+	return whole * 1000000 + frac;
+}
+
+
+static int parse_transcript(const char *buf, size_t size, usbmon_callback_t callback, void *userdata) {
+	size_t pos = sizeof(USBMON_MAGIC) - 1;
+
+	while (pos + sizeof(usbmon_header_t) <= size) {
+		usbmon_header_t h;
+		memcpy(&h, buf + pos, sizeof(h));
+		pos += sizeof(h);
+
+		if (pos + h.size > size) {
+			dprintf(STDERR_FILENO, "Transcript truncated\n");
+			return -1;
+		}
+
+		usbmon_record_t rec = { h.usec, h.dir, h.request, h.value, h.size, (const unsigned char *) buf + pos };
+		int rc = callback(&rec, userdata);
+		if (rc)
+			return rc;
+
+		pos += h.size;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Walk a capture already in memory, calling back once per bulk payload
+ * or FTDI vendor request. A transcript is recognised by its magic.
+ */
+int usbmon_parse(const char *buf, size_t size, int bus, int dev, usbmon_callback_t callback, void *userdata) {
+	if (size >= sizeof(USBMON_MAGIC) - 1 && !memcmp(buf, USBMON_MAGIC, sizeof(USBMON_MAGIC) - 1))
+		return parse_transcript(buf, size, callback, userdata);
+
+	const char *p = buf, *end = buf + size;
+	unsigned char *data = 0;
+	size_t data_alloc = 0;
+	unsigned long long start = 0;
+	int started = 0, rc = 0;
+
+	// Set when a header's data is on the next line
+	int want = -1;
+	unsigned long long want_usec = 0;
+
+	while (p < end && !rc) {
+		const char *eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+
+		const char *line = p;
+		p = eol + 1;
+
+		const char *data_start = 0;
+		int dir = -1;
+		unsigned long long usec = 0;
+
+		if (want >= 0 && line < eol && *line == ' ') {
+			dir = want;
+			usec = want_usec;
+			data_start = line;
+			want = -1;
+		} else {
+			want = -1;
+			const char *f[MAX_FIELDS];
+			int len[MAX_FIELDS];
+			int n = split(line, eol, f, len);
+
+			// tag time type xfer:bus:dev:ep ...
+			if (n < 5 || len[2] != 1 || len[3] < 4 || f[3][2] != ':')
+				continue;
+
+			const char *addr = f[3] + 3, *addr_end = f[3] + len[3];
+			int b = strtol(addr, 0, 10);
+			while (addr < addr_end && *addr != ':') addr++;
+			int d = (addr < addr_end ? strtol(addr + 1, 0, 10) : -1);
+			if ((bus >= 0 && b != bus) || (dev >= 0 && d != dev))
+				continue;
+
+			usec = timestamp(f[1], len[1]);
+			char type = f[2][0], xfer = f[3][0], io = f[3][1];
+
+			if (type == 'S' && xfer == 'C' && io == 'o' && len[4] == 1 && f[4][0] == 's' && n >= 8) {
+				// Vendor request out: s bmRequestType bRequest wValue wIndex wLength
+				if (hex_field(f[5], len[5]) != 0x40)
+					continue;
+
+				if (!started) {
+					start = usec;
+					started = 1;
+				}
+				usbmon_record_t rec = { usec - start, USBMON_CONTROL, hex_field(f[6], len[6]), hex_field(f[7], len[7]), 0, 0 };
+				rc = callback(&rec, userdata);
+				continue;
+			}
+
+			if (xfer != 'B' || n < 7 || len[6] != 1 || f[6][0] != '=')
+				continue;
+			if (type == 'S' && io == 'o')
+				dir = USBMON_OUT;
+			else if (type == 'C' && io == 'i')
+				dir = USBMON_IN;
+			else
+				continue;
+
+			data_start = f[6] + 1;
+			while (data_start < eol && *data_start == ' ')
+				data_start++;
+			if (data_start == eol) {
+				// Text captures put the data on its own line
+				want = dir;
+				want_usec = usec;
+				continue;
+			}
+		}
+
+		if ((size_t) (eol - data_start) / 2 + 1 > data_alloc) {
+			data_alloc = (eol - data_start) / 2 + 256;
+			free(data);
+			if (!(data = malloc(data_alloc))) {
+				dprintf(STDERR_FILENO, "Out of memory parsing capture\n");
+				return -1;
+			}
+		}
+
+		unsigned int len = unhex(data_start, eol, data);
+
+		if (dir == USBMON_IN) {
+			unsigned int out = 0;
+			for (unsigned int i = 0; i < len; i++)
+				if (i % FTDI_PACKET >= FTDI_STATUS)
+					data[out++] = data[i];
+			len = out;
+		}
+		if (!len)
+			continue;
+
+		if (!started) {
+			start = usec;
+			started = 1;
+		}
+		usbmon_record_t rec = { usec - start, dir, 0, 0, len, data };
+		rc = callback(&rec, userdata);
+	}
+
+	free(data);
+	return rc;
+}
+
+
+int usbmon_parse_file(const char *file, int bus, int dev, usbmon_callback_t callback, void *userdata) {
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		dprintf(STDERR_FILENO, "%s: Unable to open %s\n", strerror(errno), file);
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	char *buf = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		dprintf(STDERR_FILENO, "%s: Unable to map %s\n", strerror(errno), file);
+		return -1;
+	}
+	madvise(buf, st.st_size, MADV_SEQUENTIAL);
+
+	int rc = usbmon_parse(buf, st.st_size, bus, dev, callback, userdata);
+
+	munmap(buf, st.st_size);
+	return rc;
+}
+
+
+int usbmon_write_record(FILE *fp, const usbmon_record_t *rec) {
+	usbmon_header_t h = { rec->usec, rec->dir, rec->request, rec->value, rec->size };
+
+	if (fwrite(&h, sizeof(h), 1, fp) != 1)
+		return -1;
+	if (rec->size && fwrite(rec->data, rec->size, 1, fp) != 1)
+		return -1;
+
+	return 0;
+}
+
+
+// Grow a buffer to hold at least need items
+static int grow(void **buf, int *alloc, int need, size_t item) {
+	if (need <= *alloc)
+		return 0;
+
+	int size = (*alloc ? *alloc : 64);
+	while (size < need)
+		size *= 2;
+
+	void *p = realloc(*buf, size * item);
+	if (!p)
+		return -1;
+	*buf = p;
+	*alloc = size;
+	return 0;
+}
+
+
+static int append(unsigned char **buf, int *len, int *alloc, const unsigned char *data, int size) {
+	if (grow((void **) buf, alloc, *len + size, 1))
+		return -1;
+	memcpy(*buf + *len, data, size);
+	*len += size;
+	return 0;
+}
+
+
+typedef struct load_t {
+	usbmon_exchanges_t *list;
+	const char *file;
+	int current;				// Exchange being filled, -1 before the first request
+	unsigned int sent, last_in;
+} load_t;
+
+
+// Bulk out is the host talking, bulk in the device
+static int load_record(const usbmon_record_t *rec, void *userdata) {
+	load_t *l = (load_t *) userdata;
+	usbmon_exchanges_t *list = l->list;
+	usbmon_exchange_t *ex = (l->current >= 0 ? &list->ex[l->current] : 0);
+
+	if (rec->dir == USBMON_OUT) {
+		if (!ex || ex->reply_len) {
+			if (grow((void **) &list->ex, &list->alloc, list->count + 1, sizeof(usbmon_exchange_t)))
+				return -1;
+			l->current = list->count++;
+			ex = &list->ex[l->current];
+			memset(ex, 0, sizeof(*ex));
+			ex->seq = l->current;
+			ex->source = l->file;
+			ex->usec = rec->usec;
+		}
+		if (append(&ex->request, &ex->request_len, &ex->request_alloc, rec->data, rec->size))
+			return -1;
+		l->sent = rec->usec;
+		return 0;
+	}
+
+	if (rec->dir != USBMON_IN || !ex)
+		return 0;		// Baud and break, or heartbeats before the first request
+
+	int beat = 1;
+	for (unsigned int i = 0; i < rec->size; i++)
+		if (rec->data[i] != 0xAA)
+			beat = 0;
+	if (beat && rec->usec - (ex->reply_len ? l->last_in : l->sent) > HEARTBEAT_GAP)
+		return 0;
+
+	if (grow((void **) &ex->chunks, &ex->chunk_alloc, ex->chunk_count + 1, sizeof(usbmon_chunk_t)))
+		return -1;
+	ex->chunks[ex->chunk_count].offset = ex->reply_len;
+	ex->chunks[ex->chunk_count].usec = rec->usec - l->sent;
+	ex->chunk_count++;
+
+	if (append(&ex->reply, &ex->reply_len, &ex->reply_alloc, rec->data, rec->size))
+		return -1;
+	l->last_in = rec->usec;
+	return 0;
+}
+
+
+int usbmon_load_exchanges(const char *file, usbmon_exchanges_t *list) {
+	load_t l = { list, file, -1, 0, 0 };
+
+	int rc = usbmon_parse_file(file, -1, -1, load_record, &l);
+	if (rc)
+		dprintf(STDERR_FILENO, "Unable to load %s\n", file);
+
+	return rc;
+}
+
+
+void usbmon_free_exchanges(usbmon_exchanges_t *list) {
+	for (int i = 0; i < list->count; i++) {
+		free(list->ex[i].request);
+		free(list->ex[i].reply);
+		free(list->ex[i].chunks);
+	}
+	free(list->ex);
+	memset(list, 0, sizeof(*list));
+}
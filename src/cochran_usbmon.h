@@ -0,0 +1,71 @@
+/*
+ * cochran_usbmon.h
+ *
+ * Reads usbmon captures of a Cochran on its FTDI cable. Text captures
+ * are parsed in one pass over a mapping of the file; the payloads come
+ * out tagged by direction with the FTDI status bytes removed. The same
+ * records can be written to, and read back from, a binary transcript.
+ */
+
+#define USBMON_OUT		0		// Host to device, bulk out
+#define USBMON_IN		1		// Device to host, bulk in less FTDI status
+#define USBMON_CONTROL	2		// FTDI vendor request, e.g. baud or break
+
+typedef struct usbmon_record_t {
+	unsigned int usec;			// Since the first record
+	unsigned char dir;
+	unsigned char request;		// USBMON_CONTROL only
+	unsigned short value;		// USBMON_CONTROL only
+	unsigned int size;
+	const unsigned char *data;
+} usbmon_record_t;
+
+// Return non-zero to stop the parse, usbmon_parse then returns that
+typedef int (*usbmon_callback_t)(const usbmon_record_t *rec, void *userdata);
+
+// Transcript files start with this, then a header and data per record
+#define USBMON_MAGIC "CUSBMON1"
+
+typedef struct usbmon_header_t {
+	unsigned int usec;
+	unsigned char dir;
+	unsigned char request;
+	unsigned short value;
+	unsigned int size;
+} usbmon_header_t;
+
+/*
+ * A request from the host and what the device sent back before the next
+ * one, with the USB transfers the reply arrived in. Idle heartbeats are
+ * left out of replies.
+ */
+typedef struct usbmon_chunk_t {
+	int offset;					// Where in the reply this transfer starts
+	unsigned int usec;			// After the request was sent
+} usbmon_chunk_t;
+
+typedef struct usbmon_exchange_t {
+	int seq;					// Position in the list
+	const char *source;			// File it was loaded from
+	unsigned int usec;
+	unsigned char *request;
+	int request_len, request_alloc;
+	unsigned char *reply;
+	int reply_len, reply_alloc;
+	usbmon_chunk_t *chunks;
+	int chunk_count, chunk_alloc;
+} usbmon_exchange_t;
+
+typedef struct usbmon_exchanges_t {
+	usbmon_exchange_t *ex;
+	int count, alloc;
+} usbmon_exchanges_t;
+
+// bus and dev select one device, -1 for any
+int usbmon_parse(const char *buf, size_t size, int bus, int dev, usbmon_callback_t callback, void *userdata);
+int usbmon_parse_file(const char *file, int bus, int dev, usbmon_callback_t callback, void *userdata);
+int usbmon_write_record(FILE *fp, const usbmon_record_t *rec);
+
+// Appends the exchanges in a capture or transcript to list
+int usbmon_load_exchanges(const char *file, usbmon_exchanges_t *list);
+void usbmon_free_exchanges(usbmon_exchanges_t *list);
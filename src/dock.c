@@ -0,0 +1,314 @@
+/*
+ * dock.c
+ *
+ * Download several Cochran dive computers at once, one thread per serial
+ * port. Each computer is identified from its ID block and a snapshot is
+ * written to <dir>/K<serial>/ in the same layout as the data/ directory.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "cochran_transport.h"
+#include "cochran_device.h"
+#include "cochran_serial.h"
+#include "cochran_log.h"
+#include "cochran_memory.h"
+
+typedef enum dock_state_t {
+	DOCK_IDENTIFY,
+	DOCK_CONFIG,
+	DOCK_MEMORY,
+	DOCK_VERIFY,
+	DOCK_DONE,
+	DOCK_FAILED,
+} dock_state_t;
+
+static const char *dock_state_names[] = { "id", "config", "memory", "verify", "done", "failed" };
+
+typedef struct dock_t {
+	pthread_t thread;
+	int started;				// thread is running and has to be joined
+	pthread_mutex_t lock;
+	session_t session;
+	session_stats_t stats;
+	const char *port;
+	const char *outdir;
+	int verify;
+	verify_result_t verified;
+	device_t *device;
+	unsigned int serial;
+
+	// Progress, guarded by lock
+	dock_state_t state;
+	const unsigned char *buf;	// buffer of the current read
+	unsigned int done;
+	unsigned int total;
+	char error[80];
+} dock_t;
+
+
+static void dock_progress(const unsigned char *end, void *userdata) {
+	dock_t *dock = (dock_t *) userdata;
+
+	pthread_mutex_lock(&dock->lock);
+	dock->done = end - dock->buf;
+	pthread_mutex_unlock(&dock->lock);
+}
+
+
+static void dock_state(dock_t *dock, dock_state_t state, const unsigned char *buf, unsigned int total) {
+	pthread_mutex_lock(&dock->lock);
+	dock->state = state;
+	dock->buf = buf;
+	dock->done = 0;
+	dock->total = total;
+	pthread_mutex_unlock(&dock->lock);
+}
+
+
+static void *dock_fail(dock_t *dock, const char *error) {
+	pthread_mutex_lock(&dock->lock);
+	dock->state = DOCK_FAILED;
+	snprintf(dock->error, sizeof(dock->error), "%s", error);
+	pthread_mutex_unlock(&dock->lock);
+	return NULL;
+}
+
+
+// Fail once the port's open, the transport goes with it
+static void *dock_abort(dock_t *dock, const char *error) {
+	transport_close(dock->session.transport);
+	dock->session.transport = NULL;
+	return dock_fail(dock, error);
+}
+
+
+static int write_file(const char *dir, const char *name, const unsigned char *buf, unsigned int size) {
+	char path[256];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0)
+		return errno;
+
+	int rc = (write(fd, buf, size) == (int) size ? 0 : EIO);
+	close(fd);
+	return rc;
+}
+
+
+static void *dock_worker(void *userdata) {
+	dock_t *dock = (dock_t *) userdata;
+	session_t *session = &dock->session;
+	unsigned char id[0x43] = { 0 }, config0[512], config1[512];
+	unsigned char *memory;
+	char dir[256];
+
+	dock_state(dock, DOCK_IDENTIFY, id, sizeof(id));
+
+	session->port = dock->port;
+	session->quiet = 1;
+	session->stats = &dock->stats;
+	session->progress = dock_progress;
+	session->progress_data = dock;
+	session->transport = transport_open(dock->port);
+	if (!session->transport)
+		return dock_fail(dock, errno ? strerror(errno) : "unable to open");
+
+	if (session->transport->ops->set_baud(session->transport, 9600))
+		return dock_abort(dock, "unable to set baud");
+
+	dock->device = identify_device(session, id, sizeof(id));
+	if (!dock->device)
+		return dock_abort(dock, "no Cochran found");
+
+	session->device = dock->device;
+	session->timeout = 10000;
+	negotiate_baud(session);
+
+	dock_state(dock, DOCK_CONFIG, config0, sizeof(config0));
+	if (read_config0(session, config0, sizeof(config0)))
+		return dock_abort(dock, "config0 read failed");
+
+	if (dock->device->family != FAMILY_COMMANDER_TM) {
+		dock_state(dock, DOCK_CONFIG, config1, sizeof(config1));
+		if (read_config1(session, config1, sizeof(config1)))
+			return dock_abort(dock, "config1 read failed");
+	}
+
+	dock->serial = device_serial_number(dock->device, config0);
+
+	memory = malloc(dock->device->log_size);
+	if (!memory)
+		return dock_abort(dock, "out of memory");
+
+	dock_state(dock, DOCK_MEMORY, memory, dock->device->log_size);
+
+	int rc;
+	if (session->highbaud == UNSUPPORTED)
+		rc = read_low_baud(session, dock->device->log_address, dock->device->log_size, memory, dock->device->log_size);
+	else
+		rc = read_high_baud(session, dock->device->log_address, dock->device->log_size, memory, dock->device->log_size);
+
+	if (!rc && dock->verify) {
+		unsigned int recent[3][2];
+		unsigned int recent_count = 0;
+		cochran_memory_t mem;
+
+		// Suspect chunks from the telemetry, plus the logbook and newest dive's profile
+		if (!cochran_memory_init(&mem, id, memory, dock->device->log_size))
+			recent_count = cochran_memory_recent(&mem, recent);
+
+		dock_state(dock, DOCK_VERIFY, NULL, 0);
+		session->progress = NULL;
+		rc = verify_read(session, dock->device->log_address, memory, dock->device->log_size, recent, recent_count, &dock->verified);
+	}
+
+	transport_close(session->transport);
+
+	if (rc) {
+		free(memory);
+		return dock_fail(dock, rc == EIO ? "memory failed verify" : "memory read failed");
+	}
+
+	// Store the snapshot
+	snprintf(dir, sizeof(dir), "%s/K%06u", dock->outdir, dock->serial);
+	mkdir(dir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+
+	rc = write_file(dir, "id0", id, sizeof(id))
+		|| write_file(dir, "config0", config0, sizeof(config0))
+		|| (dock->device->family != FAMILY_COMMANDER_TM && write_file(dir, "config1", config1, sizeof(config1)))
+		|| write_file(dir, "memory", memory, dock->device->log_size);
+	free(memory);
+
+	// Timing for the whole exchange, to compare adapters and units over time
+	char path[300];
+	snprintf(path, sizeof(path), "%s/telemetry.json", dir);
+	int sf = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (sf >= 0) {
+		session_stats_json(session, sf);
+		close(sf);
+	}
+
+	if (rc)
+		return dock_fail(dock, "unable to write snapshot");
+
+	dock_state(dock, DOCK_DONE, NULL, 0);
+	return NULL;
+}
+
+
+// Print one status line for all ports, returns the number still running
+static int print_progress(dock_t *docks, int count) {
+	unsigned int done = 0, total = 0;
+	int running = 0;
+
+	dprintf(STDERR_FILENO, "\r");
+	for (int i = 0; i < count; i++) {
+		pthread_mutex_lock(&docks[i].lock);
+		dock_state_t state = docks[i].state;
+		unsigned int pct = docks[i].total ? (unsigned long long) docks[i].done * 100 / docks[i].total : 100;
+		if (state == DOCK_MEMORY) {
+			done += docks[i].done;
+			total += docks[i].total;
+		}
+		pthread_mutex_unlock(&docks[i].lock);
+
+		if (state == DOCK_MEMORY)
+			dprintf(STDERR_FILENO, "[%s %3u%%] ", docks[i].port, pct);
+		else
+			dprintf(STDERR_FILENO, "[%s %s] ", docks[i].port, dock_state_names[state]);
+
+		if (state != DOCK_DONE && state != DOCK_FAILED)
+			running++;
+	}
+	dprintf(STDERR_FILENO, "%u/%u KB ", done / 1024, total / 1024);
+
+	return running;
+}
+
+
+void usage(const char *name) {
+	dprintf(STDERR_FILENO, "Usage: %s [-o dir] [-V] port [port ...]\n", name);
+	dprintf(STDERR_FILENO, "Where: -o <dir>      Directory for snapshots (default .)\n");
+	dprintf(STDERR_FILENO, "       -V            Re-read suspect blocks of each download and repair bad ones:\n");
+	dprintf(STDERR_FILENO, "                     chunks that failed or were retried, the logbook and newest profile\n");
+	dprintf(STDERR_FILENO, "       port          Serial port with a Cochran attached, e.g. /dev/ttyUSB0,\n"
+		"                     or loop:<dir> to play a snapshot directory\n");
+}
+
+
+int main(int argc, char *argv[]) {
+	const char *outdir = ".";
+	int verify = 0;
+
+	int c;
+	while ((c = getopt(argc, argv, "o:V")) != -1) {
+		switch (c) {
+		case 'o':	// Output directory
+			outdir = optarg;
+			break;
+		case 'V':	// Verify each download
+			verify = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	int count = argc - optind;
+	if (count < 1) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	dock_t *docks = calloc(count, sizeof(dock_t));
+	if (!docks) {
+		dprintf(STDERR_FILENO, "Unable to allocate memory.\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < count; i++) {
+		docks[i].port = argv[optind + i];
+		docks[i].outdir = outdir;
+		docks[i].verify = verify;
+		pthread_mutex_init(&docks[i].lock, NULL);
+		if (pthread_create(&docks[i].thread, NULL, dock_worker, &docks[i]))
+			dock_fail(&docks[i], "unable to start thread");
+		else
+			docks[i].started = 1;
+	}
+
+	while (print_progress(docks, count))
+		msleep(500);
+	dprintf(STDERR_FILENO, "\n");
+
+	int failed = 0;
+	for (int i = 0; i < count; i++) {
+		if (docks[i].started)
+			pthread_join(docks[i].thread, NULL);
+		if (docks[i].state == DOCK_DONE) {
+			printf("%s: %s K%06u saved to %s/K%06u\n", docks[i].port, docks[i].device->name,
+				docks[i].serial, outdir, docks[i].serial);
+			if (verify)
+				printf("%s: verified %u blocks, %u repaired\n", docks[i].port,
+					docks[i].verified.blocks, docks[i].verified.repaired);
+		} else {
+			printf("%s: failed, %s\n", docks[i].port, docks[i].error);
+			failed++;
+		}
+		pthread_mutex_destroy(&docks[i].lock);
+		session_stats_free(&docks[i].stats);
+	}
+
+	free(docks);
+	exit(failed ? 2 : 0);
+}
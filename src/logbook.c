@@ -0,0 +1,451 @@
+/*
+ * logbook.c
+ *
+ * List, dump and decode the dives in a memory image, as kept in
+ * data/<model>/K<serial>/ or saved by dock or serial -f. The image is
+ * mapped once and read through cochran_memory, the model comes from the
+ * ID block so any family's layout works.
+ *
+ * logbook list     Every dive in the logbook, one per line
+ * logbook dump     A dive's log pointers, pre-dive events and profile
+ * logbook samples  A dive's decoded samples, one per line
+ * logbook export   Dives as JSON lines, log and samples, or as a
+ *                  Subsurface XML or UDDF document
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <libgen.h>
+#include <time.h>
+
+#include "cochran.h"
+#include "cochran_log.h"
+#include "cochran_sample.h"
+#include "cochran_memory.h"
+#include "cochran_export.h"
+
+typedef int (*command_t)(const cochran_memory_t *mem, int num);
+
+static int cmd_list(const cochran_memory_t *mem, int num);
+static int cmd_dump(const cochran_memory_t *mem, int num);
+static int cmd_samples(const cochran_memory_t *mem, int num);
+static int cmd_export(const cochran_memory_t *mem, int num);
+
+static const struct {
+	const char *name;
+	command_t run;
+	int needs_num;
+} commands[] = {
+	{ "list",		cmd_list,		0 },
+	{ "dump",		cmd_dump,		1 },
+	{ "samples",	cmd_samples,	1 },
+	{ "export",		cmd_export,		0 },
+};
+
+const char *export_format = NULL;
+
+int cmdr_event_bytes[15][2] = { {0x00, 17}, {0x01, 21}, {0x02, 18},
+								{0x03, 17}, {0x06, 19}, {0x07, 19},
+								{0x08, 19}, {0x09, 19}, {0x0a, 19},
+								{0x0b, 21}, {0x0c, 19}, {0x0d, 19},
+								{0x0e, 19}, {0x10, 21},
+								{  -1,  1} };
+int emc_event_bytes[15][2] = {  {0x00, 19}, {0x01, 23}, {0x02, 20},
+								{0x03, 19}, {0x06, 21}, {0x07, 21},
+								{0x0a, 21}, {0x0b, 21}, {0x0f, 19},
+								{0x10, 21},
+								{  -1,  1} };
+
+
+void usage(char *progname) {
+	printf("Usage: %s list [-i id_file] dump_file\n", progname);
+	printf("       %s dump|samples [-i id_file] -n num dump_file\n", progname);
+	printf("       %s export [-i id_file] [-n num] [-F format] dump_file\n", progname);
+	printf("Where: -i id_file  ID block of the computer, default is id0 next to dump_file\n");
+	printf("       -n num      Log entry num (from 0 to 255 or 511), export does every dive without it\n");
+	printf("       -F format   json (default), subsurface or uddf\n");
+	printf("       dump_file   Is the file containing the dive computer dump.\n");
+	exit(1);
+}
+
+
+int main(int argc, char *argv[]) {
+	const char *id_file = NULL;
+	command_t run = NULL;
+	int needs_num = 0, num = -1;
+
+	if (argc < 2)
+		usage(argv[0]);
+
+	for (unsigned int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+		if (!strcmp(argv[1], commands[i].name)) {
+			run = commands[i].run;
+			needs_num = commands[i].needs_num;
+		}
+	}
+	if (!run)
+		usage(argv[0]);
+
+	// Options follow the command
+	optind = 2;
+	int c;
+	while ((c = getopt(argc, argv, "i:n:F:")) != -1) {
+		switch (c) {
+		case 'i':
+			id_file = optarg;
+			break;
+		case 'n':
+			num = atoi(optarg);
+			break;
+		case 'F':
+			export_format = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if ((needs_num && num < 0) || optind != argc - 1)
+		usage(argv[0]);
+
+	const char *dump_file = argv[optind];
+	char id_path[512];
+
+	if (!id_file) {
+		char dir[512];
+		snprintf(dir, sizeof(dir), "%s", dump_file);
+		snprintf(id_path, sizeof(id_path), "%s/id0", dirname(dir));
+		id_file = id_path;
+	}
+
+	unsigned char id[0x43];
+	int fd = open(id_file, O_RDONLY);
+	if (fd < 0 || read(fd, id, sizeof(id)) != sizeof(id)) {
+		printf("Unable to read ID block %s\n%s\n", id_file, strerror(errno));
+		exit(2);
+	}
+	close(fd);
+
+	cochran_memory_t mem;
+	if (cochran_memory_map(&mem, id, dump_file))
+		exit(2);
+
+	if (num >= (int) mem.log_count) {
+		printf("Error log num is too large, this logbook has %u entries.\n", mem.log_count);
+		exit(1);
+	}
+
+	int rc = run(&mem, num);
+
+	cochran_memory_unmap(&mem);
+
+	exit(rc);
+}
+
+
+static int cmd_list(const cochran_memory_t *mem, int num) {
+	cochran_log_t log;
+
+	(void) num;
+
+	cochran_log_print_short_header(1);
+
+	for (unsigned int n = 0; n < mem->log_count; n++) {
+		const unsigned char *rec = cochran_memory_log(mem, n);
+		if (!rec)
+			continue;
+		mem->meta.parser(rec, &log);
+		cochran_log_print_short(&log, n);
+	}
+
+	return 0;
+}
+
+
+static void print_emc(const unsigned char *p) {
+
+	printf("Dive Date       Time     BT    Depth Temp Pre Ptr  Pro Ptr  End Ptr\n");
+
+	printf("%4d %04d-%02d-%02d %02d:%02d:%02d %2d:%02d %5.1f %3dF %08x %08x %08x\n",
+		array_uint16_le(p + 86), // dive number
+		*(p + 5) + 2000, *(p + 4), *(p + 3), 		// Year, Mon, Day
+		*(p + 2), *(p + 1), *p,						// Hour, Min, Sec
+		array_uint16_le(p + 256 + 48)/60,			// Bottom time hours
+		array_uint16_le(p + 256 + 48)%60,			// Bottom time Min
+		array_uint16_le(p + 256 + 50)/4.0,			// Max depth
+		*(p + 256 + 37),							// Temp
+		array_uint32_le(p + 30),					// Pre dive sample ptr
+		array_uint32_le(p + 6),						// Profile sample ptr
+		array_uint32_le(p + 256)					// End profile ptr
+	);
+}
+
+
+static void print_cmdr(const unsigned char * p) {
+	printf("Dive Date       Time     BT    Depth Temp Pre Ptr  Pro Ptr  End Ptr\n");
+
+	printf("%4d %04d-%02d-%02d %02d:%02d:%02d %2d:%02d %5.1f %3dF %08x %08x %08x\n",
+		array_uint16_le(p + 70), // dive number
+		*(p + 4) + 2000, *(p + 5), *(p + 2), 		// Year, Mon, Day
+		*(p + 3), *p, *(p + 1),						// Hour, Min, Sec
+		array_uint16_le(p + 128 + 38)/60,			// Bottom time hours
+		array_uint16_le(p + 128 + 38)%60,			// Bottom time Min
+		array_uint16_le(p + 128 + 40)/4.0,			// Max depth
+		*(p + 128 + 25),							// Temp
+		array_uint32_le(p + 30),					// Pre dive sample ptr
+		array_uint32_le(p + 6),						// Profile sample ptr
+		array_uint32_le(p + 128)					// End profile ptr
+	);
+}
+
+
+static void print_pre_dive(const unsigned char *profile, const int size, int emc) {
+	int (*event_bytes)[2] = emc ? emc_event_bytes : cmdr_event_bytes;
+	int p = 0, e;
+
+	printf("\nPre-dive sample size: %08x\n\n", size);
+
+	printf(" Event Time-stamp          Display-time      Event data\n");
+
+	while (p < size) {
+		// Get event info
+		for (e = 0; event_bytes[e][0] != profile[p] && event_bytes[e][0] != -1; e++);
+		printf("  %02x ", profile[p]);
+
+		if (p + event_bytes[e][1] > size) {
+			printf("truncated\n");
+			break;
+		}
+
+		// Get time stamp from event
+		time_t time = array_uint32_le(profile + p + 1) + COCHRAN_EPOCH;
+		struct tm *t;
+		t = gmtime(&time);
+
+		// And display
+		printf("%4d-%02d-%02d %02d:%02d:%02d ", t->tm_year + 1900, t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec);
+
+
+		// Get display time from event
+		if (emc)
+			printf("%2d-%02d-%02d %02d:%02d:%02d ", profile[p+10], profile[p+9], profile[p+8], profile[p+7], profile[p+6], profile[p+5]);
+		else
+			printf("%2d-%02d-%02d %02d:%02d:%02d ", profile[p+9], profile[p+10], profile[p+7], profile[p+8], profile[p+5], profile[p+6]);
+
+		for (int x = 11; x < event_bytes[e][1]; x++)
+			printf("%02x ", profile[p+x]);
+		printf("\n");
+
+		if (event_bytes[e][1] > 0)
+			p += event_bytes[e][1];
+		else
+			p++;
+	}
+}
+
+
+static int cmd_dump(const cochran_memory_t *mem, int num) {
+	const unsigned char *rec = cochran_memory_log(mem, num);
+	int emc = (mem->meta.log_size == 512);
+	cochran_log_t log;
+	cochran_profile_t view;
+	unsigned char *stitch;
+
+	if (!rec) {
+		printf("Log entry %d is empty\n", num);
+		return 3;
+	}
+
+	mem->meta.parser(rec, &log);
+
+	if (emc) {
+		print_emc(rec);
+	} else if (mem->meta.log_size == 256) {
+		print_cmdr(rec);
+	} else {
+		cochran_log_print_short_header(-1);
+		cochran_log_print_short(&log, -1);
+	}
+
+	// Pre-dive events and the profile come out of the ring
+	if (log.profile_pre && log.profile_pre != log.profile_begin) {
+		if (cochran_memory_view(mem, log.profile_pre, log.profile_begin, &view)) {
+			printf("\nPre-dive events aren't in the dump\n");
+		} else {
+			const unsigned char *events = cochran_profile_contiguous(&view, &stitch);
+			if (events)
+				print_pre_dive(events, view.size[0] + view.size[1], emc);
+			free(stitch);
+		}
+	}
+
+	if (cochran_memory_profile(mem, num, &log, &view)) {
+		printf("\nProfile isn't in the dump\n");
+		return 0;
+	}
+
+	printf("\nProfile %08x - %08x: %u bytes", view.begin, view.end, view.size[0] + view.size[1]);
+	if (view.size[1])
+		printf(", wrapped after %u", view.size[0]);
+	printf("\n");
+
+	return 0;
+}
+
+
+static int print_sample_cb(int time, cochran_sample_t *sample, void *userdata) {
+	(void) userdata;
+
+	printf("%02d:%02d:%02d ", time / 3600, time / 60 % 60, time % 60);
+
+	switch (sample->type) {
+	case SAMPLE_DEPTH:
+		printf("depth         %7.2f ft", sample->value.depth);
+		break;
+	case SAMPLE_TEMP:
+		printf("temp          %7.1f F", sample->value.temp);
+		break;
+	case SAMPLE_ASCENT_RATE:
+		printf("ascent rate   %7.2f ft/min", sample->value.ascent_rate);
+		break;
+	case SAMPLE_TANK_PRESSURE:
+		printf("tank pressure %7.1f psi", sample->value.tank_pressure);
+		break;
+	case SAMPLE_GAS_CONSUMPTION_RATE:
+		printf("gas rate      %7.2f psi/min", sample->value.gas_consumption_rate);
+		break;
+	case SAMPLE_NDL:
+		printf("ndl           %7u min", sample->value.ndl);
+		break;
+	case SAMPLE_DECO:
+	case SAMPLE_DECO_FIRST_STOP:
+		printf("%-13s %7u min, ceiling %d ft", sample->type == SAMPLE_DECO ? "deco" : "first stop",
+			sample->value.deco.time, sample->value.deco.ceiling);
+		break;
+	case SAMPLE_TISSUES:
+		printf("tissues      ");
+		for (int i = 0; i < 20; i++)
+			printf(" %02x", sample->value.tissues[i]);
+		break;
+	case SAMPLE_EVENT:
+		printf("event         %s", sample->value.event ? sample->value.event : "unknown");
+		break;
+	case SAMPLE_INTERDIVE:
+		printf("inter-dive    %02x %04d-%02d-%02d %02d:%02d:%02d", sample->value.interdive.code,
+			sample->value.interdive.time.tm_year + 1900, sample->value.interdive.time.tm_mon + 1,
+			sample->value.interdive.time.tm_mday, sample->value.interdive.time.tm_hour,
+			sample->value.interdive.time.tm_min, sample->value.interdive.time.tm_sec);
+		break;
+	default:
+		printf("unknown");
+		break;
+	}
+
+	if (sample->raw.size && sample->raw.data && sample->type != SAMPLE_TISSUES) {
+		printf("  [");
+		for (unsigned int i = 0; i < sample->raw.size; i++)
+			printf("%s%02x", i ? " " : "", sample->raw.data[i]);
+		printf("]");
+	}
+	printf("\n");
+
+	return 0;
+}
+
+
+static int cmd_samples(const cochran_memory_t *mem, int num) {
+	cochran_log_t log;
+	cochran_profile_t view;
+
+	if (cochran_memory_profile(mem, num, &log, &view)) {
+		printf("Dive %d has no profile in the dump\n", num);
+		return 3;
+	}
+
+	if (cochran_sample_parse_segments((unsigned char *) mem->model, &log, view.data, view.size, print_sample_cb, NULL)) {
+		printf("No sample parser for model %s\n", mem->model);
+		return 3;
+	}
+
+	return 0;
+}
+
+
+// One JSON line per dive, the same as serial -J
+static void export_dive(const cochran_memory_t *mem, unsigned int n) {
+	cochran_log_t log;
+	cochran_profile_t view;
+	int count = 0;
+
+	int rc = cochran_memory_profile(mem, n, &log, &view);
+
+	cochran_log_print_json(&log, n);
+	printf(",\"samples\":[");
+	if (!rc && view.size[0] + view.size[1] > 2)
+		cochran_sample_parse_segments((unsigned char *) mem->model, &log, view.data, view.size, cochran_sample_print_json, &count);
+	printf("]}\n");
+}
+
+
+// Subsurface XML or UDDF, the dives go straight from the image to the buffered writer
+static int export_document(const cochran_memory_t *mem, int num, cochran_export_format_t format) {
+	cochran_export_t *ex = malloc(sizeof(cochran_export_t));
+	cochran_log_t log;
+	cochran_profile_t view;
+
+	if (!ex || cochran_export_open(ex, STDOUT_FILENO, format, mem->model, mem->meta.description)) {
+		free(ex);
+		return 2;
+	}
+
+	for (unsigned int n = (num < 0 ? 0 : num); n < mem->log_count; n++) {
+		if (cochran_memory_log(mem, n)) {
+			if (cochran_memory_profile(mem, n, &log, &view))
+				memset(&view, 0, sizeof(view));
+			cochran_export_dive(ex, &log, view.data, view.size);
+		}
+
+		if (num >= 0)
+			break;
+	}
+
+	int rc = cochran_export_close(ex);
+	if (rc)
+		dprintf(STDERR_FILENO, "%s: Unable to write the export\n", strerror(rc));
+	free(ex);
+
+	return (rc ? 2 : 0);
+}
+
+
+static int cmd_export(const cochran_memory_t *mem, int num) {
+	cochran_export_format_t format;
+
+	if (num >= 0 && !cochran_memory_log(mem, num)) {
+		printf("Log entry %d is empty\n", num);
+		return 3;
+	}
+
+	if (export_format && strcmp(export_format, "json")) {
+		if (cochran_export_format(export_format, &format)) {
+			printf("Unknown export format %s\n", export_format);
+			return 1;
+		}
+		return export_document(mem, num, format);
+	}
+
+	if (num >= 0) {
+		export_dive(mem, num);
+		return 0;
+	}
+
+	for (unsigned int n = 0; n < mem->log_count; n++)
+		if (cochran_memory_log(mem, n))
+			export_dive(mem, n);
+
+	return 0;
+}
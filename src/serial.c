@@ -1,7 +1,6 @@
 
 
 #include <stdio.h>
-#include <termios.h>
 #include <fcntl.h>
 #include <error.h>
 #include <errno.h>
@@ -9,24 +8,16 @@
 #include <unistd.h>
 #include <time.h>
 #include <stdlib.h>
-#include <sys/ioctl.h>
-#include <linux/serial.h>
-
-typedef enum model_id_t {
-	MODEL_UNDEFINED,
-	MODEL_COMMANDER_TM,
-	MODEL_COMMANDER_I,
-	MODEL_COMMANDER_II,
-	MODEL_EMC_14,
-	MODEL_EMC_16,
-	MODEL_EMC_20H,
-} model_id_t;
-
-typedef enum family_id_t {
-	FAMILY_COMMANDER_TM = 0,
-	FAMILY_COMMANDER = 1,
-	FAMILY_EMC = 2,
-} family_id_t;
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cochran_transport.h"
+#include "cochran_device.h"
+#include "cochran_serial.h"
+#include "cochran_log.h"
+#include "cochran_sample.h"
+#include "cochran_memory.h"
 
 typedef enum read_mode_t {
 	MODE_UNDEFINED,
@@ -39,549 +30,281 @@ typedef enum read_mode_t {
 	MODE_FULL,
 } read_mode_t;
 
-#define uint32_to_array_le(buf, n) ((buf)[0] = (n) & 0xff, \
-									(buf)[1] = ((n) >> 8) & 0xff, \
-									(buf)[2] = ((n) >> 16) & 0xff, \
-									(buf)[3] = ((n) >> 24) & 0xff )
-#define uint24_to_array_le(buf, n) ((buf)[0] = (n) & 0xff, \
-									(buf)[1] = ((n) >> 8) & 0xff, \
-									(buf)[2] = ((n) >> 16) & 0xff )
-#define uint16_to_array_le(buf, n) ((buf)[0] = (n) & 0xff, \
-									(buf)[1] = ((n) >> 8) & 0xff )
-
-#define C_ARRAY_SIZE(array) (sizeof (array) / sizeof *(array))
-
-#define UNSUPPORTED  0xFFFFFFFF
-
-typedef struct device_t {
-	unsigned char *name;
-	model_id_t model;
-	family_id_t family;
-	unsigned int baud;
-	unsigned int highbaud;
-	unsigned int highbaud_byte;
-	unsigned int ram_address;
-	unsigned int ram_size;
-	unsigned int log_address;
-	unsigned int log_size;
-} device_t;
-
-#define F_COMMANDER_TM FAMILY_COMMANDER_TM, 9600, UNSUPPORTED, UNSUPPORTED,  0,          0x10000
-#define F_COMMANDER    FAMILY_COMMANDER,    9600, 115200,      0x04,         0,          0x10000
-#define F_EMC          FAMILY_EMC,          9600, 806400,      0x05,         0,          0x10000
-
-device_t devices[] = {
-	// name            model               family          log_address log_size
-	{ "Commander TM",  MODEL_COMMANDER_TM, F_COMMANDER_TM, 0x10000,    0x10000  },
-	{ "Commander I",   MODEL_COMMANDER_I,  F_COMMANDER,    0,          0x100000 },
-	{ "Commander II",  MODEL_COMMANDER_II, F_COMMANDER,    0,          0x100000 },
-	{ "EMC 14",        MODEL_EMC_14,       F_EMC,          0,          0x100000 },
-	{ "EMC 16",        MODEL_EMC_14,       F_EMC,          0,          0x100000 },
-	{ "EMC 20H",       MODEL_EMC_14,       F_EMC,          0,          0x100000 },
-};
-
-
-
-int open_serial(const char *file) {
-	int fd;
-
-	dprintf(STDERR_FILENO, "Opening %s\n", file);
-
-	struct termios newtio;
-	fd = open(file, O_RDWR | O_NONBLOCK | O_NOCTTY);
-
-	if (fd == -1) {
-		dprintf(STDERR_FILENO, "Unable to open serial port\n");
-		return fd;
-	}
-
-	tcgetattr(fd, &newtio);
-	cfsetospeed(&newtio, B9600);
-	cfsetispeed(&newtio, B9600);
-
-	newtio.c_cflag |= CLOCAL | CREAD;
-
-	// Set N, 8, 1
-	newtio.c_cflag &= ~PARENB;
-	newtio.c_cflag &= ~CSTOPB;
-	newtio.c_cflag &= ~CSIZE;
-	newtio.c_cflag |= CS8;
-
-	// Set no flow control
-	newtio.c_cflag &= ~CRTSCTS;
-	newtio.c_iflag &= ~(IXON | IXOFF | IXANY);
-
-	newtio.c_iflag |= IGNPAR | IGNBRK;
-
-	newtio.c_oflag &= ~(ONLCR | OPOST);
-
-	newtio.c_lflag &= ~(ISIG | ICANON | ECHO);
 
-	tcsetattr(fd, TCSANOW, &newtio);
-
-	return fd;
-}
-
-int msleep(unsigned int millis) {
-	struct timespec ts;
-
-	ts.tv_sec  = (millis / 1000);
-	ts.tv_nsec = (millis % 1000) * 1000000;
-	while (nanosleep (&ts, &ts) != 0) {
-		int errcode = errno;
-		if (errcode != EINTR ) {
-			return errcode;
-		}
+/*
+ * Pipelined download and decode
+ *
+ * The receive loop reports how far the buffer has been filled and a parser
+ * thread decodes log records and profiles as soon as the bytes they need
+ * have landed. Log records come first in memory so summaries appear almost
+ * immediately; profiles follow as the transfer reaches them.
+ */
+
+typedef struct pipeline_t {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	session_t *session;
+	cochran_memory_t mem;		// Logbook and profile ring of buf
+	char model[4];
+	int json;
+
+	const unsigned char *buf;
+	unsigned int size;
+	unsigned int landed;		// bytes received so far
+	int done;					// transfer complete or aborted
+} pipeline_t;
+
+
+static void pipeline_progress(const unsigned char *end, void *userdata) {
+	pipeline_t *pl = (pipeline_t *) userdata;
+	unsigned int landed = end - pl->buf;
+
+	pthread_mutex_lock(&pl->lock);
+	if (landed > pl->landed) {
+		pl->landed = landed;
+		pthread_cond_broadcast(&pl->cond);
 	}
-
-	return 0;
+	pthread_mutex_unlock(&pl->lock);
 }
 
-int set_baud(int fd, unsigned int baud_rate) {
-	speed_t baud;
-	int custom_baud = 0;
-	struct termios tty;
-
-	memset (&tty, 0, sizeof (tty));
-	if (tcgetattr (fd, &tty) != 0) {
-		return errno;
-	}
 
-	msleep(45);	// Give time to process received data
-
-	switch (baud_rate) {
-	case 0:		baud = B0; break;
-	case 50:	baud = B50; break;
-	case 75:	baud = B75; break;
-	case 110:	baud = B110; break;
-	case 134:	baud = B134; break;
-	case 150:	baud = B150; break;
-	case 200:	baud = B200; break;
-	case 300:	baud = B300; break;
-	case 600:	baud = B600; break;
-	case 1200:	baud = B1200; break;
-	case 1800:	baud = B1800; break;
-	case 2400:	baud = B2400; break;
-	case 4800:	baud = B4800; break;
-	case 9600:	baud = B9600; break;
-	case 19200: baud = B19200; break;
-	case 38400: baud = B38400; break;
-#ifdef B57600
-	case 57600: baud = B57600; break;
-#endif
-#ifdef B115200
-	case 115200: baud = B115200; break;
-#endif
-#ifdef B230400
-	case 230400: baud = B230400; break;
-#endif
-#ifdef B460800
-	case 460800: baud = B460800; break;
-#endif
-#ifdef B500000
-	case 500000: baud = B500000; break;
-#endif
-#ifdef B576000
-	case 576000: baud = B576000; break;
-#endif
-#ifdef B921600
-	case 921600: baud = B921600; break;
-#endif
-#ifdef B1000000
-	case 1000000: baud = B1000000; break;
-#endif
-#ifdef B1152000
-	case 1152000: baud = B1152000; break;
-#endif
-#ifdef B1500000
-	case 1500000: baud = B1500000; break;
-#endif
-#ifdef B2000000
-	case 2000000: baud = B2000000; break;
-#endif
-#ifdef B2500000
-	case 2500000: baud = B2500000; break;
-#endif
-#ifdef B3000000
-	case 3000000: baud = B3000000; break;
-#endif
-#ifdef B3500000
-	case 3500000: baud = B3500000; break;
-#endif
-#ifdef B4000000
-	case 4000000: baud = B4000000; break;
-#endif
-	default:
-	    baud = B38400; /* Required for custom baudrates on linux. */
-	    custom_baud = 1;
-	    break;
-	}
+// Wait for the first "size" bytes of the buffer, returns 0 if they never come
+static int pipeline_wait(pipeline_t *pl, unsigned int size) {
+	int rc;
 
-	// Set baud
-	if (cfsetispeed (&tty, baud) != 0 ||
-		cfsetospeed (&tty, baud) != 0) {
-		return errno;
-	}
+	if (size > pl->size)
+		return 0;
 
-	// Apply the new settings.
-	if (tcsetattr (fd, TCSANOW, &tty) != 0) {
-#if 0 // who cares
-		return errno;
-#endif
-	}
+	pthread_mutex_lock(&pl->lock);
+	while (pl->landed < size && !pl->done)
+		pthread_cond_wait(&pl->cond, &pl->lock);
+	rc = (pl->landed >= size);
+	pthread_mutex_unlock(&pl->lock);
 
-	// set custom baud
-	if (custom_baud) {
-#if defined(TIOCGSERIAL) && defined(TIOCSSERIAL) && !defined(__ANDROID__)
-		// Get the current settings.
-		struct serial_struct ss;
-		if (ioctl (fd, TIOCGSERIAL, &ss) != 0) {
-			return errno;
-		}
+	return rc;
+}
 
-		// Set the custom divisor.
-		ss.custom_divisor = ss.baud_base / baud_rate;
-		ss.flags &= ~ASYNC_SPD_MASK;
-		ss.flags |= ASYNC_SPD_CUST;
 
-		// Apply the new settings.
-		if (ioctl (fd, TIOCSSERIAL, &ss) != 0) {
-			return errno;
-		}
-#elif defined(IOSSIOSPEED)
-		speed_t speed = baudrate;
-		if (ioctl (fd, IOSSIOSPEED, &speed) != 0) {
-			return errno;
-		}
-#else
-		// Custom baudrates are not supported.
-		return -1;
-#endif
-	}
-    
-	return 0;
+// Wait until the dive's profile has landed, all of the ring if it wrapped
+static int pipeline_profile(pipeline_t *pl, const cochran_profile_t *view) {
+	return pipeline_wait(pl, (view->size[1] ? pl->mem.profile_end : view->end) - pl->mem.base) ? 0 : -1;
 }
 
 
-void printhex(unsigned char *buf, int len)
-{
-	int ptr = 0;
-	int lineptr;
-	unsigned char ascii[17];
-
-	ascii[16] = 0;
-
-	while (ptr < len)
-	{
-		lineptr = 0;
-		dprintf(STDERR_FILENO, "%04x  ", ptr); // print byte count
-		while (ptr < len && lineptr < 16) {
-			if (lineptr == 8)
-				dprintf(STDERR_FILENO, "    %02X ", buf[ptr]);
-			else
-				dprintf(STDERR_FILENO, "%02X ", buf[ptr]);
-
-			// Build ascii representation
-			if (buf[ptr] >31 && buf[ptr] < 127)
-				ascii[lineptr] = buf[ptr];
-			else
-				ascii[lineptr] = '.';
-			ptr++;
-			lineptr++;
-		}
-
-		if (lineptr < 16) ascii[lineptr] = 0;
-		dprintf(STDERR_FILENO, " %s \n", ascii);
-	}
-}
+static void *pipeline_parse(void *userdata) {
+	pipeline_t *pl = (pipeline_t *) userdata;
+	const cochran_memory_t *mem = &pl->mem;
+	unsigned int log_size = mem->meta.log_size;
+	cochran_log_t log;
 
+	if (!pl->json)
+		cochran_log_print_short_header(1);
 
-int wait_for_aa(int fd) {
-	int ret, count = 0;
-	unsigned char buf[1];
+	// The logbook and dive rules are cochran_memory's, as logbook uses on a saved image
+	for (unsigned int n = 0; n < mem->log_count; n++) {
+		if (!pipeline_wait(pl, (n + 1) * log_size))
+			break;
+		if (!cochran_memory_log(mem, n))
+			continue;
 
-	ioctl(fd, TIOCSBRK, NULL);
-	msleep(16);
-	ioctl(fd, TIOCCBRK, NULL);
-	tcflush(fd, TCIOFLUSH);
-	write(fd, "\x00", 1);
-	usleep(16000);
+		cochran_log_parse(pl->model, mem->image + n * log_size, &log);
 
-	while (count++ < 200) {
-		ret = read(fd, buf, 1);
-		if (ret > 0) {
-			return 0;
-			if (buf[0] == 0xaa) return 0;
+		if (!pl->json) {
+			cochran_log_print_short(&log, n);
+			fflush(stdout);
+			continue;
 		}
-		usleep(50000);
-	}
-	return 1;
-}
 
-int write_serial(int fd, const unsigned char *buf, unsigned int size, unsigned int hb) {
+		// Early models don't log where the profile ends, the next dive's record has to land
+		int have_next = pipeline_wait(pl, ((n + 1) % mem->log_count + 1) * log_size);
 
-	dprintf(STDERR_FILENO, "Sending %d byte command\n", size);
+		cochran_profile_t view;
+		int count = 0, rc = -1;
 
-	if (hb && wait_for_aa(fd))
-		return -1;
+		if (log.profile_end || have_next)
+			rc = cochran_memory_profile(mem, n, &log, &view);
+		if (!rc)
+			rc = pipeline_profile(pl, &view);
 
-	for (unsigned int x = 0; x < size; x++) {
-		dprintf(STDERR_FILENO, "- %02hhx ", buf[x]);
-		if (write(fd, buf + x, 1) != 1)
-			return errno;
-		msleep(16);
+		cochran_log_print_json(&log, n);
+		printf(",\"samples\":[");
+		if (!rc && view.size[0] + view.size[1] > 2)
+			cochran_sample_parse_segments((unsigned char *) pl->model, &log, view.data, view.size, cochran_sample_print_json, &count);
+		printf("]}\n");
+		fflush(stdout);
 	}
-	dprintf(STDERR_FILENO, "\n");
 
-	return 0;
+	return NULL;
 }
 
 
-int read_serial(int fd, unsigned char *buf, unsigned int size) {
-
-	int result_bytes = size;
-	int readcnt = 0, bufptr = 0, progress = 0;
+int pipeline_start(pipeline_t *pl, session_t *session, const unsigned char *id, const unsigned char *buf, unsigned int size, int json) {
+	cochran_log_meta_t meta;
 
-	// Hacker progress bar
-	unsigned int tick_size = size / 64;
-	if (tick_size < 1024) tick_size = 1024;
-	unsigned int ticks = size / tick_size;
-	unsigned char  *blank = "                                                                "; // 64 spaces
+	memset(pl, 0, sizeof(pipeline_t));
+	memcpy(pl->model, id + ID_MODEL_OFFSET, 3);
+	pl->model[3] = 0;
 
-	if (ticks > 1) {
-		dprintf(STDERR_FILENO, "[%s]\r[", blank + (64 - ticks));
+	if (cochran_log_meta(&meta, pl->model)) {
+		dprintf(STDERR_FILENO, "Unknown model \"%s\", dives won't be parsed.\n", pl->model);
+		return -1;
 	}
 
-	while (bufptr < result_bytes)
-	{
-		readcnt = read(fd, buf + bufptr, result_bytes - bufptr);
-
-		if (readcnt < 0 && errno != 11) dprintf(STDERR_FILENO, "readcnd less than zero: (%d) %s\n", errno, strerror(errno));
+	if (cochran_memory_init(&pl->mem, id, buf, size))
+		return -1;
 
-		if (readcnt > 0) {
-			bufptr += readcnt;
-			progress += readcnt;
-			if (progress >= tick_size) {
-				progress -= tick_size;
-				dprintf(STDERR_FILENO, ".");
-			}
-		}
-		msleep(16);
-	}
+	pl->session = session;
+	pl->json = json;
+	pl->buf = buf;
+	pl->size = size;
 
-	dprintf(STDERR_FILENO, "\nRead %d bytes\n", bufptr);
-	return errno;
-}
+	pthread_mutex_init(&pl->lock, NULL);
+	pthread_cond_init(&pl->cond, NULL);
 
+	session->progress = pipeline_progress;
+	session->progress_data = pl;
 
-int do_cmd(device_t *device, int fd, unsigned char *cmd, unsigned int cmd_size, unsigned char *buf, unsigned int size) {
-
-	if (write_serial(fd, cmd, cmd_size, 1)) {
-		dprintf(STDERR_FILENO, "Error (%d) reading. %s\n", errno, strerror(errno));
-		return errno;
+	if (pthread_create(&pl->thread, NULL, pipeline_parse, pl)) {
+		session->progress = NULL;
+		return -1;
 	}
 
-	return read_serial(fd, buf, size);
+	return 0;
 }
 
 
-int do_cmd_high_baud(device_t *device, int fd, unsigned char *cmd, unsigned int cmd_size, unsigned char *buf, unsigned int size) {
-	int rc;
-
-	if (write_serial(fd, cmd, cmd_size, 1)) {
-		dprintf(STDERR_FILENO, "Error (%d) reading. %s\n", errno, strerror(errno));
-		return errno;
-	}
-
-	// Change baud
-	if (set_baud(fd, device->highbaud))
-		return errno;
+void pipeline_finish(pipeline_t *pl) {
+	pl->session->progress = NULL;
 
-	rc = read_serial(fd, buf, size);
+	pthread_mutex_lock(&pl->lock);
+	pl->done = 1;
+	pthread_cond_broadcast(&pl->cond);
+	pthread_mutex_unlock(&pl->lock);
 
-	// Change baud
-	if (set_baud(fd, device->baud))
-		return errno;
+	pthread_join(pl->thread, NULL);
 
-	return rc;
+	pthread_cond_destroy(&pl->cond);
+	pthread_mutex_destroy(&pl->lock);
 }
 
 
-int read_low_baud(device_t *device, int fd, unsigned int address, unsigned int read_size, unsigned char *buf, unsigned int size) {
-	unsigned char cmd[6];
-	unsigned int cmd_size = 6;
-
-	cmd[0] = 0x05;
-
-	unsigned int blk_size = 0x10000;
-
-	for (unsigned int i = 0; i < read_size; i += blk_size) {
-		int rc = 0;
-		// Load address into command
-		uint24_to_array_le(cmd + 1, address + i);
-
-		if (read_size - i < blk_size)
-			read_size -= i;
-
-		// Load read size into command
-		uint16_to_array_le(cmd + 4, read_size);
-
-		if ((rc = do_cmd(device, fd, cmd, cmd_size, buf + i, read_size))) {
-			return rc;
-		}
+/*
+ * Direct-to-disk output. The output file is preallocated and mapped and
+ * reads land straight in the mapping, pages are pushed out every
+ * MAP_SYNC_SIZE bytes so memory stays flat and a crash leaves whatever
+ * arrived on disk. The file isn't truncated first so an earlier partial
+ * download is kept until it's overwritten.
+ */
+#define MAP_SYNC_SIZE	0x10000
+
+typedef struct outmap_t {
+	int fd;						// -1 when reads go to malloc'd memory
+	unsigned char *map;
+	unsigned int size;
+	unsigned int synced;		// Bytes already handed to msync
+	read_progress_t next;		// Progress callback we sit in front of
+	void *next_data;
+} outmap_t;
+
+
+static unsigned char *result_buffer(outmap_t *om, unsigned int size) {
+	if (om->fd < 0)
+		return (unsigned char *) malloc(size);
+
+	int rc = posix_fallocate(om->fd, 0, size);
+	if (rc && rc != EOPNOTSUPP && rc != EINVAL) {
+		dprintf(STDERR_FILENO, "Unable to preallocate %u bytes. %s\n", size, strerror(rc));
+		return NULL;
 	}
-	return 0;
+	// Longer leftovers from another model would confuse later tools
+	if (ftruncate(om->fd, size))
+		return NULL;
+
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, om->fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	om->map = (unsigned char *) map;
+	om->size = size;
+	om->synced = 0;
+	return om->map;
 }
 
-int read_high_baud(device_t *device, int fd, unsigned int address, unsigned int read_size, unsigned char *buf, unsigned int size) {
-	unsigned char cmd[10];
-	unsigned int cmd_size = 10;
-
-	switch (device->family) {
-	case FAMILY_COMMANDER:		// 24 bit command
-		cmd[0] = 0x15;
-		uint24_to_array_le(cmd + 1, address);
-		uint24_to_array_le(cmd + 4, read_size);
-		cmd[7] = device->highbaud_byte;
-		cmd_size = 8;
-		break;
-	case FAMILY_EMC:				// 32 bit command
-		cmd[0] = 0x15;
-		uint32_to_array_le(cmd + 1, address);
-		uint32_to_array_le(cmd + 5, read_size);
-		cmd[9] = device->highbaud_byte;
-		break;
-	default:				// Commander TM has no high-speed read
-		return -1;
-	}
-
-	return do_cmd_high_baud(device, fd, cmd, cmd_size, buf, size);
-}
 
+static void map_progress(const unsigned char *end, void *userdata) {
+	outmap_t *om = (outmap_t *) userdata;
+	unsigned int landed = end - om->map;
 
-int read_id(device_t *device, int fd, unsigned char *buf, unsigned int size) {
-	unsigned char cmd[6];
-	unsigned int cmd_size = 6;
+	if (om->next)
+		om->next(end, om->next_data);
 
-	switch (device->family) {
-	case FAMILY_COMMANDER_TM:
-		memcpy(cmd, "\x05\xBD\x7F\x00\x43\x00", cmd_size);
-		break;
-	case FAMILY_COMMANDER:
-		memcpy(cmd, "\x05\xBD\x7F\x00\x43\x00", cmd_size);
-		break;
-	case FAMILY_EMC:
-		memcpy(cmd, "\x05\x9D\xFF\x00\x43\x00", cmd_size);
-		break;
-	default:
-		return -1;
-		break;
+	if (landed >= om->synced + MAP_SYNC_SIZE) {
+		unsigned int start = om->synced & ~(sysconf(_SC_PAGESIZE) - 1);
+		msync(om->map + start, landed - start, MS_ASYNC);
+		om->synced = landed;
 	}
-
-	return do_cmd(device, fd, cmd, cmd_size, buf, size);
 }
 
 
-int read_config0(device_t *device, int fd, unsigned char *buf, unsigned int size) {
-	unsigned char cmd[2];
-	unsigned int cmd_size;
-
-	switch (device->family) {
-	case FAMILY_COMMANDER_TM:
-		cmd[0] = 0x96;
-		cmd_size = 1;
-		break;
-	case FAMILY_COMMANDER:
-	case FAMILY_EMC:
-		cmd[0] = 0x96;
-		cmd[1] = 0x00;
-		cmd_size = 2;
-		break;
-	default:
-		return -1;
-		break;
-	}
-
-	return do_cmd(device, fd, cmd, cmd_size, buf, size);
+// Call after anything else that watches the read, e.g. pipeline_start()
+static void map_attach(outmap_t *om, session_t *session) {
+	if (!om->map)
+		return;
+	om->next = session->progress;
+	om->next_data = session->progress_data;
+	session->progress = map_progress;
+	session->progress_data = om;
 }
 
 
-int read_config1(device_t *device, int fd, unsigned char *buf, unsigned int size) {
-	unsigned char cmd[2];
-	unsigned int cmd_size;
-
-	switch (device->family) {
-	case FAMILY_COMMANDER_TM:
-		dprintf(STDERR_FILENO, "Device %s doesn't have a second config page.\n", device->name);
-		return 0;
-		break;
-	case FAMILY_COMMANDER:
-	case FAMILY_EMC:
-		cmd[0] = 0x96;
-		cmd[1] = 0x01;
-		cmd_size = 2;
-		break;
-	default:
-		return -1;
-		break;
+// The read is done, hand the progress hook back
+static void map_detach(outmap_t *om, session_t *session) {
+	if (session->progress == map_progress) {
+		session->progress = om->next;
+		session->progress_data = om->next_data;
 	}
-
-	return do_cmd(device, fd, cmd, cmd_size, buf, size);
 }
 
 
-int read_misc(device_t *device, int fd, unsigned char *buf, unsigned int size) {
-	unsigned char cmd[6];
-	unsigned int cmd_size = 6;
-
-	memcpy(cmd, "\x05\xE0\x03\x00\xDC\x05", cmd_size);
-
-	// Tell DC to refresh write current state data
-	write_serial(fd, "\x89", 1, 1);
-
-	return do_cmd(device, fd, cmd, cmd_size, buf, size);
+static void map_finish(outmap_t *om) {
+	msync(om->map, om->size, MS_SYNC);
+	munmap(om->map, om->size);
+	om->map = NULL;
 }
 
 
-int read_ram(device_t *device, int fd, unsigned char *buf, unsigned int size) {
-	unsigned char cmd[6];
-	unsigned int cmd_size = 6;
-
-	// Tell DC to refresh write current state data
-	write_serial(fd, "\x89", 1, 1);
-
-	cmd[0] = 0x05;
-
-	unsigned int read_size = 0x8000;
-
-	for (unsigned int i = 0; i < device->ram_size; i += read_size) {
-		// Load address into command
-		uint24_to_array_le(cmd + 1, i);
+// Re-read the suspect blocks and say what it found, id is NULL unless buf is a full read
+static void report_verify(session_t *session, const unsigned char *id, unsigned int address, unsigned char *buf, unsigned int size) {
+	unsigned int recent[3][2];
+	unsigned int recent_count = 0;
+	verify_result_t result;
+	cochran_memory_t mem;
 
-		if (device->ram_size - i < read_size)
-			read_size = device->ram_size - i;
+	// The logbook and the newest dive's profile are always checked
+	if (id && !cochran_memory_init(&mem, id, buf, size))
+		recent_count = cochran_memory_recent(&mem, recent);
 
-		// Load read size into command
-		uint16_to_array_le(cmd + 4, read_size);
+	dprintf(STDERR_FILENO, "Verifying\n");
+	int rc = verify_read(session, address, buf, size, recent, recent_count, &result);
 
-		int rc = 0;
-		if ((rc = do_cmd(device, fd, cmd, cmd_size, buf + i, read_size))) {
-			return rc;
-		}
-	}
-	return 0;
+	dprintf(STDERR_FILENO, "Verified %u blocks, %u repaired, %u bad\n", result.blocks, result.repaired, result.failed);
+	if (rc && rc != EIO)
+		dprintf(STDERR_FILENO, "Verify stopped, error (%d) %s\n", rc, strerror(rc));
 }
 
 
 void usage(const char *name) {
 
-	dprintf(STDERR_FILENO, "Usage: %s -m <model> [-ijcde | -a <addresss> -s <size>] -o file\n", name);
+	dprintf(STDERR_FILENO, "Usage: %s [-m <model>] [-ijcde | -a <addresss> -s <size>] -o file\n", name);
 	dprintf(STDERR_FILENO, "Where: model is one of");
-	for (int i = 0; i < C_ARRAY_SIZE(devices); i++) {
+	for (unsigned int i = 0; i < device_count; i++) {
 		if (i != 0) dprintf(STDERR_FILENO, ",");
 		dprintf(STDERR_FILENO, " %s", devices[i].name);
 	}
 	dprintf(STDERR_FILENO, "\n");
+	dprintf(STDERR_FILENO, "       Without -m the model is read from the ID block\n");
 	dprintf(STDERR_FILENO, "       -i            Read ID0 block\n");
 	dprintf(STDERR_FILENO, "       -j            Read ID1 block\n");
 	dprintf(STDERR_FILENO, "       -c            Read conf0 block\n");
@@ -590,23 +313,32 @@ void usage(const char *name) {
 	dprintf(STDERR_FILENO, "       -f            Read all Log and Profile data\n");
 	dprintf(STDERR_FILENO, "       -x            Use High-speed read command for address read mode\n");
 	dprintf(STDERR_FILENO, "       -r            Read RAM/ROM memory\n");
+	dprintf(STDERR_FILENO, "       -V            Re-read suspect blocks and repair bad ones: chunks that failed or\n");
+	dprintf(STDERR_FILENO, "                     were retried, and with -f the logbook and newest dive's profile\n");
+	dprintf(STDERR_FILENO, "       -p            With -f, print dive summaries while downloading\n");
+	dprintf(STDERR_FILENO, "       -J            With -f, print dives and profiles as JSON while downloading\n");
 	dprintf(STDERR_FILENO, "       -a <address>  Read memory at the address\n");
 	dprintf(STDERR_FILENO, "       -s <size>     Read size bytes\n");
 	dprintf(STDERR_FILENO, "       -o <file>     Output to file\n");
+	dprintf(STDERR_FILENO, "       -M            With -f, -r or -a, read straight into the output file through a mapping\n");
+	dprintf(STDERR_FILENO, "       -t <file>     Write per command timing as JSON, - for stderr\n");
 }
 
 int main(int argc, char * argv[])
 {
 	read_mode_t mode = MODE_UNDEFINED;
 	unsigned int address = 0xFFFFFFFF, size = 0;
-	unsigned char *outfile;
+	unsigned char *outfile = NULL;
+	const char *statsfile = NULL;
 	int result_size = 0;
 	int high_speed = 0;
+	int parse = 0, json = 0;
+	int verify = 0;
+	int mapped = 0;
 	device_t *device = NULL;
-	unsigned int device_count = C_ARRAY_SIZE(devices);
 
 	int c; 
-	while ((c = getopt(argc, argv, "m:icdefxra:s:o:")) != -1) {
+	while ((c = getopt(argc, argv, "m:icdefxrpJVMa:s:o:t:")) != -1) {
 		switch (c) {
 		case 'm': 	// Set model
 			for (unsigned int i = 0; i < device_count; i++) {
@@ -615,6 +347,12 @@ int main(int argc, char * argv[])
 					break;
 				}
 			}
+			if (device == NULL) {
+				dprintf(STDERR_FILENO, "Unknown model \"%s\"\n", optarg);
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
 		case 'i':	// Read ID block
 			mode = MODE_ID;
 			result_size = 0x43;
@@ -640,6 +378,19 @@ int main(int argc, char * argv[])
 		case 'x':	// Use high speed read
 			high_speed = 1;
 			break;
+		case 'p':	// Parse while downloading
+			parse = 1;
+			break;
+		case 'J':	// Parse while downloading, JSON output
+			parse = 1;
+			json = 1;
+			break;
+		case 'M':	// Read straight into the mapped output file
+			mapped = 1;
+			break;
+		case 'V':	// Verify memory reads
+			verify = 1;
+			break;
 		case 'a':	// Read address
 			mode = MODE_ADDRESS;
 			address = (int) strtof(optarg, NULL);
@@ -650,6 +401,9 @@ int main(int argc, char * argv[])
 		case 'o': 	// Output file
 			outfile = optarg;
 			break;
+		case 't':	// Telemetry report
+			statsfile = optarg;
+			break;
 		default:
 			usage(argv[0]);
 			exit(1);
@@ -662,33 +416,75 @@ int main(int argc, char * argv[])
 		exit(3);
 	}
 
-	if (device == NULL) {
-		dprintf(STDERR_FILENO, "You must speficy a dive computer type.\n");
+	if (mapped && !outfile) {
+		dprintf(STDERR_FILENO, "Mapped output needs an output file.\n");
+		exit(1);
+	}
+
+	// The small blocks are written whole, an untruncated file would keep an old tail
+	if (mapped && mode != MODE_FULL && mode != MODE_RAM && mode != MODE_ADDRESS) {
+		dprintf(STDERR_FILENO, "Mapped output is for -f, -r and -a reads.\n");
 		exit(1);
 	}
 
-	int fd = open_serial(argv[optind]);
-	if (fd < 0) {
+	if (parse && (mode != MODE_FULL || !outfile)) {
+		dprintf(STDERR_FILENO, "Parsing while downloading needs -f and an output file.\n");
+		exit(1);
+	}
+
+	transport_t *transport = transport_open(argv[optind]);
+	if (!transport) {
 		dprintf(STDERR_FILENO, "Error (%d) opening file \"%s\"\n", errno, strerror(errno));
 		exit(1);
 	}
 
-	// Set baud
-	int rc = set_baud(fd, device->baud);
+	session_stats_t stats = { 0 };
+	session_t session = { .device = device, .transport = transport, .port = argv[optind] };
+	if (statsfile || verify)		// Verify finds suspect chunks in the telemetry
+		session.stats = &stats;
+
+	// Set baud, every model talks 9600 until a high-speed read
+	int rc = transport->ops->set_baud(transport, device ? device->baud : 9600);
 	if (rc) {
 		dprintf(STDERR_FILENO, "Error (%d) setting baud rate. %s\n", errno, strerror(errno));
 		exit(1);
 	}
 
+	unsigned char id[0x43];
+	int have_id = 0;
+
+	if (device == NULL) {
+		// No -m, ask the dive computer what it is
+		device = identify_device(&session, id, sizeof(id));
+		if (device == NULL) {
+			dprintf(STDERR_FILENO, "Unable to identify the dive computer, try -m <model>.\n");
+			exit(1);
+		}
+		dprintf(STDERR_FILENO, "Found %s\n", device->name);
+		session.device = device;
+		have_id = 1;
+	}
+
+	if (negotiate_baud(&session) != UNSUPPORTED)
+		dprintf(STDERR_FILENO, "High-speed reads at %u baud\n", session.highbaud);
+
 	int of = STDOUT_FILENO;
 	if (outfile) {
-		of = open(outfile, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		of = open(outfile, O_RDWR | O_CREAT | (mapped ? 0 : O_TRUNC), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 	}
 
 	if (of < 0) {
 		dprintf(STDERR_FILENO, "Error (%d) opening file \"%s\"\n", errno, strerror(errno));
 		exit(1);
 	}
+
+	struct stat st;
+	if (mapped && (fstat(of, &st) || !S_ISREG(st.st_mode))) {
+		dprintf(STDERR_FILENO, "Mapped output needs a regular file.\n");
+		exit(1);
+	}
+
+	outmap_t outmap = { .fd = -1 };
 	unsigned char *buf;
 
 	if (result_size) {
@@ -701,40 +497,63 @@ int main(int argc, char * argv[])
 
 	switch (mode) {
 	case MODE_ID:
-		read_id(device, fd, buf, result_size);
+		read_id(&session, buf, result_size);
 		break;
 	case MODE_CONF0:
-		read_config0(device, fd, buf, result_size);
+		read_config0(&session, buf, result_size);
 		break;
 	case MODE_CONF1:
-		read_config1(device, fd, buf, result_size);
+		read_config1(&session, buf, result_size);
 		break;
 	case MODE_MISC:
-		read_misc(device, fd, buf, result_size);
+		read_misc(&session, buf, result_size);
 		break;
 	case MODE_RAM:
 		result_size = device->ram_size;
-		buf = (unsigned char *) malloc(result_size);
+		outmap.fd = (mapped ? of : -1);
+		buf = result_buffer(&outmap, result_size);
 		if (!buf) {
 			dprintf(STDERR_FILENO, "Unable to allocated %d bytes of memory.\n", result_size);
 			exit(1);
 		}
 
-		read_low_baud(device, fd, device->ram_address, device->ram_size, buf, result_size);
+		map_attach(&outmap, &session);
+		read_low_baud(&session, device->ram_address, device->ram_size, buf, result_size);
+		map_detach(&outmap, &session);
 		break;
 	case MODE_FULL:	// Read log/profile data
 		result_size = device->log_size;
-		buf = (unsigned char *) malloc(result_size);
+		outmap.fd = (mapped ? of : -1);
+		buf = result_buffer(&outmap, result_size);
 		if (!buf) {
 			dprintf(STDERR_FILENO, "Unable to allocate %d bytes of memory.\n", result_size);
 			exit(1);
 		}
 
-		if (device->highbaud == UNSUPPORTED) {
-			read_low_baud(device, fd, device->log_address, device->log_size, buf, result_size);
+		pipeline_t pipeline;
+
+		// The ID block tells us which log and sample parsers to use, and where verify looks
+		if ((parse || verify) && !have_id)
+			have_id = !read_id(&session, id, sizeof(id));
+
+		if (parse) {
+			if (pipeline_start(&pipeline, &session, id, buf, result_size, json))
+				parse = 0;
+		}
+		map_attach(&outmap, &session);
+
+		if (session.highbaud == UNSUPPORTED) {
+			read_low_baud(&session, device->log_address, device->log_size, buf, result_size);
 		} else {
-			read_high_baud(device, fd, device->log_address, device->log_size, buf, result_size);
+			read_high_baud(&session, device->log_address, device->log_size, buf, result_size);
 		}
+
+		map_detach(&outmap, &session);
+		if (parse)
+			pipeline_finish(&pipeline);
+
+		if (verify)
+			report_verify(&session, have_id ? id : NULL, device->log_address, buf, result_size);
 		break;
 	case MODE_ADDRESS:
 		if (address == 0xFFFFFFFF || size == 0) {
@@ -744,26 +563,46 @@ int main(int argc, char * argv[])
 		}
 
 		result_size = size;
-		buf = (unsigned char *) malloc(result_size);
+		outmap.fd = (mapped ? of : -1);
+		buf = result_buffer(&outmap, result_size);
 		if (!buf) {
 			dprintf(STDERR_FILENO, "Unable to allocation %d bytes of memory.\n", result_size);
 			exit(1);
 		}
 
-		if (!high_speed) {
+		map_attach(&outmap, &session);
+		if (!high_speed || session.highbaud == UNSUPPORTED) {
 			// Read at low baud (e.g. Commander TM)
-			read_low_baud(device, fd, address, size, buf, result_size);
+			read_low_baud(&session, address, size, buf, result_size);
 		} else {
-			read_high_baud(device, fd, address, size, buf, result_size);
+			read_high_baud(&session, address, size, buf, result_size);
 		}
+		map_detach(&outmap, &session);
+
+		if (verify)
+			report_verify(&session, NULL, address, buf, result_size);
 		break;
 	}
 
-	if (result_size) {
+	if (outmap.map) {
+		// Already on disk
+		map_finish(&outmap);
+	} else if (result_size) {
 		// store data
 		write(of, buf, result_size);
 	}
 
-	close(fd);
+	if (statsfile) {
+		int sf = strcmp(statsfile, "-") ? open(statsfile, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) : STDERR_FILENO;
+		if (sf < 0) {
+			dprintf(STDERR_FILENO, "Error (%d) opening file \"%s\"\n", errno, strerror(errno));
+		} else {
+			session_stats_json(&session, sf);
+			if (sf != STDERR_FILENO) close(sf);
+		}
+	}
+	session_stats_free(&stats);
+
+	transport_close(transport);
 	close(of);
 }
@@ -0,0 +1,417 @@
+/*
+*	settings.c
+*
+*	Print, and change, the settings in a config page read from stdin, or
+*	change them on one or more dive computers at once. Only the words a
+*	change touches are written to a computer, then read back to check.
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <ctype.h>
+
+#include "cochran_transport.h"
+#include "cochran_device.h"
+#include "cochran_serial.h"
+#include "cochran_settings.h"
+
+typedef struct change_t {
+	const char *field;			// Label, or emc:<n> or cmdr:<n>
+	const char *value;
+} change_t;
+
+typedef struct target_t {
+	pthread_t thread;
+	const char *port;
+	const change_t *changes;
+	int change_count;
+	const struct cochran_config_schema *schema[2];	// EMC, Commander
+
+	device_t *device;
+	unsigned int serial;
+	int words;					// Words written
+	double ms;					// Writing and reading back
+	const char *error;
+	char reason[128];			// A change the unit can't take
+} target_t;
+
+
+void usage(const char *name)
+{
+	printf("Usage: %s [-c] [-o file] [-P preset] [field value ...] < config\n", name);
+	printf("       %s -d port [-d port ...] [-P preset] [field value ...]\n", name);
+	printf("Where:  -c         Commander page, default is EMC\n");
+	printf("        -o <file>  Write the changed page\n");
+	printf("        -d <port>  Change config0 on the computer at port, or loop:<dir>\n");
+	printf("        -P <file>  Preset, a field and value per line\n");
+	printf("        field      A label, or the number printed in <> as emc:<n> or\n");
+	printf("                   cmdr:<n>, a bare number only for a page from stdin\n");
+	printf("        value      A number in the field's range, or an on/off label\n");
+}
+
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+
+// A change's field in a table, bare numbers only where there's one table
+static int change_field(const struct cochran_config_schema *schema, const change_t *c, int numbers)
+{
+	char *end;
+	long n = strtol(c->field, &end, 10);
+
+	if (numbers && *c->field && !*end)
+		return (n >= 0 && n < schema->count ? n : -1);
+	return cochran_config_find_field(schema->cfg, schema->count, c->field, 0);
+}
+
+
+// The change's field and value, or why the table can't take it
+static int check_change(const struct cochran_config_schema *schema, const change_t *c, int numbers,
+	union cochran_config_value *value, char *reason, size_t size)
+{
+	int f = change_field(schema, c, numbers);
+
+	if (f < 0) {
+		snprintf(reason, size, "no field %s", c->field);
+		return -1;
+	}
+	if (cochran_config_parse_value(&schema->cfg[f], c->value, value)) {
+		snprintf(reason, size, "%s: %s isn't a value", schema->cfg[f].label, c->value);
+		return -1;
+	}
+	if (cochran_config_check_value(&schema->cfg[f], value)) {
+		snprintf(reason, size, "%s: %s is out of range", schema->cfg[f].label, c->value);
+		return -1;
+	}
+	return f;
+}
+
+
+// Field and value pairs, one per line, the value last. Blank lines and # comments are skipped.
+static int load_preset(const char *file, change_t **changes, int *count)
+{
+	char line[256];
+	FILE *fp = fopen(file, "r");
+
+	if (!fp) {
+		printf("%s: Unable to open %s\n", strerror(errno), file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *field = line, *value, *end;
+
+		// Labels have #1 in them, a comment's # isn't followed by a digit
+		for (char *p = line; *p; p++) {
+			if (*p == '#' && !isdigit((unsigned char) p[1])) {
+				*p = 0;
+				break;
+			}
+		}
+
+		end = line + strlen(line);
+		while (end > line && isspace((unsigned char) end[-1]))
+			*--end = 0;
+		while (isspace((unsigned char) *field))
+			field++;
+
+		// The value is the last word, the field everything before it
+		value = end;
+		while (value > field && !isspace((unsigned char) value[-1]))
+			value--;
+		if (value == field)
+			continue;
+		for (end = value; end > field && isspace((unsigned char) end[-1]); )
+			*--end = 0;
+
+		change_t *c = realloc(*changes, (*count + 1) * sizeof(change_t));
+		if (!c) {
+			fclose(fp);
+			return -1;
+		}
+		*changes = c;
+		c[*count].field = strdup(field);
+		c[*count].value = strdup(value);
+		(*count)++;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+
+/*
+*	Apply the changes to a transaction, returns the number of fields that
+*	changed. Every change is checked against the table first, one it
+*	doesn't have or a value out of range leaves the transaction alone.
+*/
+static int apply_changes(struct cochran_config_txn *txn, const change_t *changes, int count, int numbers,
+	char *reason, size_t size)
+{
+	union cochran_config_value value;
+	int changed = 0;
+
+	for (int i = 0; i < count; i++)
+		if (check_change(txn->schema, &changes[i], numbers, &value, reason, size) < 0)
+			return -1;
+
+	for (int i = 0; i < count; i++) {
+		int rc, f = check_change(txn->schema, &changes[i], numbers, &value, reason, size);
+
+		if ((rc = cochran_config_txn_set(txn, f, &value)) < 0)
+			return rc;
+		changed += rc;
+	}
+
+	return changed;
+}
+
+
+static void *target_fail(target_t *t, const char *error)
+{
+	t->error = error;
+	return NULL;
+}
+
+
+static void *target_worker(void *userdata)
+{
+	target_t *t = (target_t *) userdata;
+	session_t session = { .port = t->port, .quiet = 1 };
+	unsigned char id[0x43] = { 0 }, config0[CONFIG_PAGE_SIZE];
+	unsigned short words[CONFIG_PAGE_WORDS];
+	struct cochran_config_txn txn;
+
+	session.transport = transport_open(t->port);
+	if (!session.transport)
+		return target_fail(t, errno ? strerror(errno) : "unable to open");
+
+	if (session.transport->ops->set_baud(session.transport, 9600)) {
+		transport_close(session.transport);
+		return target_fail(t, "unable to set baud");
+	}
+
+	t->device = identify_device(&session, id, sizeof(id));
+	if (!t->device || t->device->family == FAMILY_COMMANDER_TM) {
+		transport_close(session.transport);
+		return target_fail(t, t->device ? "Commander TM settings can't be written" : "no Cochran found");
+	}
+
+	session.device = t->device;
+	session.timeout = 10000;
+
+	if (read_config0(&session, config0, sizeof(config0))) {
+		transport_close(session.transport);
+		return target_fail(t, "config0 read failed");
+	}
+	t->serial = device_serial_number(t->device, config0);
+
+	cochran_config_txn_begin(&txn, t->schema[t->device->family == FAMILY_EMC ? 0 : 1], config0);
+	if (apply_changes(&txn, t->changes, t->change_count, 0, t->reason, sizeof(t->reason)) < 0) {
+		transport_close(session.transport);
+		return target_fail(t, t->reason);
+	}
+
+	t->words = cochran_config_txn_dirty(&txn, words);
+
+	double start = now_ms();
+	int rc = write_config(&session, 0, txn.target, words, t->words);
+	t->ms = now_ms() - start;
+
+	transport_close(session.transport);
+
+	if (rc)
+		return target_fail(t, rc == EIO ? "read back didn't match" : "write failed");
+
+	return NULL;
+}
+
+
+static int change_devices(const char **ports, int port_count, const change_t *changes, int change_count)
+{
+	struct cochran_config_schema schema[2];
+	int failed = 0;
+
+	target_t *targets = calloc(port_count, sizeof(target_t));
+	if (!targets || cochran_config_schema_init(&schema[0], emc_cfg) || cochran_config_schema_init(&schema[1], cmd_cfg)) {
+		printf("Unable to build the settings schema\n");
+		return 1;
+	}
+
+	// Don't start on any unit with a change neither table can take
+	for (int i = 0; i < change_count; i++) {
+		union cochran_config_value value;
+		char reason[2][128];
+		int found = 0;
+
+		for (int t = 0; t < 2; t++) {
+			int f = check_change(&schema[t], &changes[i], 0, &value, reason[t], sizeof(reason[t]));
+			if (f >= 0)
+				found++;
+			else if (change_field(&schema[t], &changes[i], 0) >= 0) {
+				printf("%s\n", reason[t]);
+				return 1;
+			}
+		}
+		if (!found) {
+			printf("No field %s, give its label, or emc:<n> or cmdr:<n>\n", changes[i].field);
+			return 1;
+		}
+	}
+
+	for (int i = 0; i < port_count; i++) {
+		targets[i].port = ports[i];
+		targets[i].changes = changes;
+		targets[i].change_count = change_count;
+		targets[i].schema[0] = &schema[0];
+		targets[i].schema[1] = &schema[1];
+		if (pthread_create(&targets[i].thread, NULL, target_worker, &targets[i]))
+			target_fail(&targets[i], "unable to start thread");
+	}
+
+	for (int i = 0; i < port_count; i++) {
+		pthread_join(targets[i].thread, NULL);
+		if (targets[i].error) {
+			printf("%s: failed, %s\n", targets[i].port, targets[i].error);
+			failed++;
+		} else if (!targets[i].words) {
+			printf("%s: %s K%06u already set\n", targets[i].port, targets[i].device->name, targets[i].serial);
+		} else {
+			printf("%s: %s K%06u %d words (%d bytes) written and verified in %.0fms\n", targets[i].port,
+				targets[i].device->name, targets[i].serial, targets[i].words, targets[i].words * 5 + 1, targets[i].ms);
+		}
+	}
+
+	cochran_config_schema_free(&schema[0]);
+	cochran_config_schema_free(&schema[1]);
+	free(targets);
+
+	return (failed ? 2 : 0);
+}
+
+
+int main(int argc, char **argv)
+{
+	struct cochran_config *cfg = emc_cfg;
+	const char *out_file = NULL;
+	const char **ports = calloc(argc, sizeof(char *));
+	int port_count = 0;
+	change_t *changes = NULL;
+	int change_count = 0;
+	unsigned char config[CONFIG_PAGE_SIZE];
+
+	int c;
+	while ((c = getopt(argc, argv, "co:d:P:")) != -1) {
+		switch (c) {
+		case 'c':
+			cfg = cmd_cfg;
+			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		case 'd':
+			ports[port_count++] = optarg;
+			break;
+		case 'P':
+			if (load_preset(optarg, &changes, &change_count))
+				return 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((argc - optind) % 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (int i = optind; i < argc; i += 2) {
+		change_t *ch = realloc(changes, (change_count + 1) * sizeof(change_t));
+		if (!ch)
+			return 1;
+		changes = ch;
+		changes[change_count].field = argv[i];
+		changes[change_count].value = argv[i + 1];
+		change_count++;
+	}
+
+	if (port_count)
+		return change_devices(ports, port_count, changes, change_count);
+
+	if (read(0, config, CONFIG_PAGE_SIZE) != CONFIG_PAGE_SIZE) {
+		printf("Expected a %d byte config page\n", CONFIG_PAGE_SIZE);
+		return 1;
+	}
+
+	struct cochran_config_schema schema;
+	struct cochran_settings settings;
+
+	if (cochran_config_schema_init(&schema, cfg) || cochran_settings_alloc(&settings, &schema)) {
+		printf("Unable to build the settings schema\n");
+		return 1;
+	}
+
+	cochran_config_decode_page(config, &settings);
+
+	for (int x = 0; x < schema.count; x++) {
+		struct cochran_config_word word = cochran_config_get_word(config, cfg[x].word);
+		printf("<%2d> %02x %02x ", x, word.data[0], word.data[1]);
+		cochran_config_print(&cfg[x], &settings.value[x]);
+	}
+
+	if (!change_count)
+		return 0;
+
+	struct cochran_config_txn txn;
+	unsigned short words[CONFIG_PAGE_WORDS];
+
+	char reason[128];
+
+	cochran_config_txn_begin(&txn, &schema, config);
+	if (apply_changes(&txn, changes, change_count, 1, reason, sizeof(reason)) < 0) {
+		printf("%s\n", reason);
+		return 1;
+	}
+
+	for (int i = 0; i < change_count; i++) {
+		int f = change_field(&schema, &changes[i], 1);
+		int w = cfg[f].word * 2;
+
+		cochran_config_print_label(&cfg[f]);
+		printf("\nFrom %02x %02x To %02x %02x\n", txn.current[w], txn.current[w + 1], txn.target[w], txn.target[w + 1]);
+	}
+
+	int count = cochran_config_txn_dirty(&txn, words);
+	printf("%d words to write:", count);
+	for (int i = 0; i < count; i++)
+		printf(" %02x", words[i]);
+	printf("\n");
+
+	if (out_file) {
+		int fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || write(fd, txn.target, CONFIG_PAGE_SIZE) != CONFIG_PAGE_SIZE) {
+			printf("%s: Unable to write %s\n", strerror(errno), out_file);
+			return 1;
+		}
+		close(fd);
+	}
+
+	cochran_settings_free(&settings);
+	cochran_config_schema_free(&schema);
+
+	return 0;
+}
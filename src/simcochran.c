@@ -39,10 +39,26 @@
 * 		Now with "mydir" containing the above files run the simulator with
 *		this command to simulate an EMC model:
 *
-* 		./simcochran emc mydir
+* 		./simcochran -e mydir
+*
+*		Add -T to pace replies like a real unit: 9600 baud for ID, config
+*		and low-baud reads, 115200 (Commander) or 806400 (EMC) for
+*		high-speed reads, a heartbeat every second and a short delay
+*		before each reply. -l, -h, -p and -d change each part on its own.
+*
+*		Several units can be simulated at once, each on its own PTY. Extra
+*		directories follow the first, a c: or e: prefix picks the model
+*		for that one, and -n repeats every directory:
+*
+*		./simcochran -M -n 4 -c cmdrdir e:emcdir
+*
+*		-F injects faults for testing a downloader's recovery, e.g. one
+*		byte in ten thousand dropped and one reply in five stalling:
+*
+*		./simcochran -F drop=0.0001,stall=0.2 -S 42 -c cmdrdir
 *
 * 		The simulator will print out the psuedo TTY device to connect your
-* 		application to.
+* 		application to, one line per unit.
 *
 *		IMPORTANT NOTE:
 *
@@ -64,7 +80,11 @@
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <pty.h>
-#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 
 #define array_uint16_le(p) ( (unsigned int) (p)[0] + ((p)[1] << 8) )
@@ -72,21 +92,116 @@
 #define array_uint32_le(p) ( (unsigned int) (p)[0] + ((p)[1] << 8) \
                                          + ((p)[2] << 16) + ((p)[3] << 24) )
 
-void heartbeat(int signal) {
-}
+// Timing model, a zero baud sends as fast as the PTY takes it
+typedef struct timing_t {
+	unsigned int low_baud;		// ID, config and low-baud reads
+	unsigned int high_baud;		// 0x15 high-speed reads
+	unsigned int heartbeat;		// ms between 0xAA bytes while idle
+	unsigned int delay;			// ms from the end of a command to the first reply byte
+} timing_t;
 
+timing_t timing = { 0, 0, 1000, 0 };
 
-int pty_setup() {
-	int mfd, sfd;
+// Paced replies go out in slices this far apart
+#define PACE_MS 5
+
+/*
+ * Fault injection. Byte faults are a chance per reply byte, the others a
+ * chance per reply (or per heartbeat). Every unit has its own generator
+ * seeded from -S and its number, so a run can be repeated exactly.
+ */
+typedef struct faults_t {
+	double drop;				// Byte never sent
+	double garbage;				// Random byte slipped in
+	double stall;				// Reply goes quiet part way for stall_ms
+	double heartbeat;			// Heartbeat not sent
+	double truncate;			// Reply ends early
+	double wrong_baud;			// Start of a 0x15 reply sent at the wrong rate
+	double stall_ms;
+} faults_t;
+
+faults_t faults = { 0, 0, 0, 0, 0, 0, 2000 };
+unsigned long long fault_seed = 1;
+
+static const struct {
+	const char *name;
+	double *value;
+} fault_names[] = {
+	{ "drop", &faults.drop },
+	{ "garbage", &faults.garbage },
+	{ "stall", &faults.stall },
+	{ "heartbeat", &faults.heartbeat },
+	{ "truncate", &faults.truncate },
+	{ "wrongbaud", &faults.wrong_baud },
+	{ "stall_ms", &faults.stall_ms },
+};
+
+#define FAULT_COUNT (sizeof(fault_names) / sizeof(fault_names[0]))
+
+
+// Data files, mapped at startup with -M
+typedef struct image_t {
+	const char *name;
+	unsigned char *data;
+	size_t size;
+} image_t;
+
+static const char *image_names[] = { "id0", "id1", "config0", "config1", "config2", "config3", "misc", "memory" };
+
+#define IMAGE_COUNT (sizeof(image_names) / sizeof(image_names[0]))
+
+
+// One simulated dive computer
+typedef struct sim_t {
+	int id;
+	int mfd;
 	char pts_name[256];
+	const char *data_dir;
+	int address_size;
+	image_t images[IMAGE_COUNT];
+	int hb_fd;					// Heartbeat timerfd
+	int pace_fd;				// Reply pacing timerfd
+	int whirlygig_ndx;
+
+	// Command being received
+	unsigned char command[16];
+	int command_len;
+	int command_expected;
+
+	// Reply in flight
+	const unsigned char *reply;
+	int reply_left;
+	unsigned char *reply_buf;	// Loaded from the file when not mapped
+	unsigned int baud;
+	struct timespec reply_start;
+	long long reply_sent;
+
+	// Fault injection
+	unsigned long long rng;
+	long long stall_at;			// Reply byte to go quiet at, -1 for none
+	int garble_left;			// Bytes still coming out at the wrong baud
+	unsigned int dropped, inserted;
+	unsigned char out[8192];	// Faulty bytes not yet taken by the PTY
+	int out_len, out_pos;
+} sim_t;
+
+int mapped = 0;
+int real_time = 0;
+int byte_faults = 0;
+int verbose = 1;
+
+// What an epoll event is for, packed with the sim index
+enum { EV_PTY, EV_HEARTBEAT, EV_PACE };
+
+
+int pty_setup(char *pts_name) {
+	int mfd, sfd;
 
 	if ((openpty(&mfd, &sfd, pts_name, 0, 0)) == -1) {
 		printf("%s: Unable to open PTY\n", strerror(errno));
 		return -1;
 	}
 
-	printf("Simulator running on device %s\n", pts_name);
-
 	// Set parameters
 	struct termios tty;
 	memset(&tty, 0, sizeof(tty));
@@ -126,190 +241,634 @@ int pty_setup() {
 }
 
 
-// Setup signal handler for heartbeat
-void setup_signals() {
-	struct sigaction sa, old_sa;
-
-	sa.sa_handler = heartbeat;
-	sigemptyset(&sa.sa_mask);
-	sigaddset(&sa.sa_mask, SIGALRM);
-	sa.sa_flags = 0;
-
-	sigaction(SIGALRM, &sa, &old_sa);
+// -h wins, otherwise -T uses the model's own rate
+unsigned int high_baud(int address_size) {
+	if (timing.high_baud || !real_time)
+		return timing.high_baud;
+	return (address_size == 4 ? 806400 : 115200);
 }
 
 
-void send_data(int mfd, const unsigned char *command, const char* data_dir, int address_size) {
-	char filename[256];
-	int seek = 0, size = -1, chunk = 12;
-	int data_fd;
-	char buffer[4096];
+/*
+ * Work out which data file a command reads and where. Returns the file
+ * name or NULL for a command we don't know.
+ */
+const char *decode_request(const unsigned char *command, int address_size, int *seek, int *size, unsigned int *baud) {
+	static char config[16];
+
+	*seek = 0;
+	*baud = timing.low_baud;
 
-	// Build file name
 	switch (command[0]) {
 	case 0x05:		// Read id blocks, 67 bytes
-		size = array_uint16_le(command + 4);
-		if (command[1] == 0x9d)
-			sprintf(filename, "%s/id0", data_dir);
-		else
-			sprintf(filename, "%s/id1", data_dir);
-		break;
+		*size = array_uint16_le(command + 4);
+		return (command[1] == 0x9d ? "id0" : "id1");
 	case 0x96:		// Read config block
-		size = 512;
-		sprintf(filename, "%s/config%d", data_dir, command[1]);
-		break;
+		*size = 512;
+		sprintf(config, "config%d", command[1]);
+		return config;
 	case 0x89:
-		size = array_uint16_le(command + 5);
-		sprintf(filename, "%s/misc", data_dir);
-		break;
+		*size = array_uint16_le(command + 5);
+		return "misc";
 	case 0x15:
-		chunk = 4096;
+		*baud = high_baud(address_size);
 		if (address_size == 4) {
 			// 32 LE address and size
-			seek = array_uint32_le(command + 1);
-			size = array_uint32_le(command + 5);
+			*seek = array_uint32_le(command + 1);
+			*size = array_uint32_le(command + 5);
 		} else {
-			seek = array_uint24_le(command + 1);
-			size = array_uint24_le(command + 4);
+			*seek = array_uint24_le(command + 1);
+			*size = array_uint24_le(command + 4);
+		}
+		return "memory";
+	}
+
+	printf("Unknown command %02x.\n", command[0]);
+	return NULL;
+}
+
+
+// xorshift64*, small and the same everywhere
+unsigned long long rng_next(sim_t *sim) {
+	unsigned long long x = sim->rng;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	sim->rng = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+int roll(sim_t *sim, double rate) {
+	return rate > 0 && (rng_next(sim) >> 11) * (1.0 / 9007199254740992.0) < rate;
+}
+
+
+// Parse name=rate[,name=rate...]
+int parse_faults(char *list) {
+	for (char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+		char *eq = strchr(item, '=');
+		unsigned int f;
+
+		if (!eq)
+			return -1;
+		*eq = 0;
+		for (f = 0; f < FAULT_COUNT; f++) {
+			if (!strcmp(item, fault_names[f].name)) {
+				*fault_names[f].value = atof(eq + 1);
+				break;
+			}
+		}
+		if (f == FAULT_COUNT) {
+			printf("Unknown fault %s\n", item);
+			return -1;
 		}
-		sprintf(filename, "%s/memory", data_dir);
-		break;
-	default:
-		printf("Unknown command %02x.\n", command[0]);
 	}
 
+	byte_faults = (faults.drop > 0 || faults.garbage > 0 || faults.wrong_baud > 0);
+	return 0;
+}
+
+
+/*
+ * Run a slice of the reply through the byte faults into sim->out and
+ * write what the PTY takes. Returns the reply bytes used up, which is 0
+ * while earlier faulty bytes are still waiting.
+ */
+int write_faulty(sim_t *sim, int size) {
+	int byte_count;
+
+	if (sim->out_pos == sim->out_len) {
+		if (size > (int) sizeof(sim->out) / 2)
+			size = sizeof(sim->out) / 2;
+
+		sim->out_len = sim->out_pos = 0;
+		for (int i = 0; i < size; i++) {
+			unsigned char b = sim->reply[i];
+			if (sim->garble_left > 0) {
+				b = rng_next(sim);
+				sim->garble_left--;
+			}
+			if (roll(sim, faults.garbage)) {
+				sim->out[sim->out_len++] = rng_next(sim);
+				sim->inserted++;
+			}
+			if (roll(sim, faults.drop)) {
+				sim->dropped++;
+				continue;
+			}
+			sim->out[sim->out_len++] = b;
+		}
+	} else {
+		size = 0;
+	}
+
+	byte_count = write(sim->mfd, sim->out + sim->out_pos, sim->out_len - sim->out_pos);
+	if (byte_count < 0 && errno != EAGAIN)
+		return -1;
+	if (byte_count > 0)
+		sim->out_pos += byte_count;
+
+	return size;
+}
+
+
+void map_images(sim_t *sim) {
+	char filename[256];
+	struct stat st;
+
+	for (unsigned int i = 0; i < IMAGE_COUNT; i++) {
+		sim->images[i].name = image_names[i];
+		if (!mapped)
+			continue;
+
+		sprintf(filename, "%s/%s", sim->data_dir, image_names[i]);
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			continue;		// Not every DC has every file
+
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+			if (map != MAP_FAILED) {
+				sim->images[i].data = (unsigned char *) map;
+				sim->images[i].size = st.st_size;
+				if (verbose)
+					printf("Mapped %s, %zu bytes\n", filename, sim->images[i].size);
+			}
+		}
+		close(fd);
+	}
+}
 
-	printf("Sending file %s, bytes (%d - %d)", filename, seek, seek + size);
 
-	// Open file and dump to device
-	data_fd = open(filename, O_RDONLY);
+// Read a reply out of the data file, the slow path without -M
+unsigned char *load_reply(sim_t *sim, const char *name, int seek, int *size) {
+	char filename[256];
+	unsigned char *buf;
 
+	sprintf(filename, "%s/%s", sim->data_dir, name);
+	int data_fd = open(filename, O_RDONLY);
 	if (data_fd < 0) {
 		printf("%s: opening %s\n", strerror(errno), filename);
-		return;
+		return NULL;
 	}
 
-	// Position file pointer
-	if (seek) {
-		if (lseek(data_fd, seek, SEEK_SET) == -1) {
-			printf("%s while positioning file pointer.\n", strerror(errno));
-			return;
-		}
+	buf = malloc(*size);
+	int byte_count = (buf ? pread(data_fd, buf, *size, seek) : -1);
+	close(data_fd);
+
+	if (byte_count <= 0) {
+		printf("%s: error reading %s\n", strerror(errno), filename);
+		free(buf);
+		return NULL;
+	}
+	if (byte_count < *size)
+		printf(" short by %d bytes", *size - byte_count);
+	*size = byte_count;
+
+	return buf;
+}
+
+
+void set_interest(int epfd, sim_t *sim, unsigned int events) {
+	struct epoll_event ev = { .events = events, .data.u64 = ((unsigned long long) sim->id << 2) | EV_PTY };
+
+	epoll_ctl(epfd, EPOLL_CTL_MOD, sim->mfd, &ev);
+}
+
+
+void arm_timer(int fd, unsigned int first_ms, unsigned int period_ms) {
+	struct itimerspec it = {
+		{ period_ms / 1000, (period_ms % 1000) * 1000000 },
+		{ first_ms / 1000, (first_ms % 1000) * 1000000 },
+	};
+
+	// A zero first expiry would disarm it
+	if (!first_ms && period_ms)
+		it.it_value.tv_nsec = 1;
+
+	timerfd_settime(fd, 0, &it, NULL);
+}
+
+
+// Idle again, listen for the next command and start heartbeating
+void end_reply(int epfd, sim_t *sim) {
+	free(sim->reply_buf);
+	sim->reply_buf = NULL;
+	sim->reply = NULL;
+	sim->reply_left = 0;
+
+	arm_timer(sim->pace_fd, 0, 0);
+	arm_timer(sim->hb_fd, timing.heartbeat, timing.heartbeat);
+	set_interest(epfd, sim, EPOLLIN);
+
+	if (verbose) {
+		if (sim->dropped || sim->inserted)
+			printf(" [%u dropped, %u inserted]", sim->dropped, sim->inserted);
+		printf("\n");
 	}
+	sim->dropped = sim->inserted = 0;
+}
+
 
-	if (size < chunk) chunk = size;
-	while (size > 0) {
-		int byte_count;
+// Write what's due, paced replies get what the baud allows so far
+void send_reply(int epfd, sim_t *sim) {
+	int size = sim->reply_left;
 
-		byte_count = read(data_fd, buffer, chunk);
-		if (byte_count != chunk) {
-			printf("%s: error reading %s\n", strerror(errno), filename);
+	if (sim->stall_at >= 0 && sim->reply_sent >= sim->stall_at) {
+		// Go quiet, pacing picks up again where it left off
+		sim->stall_at = -1;
+		sim->reply_start.tv_sec += (unsigned int) faults.stall_ms / 1000;
+		sim->reply_start.tv_nsec += ((unsigned int) faults.stall_ms % 1000) * 1000000L;
+		sim->reply_start.tv_sec += sim->reply_start.tv_nsec / 1000000000L;
+		sim->reply_start.tv_nsec %= 1000000000L;
+		set_interest(epfd, sim, 0);
+		arm_timer(sim->pace_fd, faults.stall_ms, sim->baud ? PACE_MS : 0);
+		return;
+	}
+	if (sim->stall_at >= 0 && sim->reply_sent + size > sim->stall_at)
+		size = sim->stall_at - sim->reply_sent;
+
+	if (sim->baud) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long ns = (now.tv_sec - sim->reply_start.tv_sec) * 1000000000LL + (now.tv_nsec - sim->reply_start.tv_nsec);
+		long long due = ns * sim->baud / 10 / 1000000000LL - sim->reply_sent;
+		if (due < size)
+			size = (due > 0 ? due : 0);
+	}
+
+	if (size > 0 || sim->out_pos < sim->out_len) {
+		int byte_count = (byte_faults ? write_faulty(sim, size) : write(sim->mfd, sim->reply, size));
+		if (byte_count < 0 && errno != EAGAIN) {
+			printf("%s: error writing\n", strerror(errno));
+			end_reply(epfd, sim);
 			return;
 		}
-		byte_count = write(mfd, buffer, chunk);
-		if (byte_count != chunk) {
-			printf("%3: error writing\n", strerror(errno));
-			return;
+		if (byte_count > 0) {
+			sim->reply += byte_count;
+			sim->reply_left -= byte_count;
+			sim->reply_sent += byte_count;
 		}
+	}
 
-		size -= chunk;
-		if (size < chunk) chunk = size;
+	if (sim->reply_left == 0 && sim->out_pos == sim->out_len) {
+		end_reply(epfd, sim);
+	} else if (sim->stall_at >= 0 && sim->reply_sent >= sim->stall_at) {
+		send_reply(epfd, sim);				// Stall starts now
+	} else if (!sim->baud) {
+		set_interest(epfd, sim, EPOLLOUT);	// PTY full, carry on when it drains
 	}
+}
 
-	close(data_fd);
 
-	printf("\n");
+// Whether the data directory has the file, mapped or not
+int has_image(sim_t *sim, const char *name) {
+	char filename[256];
+
+	if (mapped) {
+		for (unsigned int i = 0; i < IMAGE_COUNT; i++)
+			if (!strcmp(sim->images[i].name, name))
+				return sim->images[i].data != NULL;
+		return 0;
+	}
+
+	sprintf(filename, "%s/%s", sim->data_dir, name);
+	return !access(filename, R_OK);
 }
 
-void main(int argc, char *argv[]) {
-	char *data_dir;
-	int mfd,  address_size;
 
-	if (argc != 3) {
-		printf("Usage: %s [-c|-e] <data_dir>\n", argv[0]);
-		printf("Where:  [-c|-e]    Model to simulate, e=EMC, c=Commander\n");
-		printf("        <data_dir> Directory that contains data files.\n");
+void start_reply(int epfd, sim_t *sim) {
+	int seek, size;
+	unsigned int baud;
+	image_t *image = NULL;
+
+	const char *name = decode_request(sim->command, sim->address_size, &seek, &size, &baud);
+	if (!name)
 		return;
+
+	// A Commander answers 05 BD 7F with its ID block, captures rarely have an id1
+	if (!strcmp(name, "id1") && sim->address_size == 3 && !has_image(sim, "id1"))
+		name = "id0";
+
+	if (verbose)
+		printf("[%d] Sending %s, bytes (%d - %d)", sim->id, name, seek, seek + size);
+
+	// A unit always answers, a block the capture doesn't have reads as erased
+	if (!has_image(sim, name)) {
+		if (verbose)
+			printf(" not captured, 0xFF");
+		sim->reply_buf = malloc(size > 0 ? size : 1);
+		if (!sim->reply_buf)
+			return;
+		memset(sim->reply_buf, 0xff, size);
+		sim->reply = sim->reply_buf;
+	} else if (mapped) {
+		for (unsigned int i = 0; i < IMAGE_COUNT; i++)
+			if (!strcmp(sim->images[i].name, name))
+				image = &sim->images[i];
+
+		if (!image || !image->data || (size_t) seek >= image->size) {
+			printf(" no data\n");
+			return;
+		}
+		if ((size_t) (seek + size) > image->size) {
+			printf(" short by %zu bytes", seek + size - image->size);
+			size = image->size - seek;
+		}
+		sim->reply = image->data + seek;
+	} else {
+		sim->reply_buf = load_reply(sim, name, seek, &size);
+		if (!sim->reply_buf)
+			return;
+		sim->reply = sim->reply_buf;
 	}
 
-	if (strcmp(argv[1], "-c") == 0) {
-		address_size = 3;
-	} else if (strcmp(argv[1], "-e") == 0) {
-		address_size = 4;
+	sim->reply_left = size;
+	sim->reply_sent = 0;
+	sim->baud = baud;
+	sim->stall_at = -1;
+
+	if (size > 0 && roll(sim, faults.truncate)) {
+		sim->reply_left = rng_next(sim) % size;
+		if (verbose)
+			printf(" [truncated to %d]", sim->reply_left);
+	}
+	if (size > 0 && roll(sim, faults.stall)) {
+		sim->stall_at = rng_next(sim) % size;
+		if (verbose)
+			printf(" [stall at %lld]", sim->stall_at);
+	}
+	if (sim->command[0] == 0x15 && roll(sim, faults.wrong_baud)) {
+		// About 50ms of the reply before the rates match
+		sim->garble_left = 1 + rng_next(sim) % (baud ? baud / 10 / 20 : 512);
+		if (verbose)
+			printf(" [%d bytes at the wrong baud]", sim->garble_left);
 	}
 
-	data_dir = argv[2];
+	// No heartbeats or commands while replying
+	arm_timer(sim->hb_fd, 0, 0);
+	set_interest(epfd, sim, 0);
 
-	setbuf(stdout, 0);
+	// Command processing time, then slices at the reply's baud
+	clock_gettime(CLOCK_MONOTONIC, &sim->reply_start);
+	sim->reply_start.tv_nsec += (timing.delay % 1000) * 1000000L;
+	sim->reply_start.tv_sec += timing.delay / 1000 + sim->reply_start.tv_nsec / 1000000000L;
+	sim->reply_start.tv_nsec %= 1000000000L;
 
-	unsigned char buffer[4096];
-	int byte_count, bytes_expected;
-	int bytes_read;
-	char whirlygig[5] = "-\\|/";
-	int whirlygig_ndx = 0;
+	if (baud || timing.delay)
+		arm_timer(sim->pace_fd, timing.delay, baud ? PACE_MS : 0);
+	else
+		send_reply(epfd, sim);
+}
 
-	if ((mfd = pty_setup()) == -1) 
-		exit(1);
 
-	setup_signals();
+// Collect command bytes, a reply starts once the command is complete
+void receive(int epfd, sim_t *sim) {
+	unsigned char buffer[64];
 
-	while (1) {
-		alarm(1);
-		byte_count = read(mfd, buffer, 1);
-		alarm(0);
-
-		if (byte_count < 0) {
-			if (errno == 4) {
-				// alarm, send hearbeat
-				write(mfd, "\xAA", 1);
-				putchar(whirlygig[whirlygig_ndx++]);
-				putchar(0xd);
-				if (whirlygig_ndx > 3) whirlygig_ndx = 0;
-			} else {
-				printf("[%d]%s\n", errno, strerror(errno));
+	int byte_count = read(sim->mfd, buffer, sizeof(buffer));
+	if (byte_count <= 0) {
+		if (byte_count < 0 && errno != EAGAIN)
+			printf("[%d] [%d]%s\n", sim->id, errno, strerror(errno));
+		return;
+	}
+
+	// Any traffic puts the heartbeat back a full period
+	arm_timer(sim->hb_fd, timing.heartbeat, timing.heartbeat);
+
+	for (int i = 0; i < byte_count && !sim->reply; i++) {
+		if (sim->command_len == 0) {
+			switch (buffer[i]) {
+			case 0x05:
+				sim->command_expected = 5;
+				break;
+			case 0x96:
+				sim->command_expected = 1;
+				break;
+			case 0x89:
+				sim->command_expected = 6;
+				break;
+			case 0x15:
+				sim->command_expected = sim->address_size * 2 + 1;
+				break;
+			default:
+				if (verbose)
+					printf("[%d] Unknown command %02x.\n", sim->id, buffer[i]);
+				continue;
 			}
+		}
+
+		sim->command[sim->command_len++] = buffer[i];
+		if (sim->command_len <= sim->command_expected)
 			continue;
+
+		if (verbose) {
+			printf("[%d] Command: ", sim->id);
+			for (int n = 0; n < sim->command_len; n++)
+				printf("%02x ", sim->command[n]);
+			printf("\n");
 		}
 
-		switch (buffer[0])
-		{
-		case 0x05:
-			bytes_expected = 5;
+		sim->command_len = 0;
+		start_reply(epfd, sim);
+	}
+}
+
+
+void heartbeat(sim_t *sim, int count) {
+	char whirlygig[5] = "-\\|/";
+	unsigned long long expirations;
+
+	if (read(sim->hb_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	if (roll(sim, faults.heartbeat))
+		return;
+
+	write(sim->mfd, "\xAA", 1);
+	if (count == 1 && verbose) {
+		putchar(whirlygig[sim->whirlygig_ndx++]);
+		putchar(0xd);
+		if (sim->whirlygig_ndx > 3) sim->whirlygig_ndx = 0;
+	}
+}
+
+
+int sim_setup(int epfd, sim_t *sim) {
+	if ((sim->mfd = pty_setup(sim->pts_name)) == -1)
+		return -1;
+
+	fcntl(sim->mfd, F_SETFL, fcntl(sim->mfd, F_GETFL) | O_NONBLOCK);
+
+	sim->hb_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	sim->pace_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (sim->hb_fd < 0 || sim->pace_fd < 0) {
+		printf("%s: Unable to create timers\n", strerror(errno));
+		return -1;
+	}
+
+	map_images(sim);
+
+	sim->rng = (fault_seed + sim->id * 0x9E3779B97F4A7C15ULL) | 1;
+	sim->stall_at = -1;
+
+	struct epoll_event ev = { .events = EPOLLIN };
+	ev.data.u64 = ((unsigned long long) sim->id << 2) | EV_PTY;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sim->mfd, &ev);
+	ev.data.u64 = ((unsigned long long) sim->id << 2) | EV_HEARTBEAT;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sim->hb_fd, &ev);
+	ev.data.u64 = ((unsigned long long) sim->id << 2) | EV_PACE;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sim->pace_fd, &ev);
+
+	arm_timer(sim->hb_fd, timing.heartbeat, timing.heartbeat);
+
+	printf("Simulator running on device %s (%s, %s)\n", sim->pts_name, sim->data_dir,
+		sim->address_size == 4 ? "EMC" : "Commander");
+	return 0;
+}
+
+
+void usage(const char *name) {
+	printf("Usage: %s [-c|-e] [-M] [-T] [-l baud] [-h baud] [-p ms] [-d ms] [-n count] [-F fault=rate,...] [-S seed] <data_dir> [[c:|e:]data_dir ...]\n", name);
+	printf("Where:  [-c|-e]    Model to simulate, e=EMC, c=Commander\n");
+	printf("        -M         Map the data files once and serve from memory\n");
+	printf("        -T         Reply at real device speeds\n");
+	printf("        -l <baud>  Rate for ID, config and low-baud reads\n");
+	printf("        -h <baud>  Rate for high-speed reads\n");
+	printf("        -p <ms>    Heartbeat period (default 1000)\n");
+	printf("        -d <ms>    Delay before each reply\n");
+	printf("        -n <count> Simulate count units for each directory\n");
+	printf("        -F <list>  Inject faults, any of drop, garbage (per byte), stall,\n");
+	printf("                   truncate, wrongbaud (per reply), heartbeat (per beat)\n");
+	printf("                   as name=rate, stall_ms=<ms> sets the stall (default 2000)\n");
+	printf("        -S <seed>  Seed for the fault generators (default 1)\n");
+	printf("        <data_dir> Directory that contains data files, c: or e: sets its model.\n");
+}
+
+void main(int argc, char *argv[]) {
+	int address_size = 3;
+	int copies = 1;
+	timing_t opt = { 0, 0, 0, 0 };
+
+	int c;
+	while ((c = getopt(argc, argv, "ceMTl:h:p:d:n:F:S:")) != -1) {
+		switch (c) {
+		case 'c':	// Commander
+			address_size = 3;
+			break;
+		case 'e':	// EMC
+			address_size = 4;
 			break;
-		case 0x96:
-			bytes_expected = 1;
+		case 'M':	// Serve from mappings
+			mapped = 1;
 			break;
-		case 0x89:
-			bytes_expected = 6;
+		case 'T':	// Real device timing
+			real_time = 1;
 			break;
-		case 0x15:
-			bytes_expected = address_size * 2 + 1;
+		case 'l':
+			opt.low_baud = atoi(optarg);
+			break;
+		case 'h':
+			opt.high_baud = atoi(optarg);
+			break;
+		case 'p':
+			opt.heartbeat = atoi(optarg);
+			break;
+		case 'd':
+			opt.delay = atoi(optarg);
+			break;
+		case 'n':	// Units per directory
+			copies = atoi(optarg);
+			break;
+		case 'F':	// Fault injection
+			if (parse_faults(optarg)) {
+				usage(argv[0]);
+				return;
+			}
+			break;
+		case 'S':	// Fault seed
+			fault_seed = strtoull(optarg, NULL, 0);
 			break;
 		default:
-			printf("Unknown command %02x.\n", buffer[0]);
-			continue;
+			usage(argv[0]);
+			return;
 		}
+	}
 
-		bytes_read = 0;
-		while (bytes_read < bytes_expected) {
-			byte_count = read(mfd, &(buffer[1 + bytes_read]), bytes_expected);
-			if (byte_count < 0) {
-				printf("%s: error reading device\n", strerror(errno));
-				continue;
-			}
-			bytes_read += byte_count;
-		}
+	if (optind >= argc || copies < 1) {
+		usage(argv[0]);
+		return;
+	}
 
-		printf("Command: ");
+	if (real_time) {
+		timing.low_baud = 9600;
+		timing.delay = 10;
+	}
+	if (opt.low_baud) timing.low_baud = opt.low_baud;
+	if (opt.high_baud) timing.high_baud = opt.high_baud;
+	if (opt.heartbeat) timing.heartbeat = opt.heartbeat;
+	if (opt.delay) timing.delay = opt.delay;
 
-		for (int n = 0; n <= bytes_read; n++) 
-			printf("%02x ", buffer[n]);
-		printf("\n");
+	setbuf(stdout, 0);
+
+	int count = (argc - optind) * copies;
+	sim_t *sims = calloc(count, sizeof(sim_t));
+	int epfd = epoll_create1(0);
+	if (!sims || epfd < 0) {
+		printf("%s: Unable to set up\n", strerror(errno));
+		exit(1);
+	}
+
+	// A dozen chatty units would drown the terminal
+	verbose = (count == 1);
 
+	for (int i = 0; i < count; i++) {
+		sim_t *sim = &sims[i];
+		const char *arg = argv[optind + i / copies];
 
-		send_data(mfd, buffer, data_dir, address_size);
+		sim->id = i;
+		sim->address_size = address_size;
+		if (!strncmp(arg, "c:", 2) || !strncmp(arg, "e:", 2)) {
+			sim->address_size = (arg[0] == 'e' ? 4 : 3);
+			arg += 2;
+		}
+		sim->data_dir = arg;
+
+		if (sim_setup(epfd, sim))
+			exit(1);
 	}
-}
 
+	while (1) {
+		struct epoll_event events[32];
 
+		int n = epoll_wait(epfd, events, 32, -1);
+		if (n < 0) {
+			if (errno != EINTR)
+				printf("[%d]%s\n", errno, strerror(errno));
+			continue;
+		}
 
+		for (int e = 0; e < n; e++) {
+			sim_t *sim = &sims[events[e].data.u64 >> 2];
+			unsigned long long expirations;
+
+			switch (events[e].data.u64 & 3) {
+			case EV_PTY:
+				if (sim->reply)
+					send_reply(epfd, sim);		// PTY drained
+				else
+					receive(epfd, sim);
+				break;
+			case EV_HEARTBEAT:
+				heartbeat(sim, count);
+				break;
+			case EV_PACE:
+				if (read(sim->pace_fd, &expirations, sizeof(expirations)) == sizeof(expirations) && sim->reply)
+					send_reply(epfd, sim);
+				break;
+			}
+		}
+	}
+}
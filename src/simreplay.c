@@ -0,0 +1,341 @@
+/*
+*  simreplay.c
+*
+*  Replays usbmon captures of real Cochran sessions as a virtual device.
+*
+*  How to:
+*
+*		Build using:
+*
+*			make simreplay
+*
+*		The settings directory holds captures of Analyst talking to a
+*		Commander through its FTDI cable. Each capture is split into
+*		request/response pairs and indexed by request. The replay serves
+*		a PTY; bytes written to it are matched against the index and the
+*		recorded response is sent back, byte for byte:
+*
+*		./simreplay ../settings/cmdr_load.usbmon
+*
+*		Several captures can be given, they are indexed together. When a
+*		request was recorded more than once the next one along in the
+*		captures is served, so a session that repeats itself replays in
+*		order. Add -T to send each response with the timing it was
+*		recorded with, -i to just print the index. Transcripts written
+*		by usbmon -o load the same way as text captures.
+*/
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pty.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+
+#include "cochran_usbmon.h"
+
+// How long a partial request waits for the rest of it
+#define REQUEST_WAIT 1.0
+
+// How long a complete request waits in case a longer one is coming
+#define REQUEST_SETTLE 0.1
+
+usbmon_exchanges_t capture = { 0 };
+usbmon_exchange_t **index_sorted = 0;
+
+int real_time = 0;
+int heartbeat_ms = 1000;
+
+
+double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Order by request bytes then by when they were recorded
+int compare_exchange(const void *a, const void *b) {
+	const usbmon_exchange_t *x = *(usbmon_exchange_t * const *) a, *y = *(usbmon_exchange_t * const *) b;
+	int len = (x->request_len < y->request_len ? x->request_len : y->request_len);
+	int rc = memcmp(x->request, y->request, len);
+
+	if (rc) return rc;
+	if (x->request_len != y->request_len) return x->request_len - y->request_len;
+	return x->seq - y->seq;
+}
+
+
+int build_index(void) {
+	index_sorted = malloc(capture.count * sizeof(usbmon_exchange_t *));
+	if (!index_sorted)
+		return -1;
+
+	for (int i = 0; i < capture.count; i++)
+		index_sorted[i] = &capture.ex[i];
+	qsort(index_sorted, capture.count, sizeof(usbmon_exchange_t *), compare_exchange);
+
+	return 0;
+}
+
+
+/*
+ * Look up what the host has sent so far. Returns the exchange to replay
+ * or NULL, and sets *longer when a recorded request starts with these
+ * bytes but goes on. Of several recordings of the same request the first
+ * one after cursor wins.
+ */
+usbmon_exchange_t *lookup(const unsigned char *req, int len, int cursor, int *longer) {
+	int lo = 0, hi = capture.count;
+	usbmon_exchange_t *first = 0, *next = 0;
+
+	// First entry not below req
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		usbmon_exchange_t *e = index_sorted[mid];
+		int n = (e->request_len < len ? e->request_len : len);
+		int rc = memcmp(e->request, req, n);
+
+		if (rc < 0 || (rc == 0 && e->request_len < len))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*longer = 0;
+	for (int i = lo; i < capture.count; i++) {
+		usbmon_exchange_t *e = index_sorted[i];
+
+		if (e->request_len < len || memcmp(e->request, req, len))
+			break;
+		if (e->request_len > len) {
+			*longer = 1;
+			break;
+		}
+		if (!first)
+			first = e;
+		if (!next && e->seq > cursor)
+			next = e;
+	}
+
+	return (next ? next : first);
+}
+
+
+void print_bytes(const unsigned char *buf, int len, int max) {
+	for (int i = 0; i < len && i < max; i++)
+		printf("%02x ", buf[i]);
+	if (len > max)
+		printf("... ");
+}
+
+
+void print_index(void) {
+	for (int i = 0; i < capture.count; i++) {
+		usbmon_exchange_t *e = index_sorted[i];
+
+		printf("%5d %s %10.6f  ", e->seq, e->source, e->usec / 1e6);
+		print_bytes(e->request, e->request_len, 16);
+		printf("-> %d bytes in %d transfers\n", e->reply_len, e->chunk_count);
+	}
+}
+
+
+int pty_setup(char *pts_name) {
+	int mfd, sfd;
+
+	if ((openpty(&mfd, &sfd, pts_name, 0, 0)) == -1) {
+		printf("%s: Unable to open PTY\n", strerror(errno));
+		return -1;
+	}
+
+	// Raw, no echo
+	struct termios tty;
+	if (tcgetattr(mfd, &tty) != 0) {
+		printf("Unable to get attributes, %s\n", strerror(errno));
+		close(mfd);
+		return -1;
+	}
+
+	cfmakeraw(&tty);
+	tty.c_cflag |= (CLOCAL | CREAD);
+	if (tcsetattr(mfd, TCSANOW, &tty) != 0) {
+		printf("Unable to set parameters, %s\n", strerror(errno));
+		close(mfd);
+		return -1;
+	}
+
+	return mfd;
+}
+
+
+int write_all(int fd, const unsigned char *buf, int size) {
+	while (size > 0) {
+		int rc = write(fd, buf, size);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += rc;
+		size -= rc;
+	}
+	return 0;
+}
+
+
+void usage(const char *name) {
+	printf("Usage: %s [-T] [-i] [-p ms] <capture.usbmon> [capture.usbmon ...]\n", name);
+	printf("Where:  -T         Send replies with their recorded timing\n");
+	printf("        -i         Print the request index and exit\n");
+	printf("        -p <ms>    Heartbeat period (default 1000, 0 for none)\n");
+}
+
+
+int main(int argc, char *argv[]) {
+	int list = 0;
+
+	int c;
+	while ((c = getopt(argc, argv, "Tip:")) != -1) {
+		switch (c) {
+		case 'T':	// Recorded timing
+			real_time = 1;
+			break;
+		case 'i':	// Print index
+			list = 1;
+			break;
+		case 'p':
+			heartbeat_ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	setbuf(stdout, 0);
+
+	for (int i = optind; i < argc; i++)
+		if (usbmon_load_exchanges(argv[i], &capture))
+			exit(1);
+
+	if (build_index()) {
+		printf("Out of memory building index\n");
+		exit(1);
+	}
+
+	if (list) {
+		print_index();
+		return 0;
+	}
+
+	char pts_name[256];
+	int mfd = pty_setup(pts_name);
+	if (mfd == -1)
+		exit(1);
+
+	printf("Replaying %d exchanges on device %s\n", capture.count, pts_name);
+
+	unsigned char pending[256];
+	int pending_len = 0, cursor = -1;
+	double last_input = 0, idle_since = now(), settle = REQUEST_SETTLE;
+
+	usbmon_exchange_t *reply = 0;
+	int chunk = 0;
+	double reply_start = 0;
+
+	while (1) {
+		double t = now(), wake = -1;
+
+		// Work out when something is next due
+		if (reply)
+			wake = reply_start + reply->chunks[chunk].usec / 1e6;
+		else if (pending_len)
+			wake = last_input + settle;
+		else if (heartbeat_ms)
+			wake = idle_since + heartbeat_ms / 1000.0;
+
+		int timeout = -1;
+		if (wake >= 0)
+			timeout = (wake > t ? (int) ((wake - t) * 1000) + 1 : 0);
+
+		struct pollfd pfd = { .fd = mfd, .events = POLLIN };
+		int rc = poll(&pfd, 1, timeout);
+		if (rc < 0 && errno != EINTR) {
+			printf("[%d]%s\n", errno, strerror(errno));
+			exit(1);
+		}
+
+		t = now();
+		if (rc > 0 && (pfd.revents & POLLIN)) {
+			int len = read(mfd, pending + pending_len, sizeof(pending) - pending_len);
+			if (len > 0) {
+				pending_len += len;
+				last_input = t;
+			}
+		}
+
+		if (reply && !real_time) {
+			write_all(mfd, reply->reply, reply->reply_len);
+			reply = 0;
+			idle_since = t;
+			continue;
+		} else if (reply) {
+			// Send every transfer that is due
+			while (chunk < reply->chunk_count && reply_start + reply->chunks[chunk].usec / 1e6 <= t) {
+				int end = (chunk + 1 < reply->chunk_count ? reply->chunks[chunk + 1].offset : reply->reply_len);
+				write_all(mfd, reply->reply + reply->chunks[chunk].offset, end - reply->chunks[chunk].offset);
+				chunk++;
+			}
+			if (chunk == reply->chunk_count) {
+				reply = 0;
+				idle_since = t;
+			}
+			continue;
+		}
+
+		// Match what the host has sent, dropping bytes that match nothing
+		while (pending_len) {
+			int longer;
+			usbmon_exchange_t *e = lookup(pending, pending_len, cursor, &longer);
+
+			settle = (e ? REQUEST_SETTLE : REQUEST_WAIT);
+			if (longer && t - last_input < settle)
+				break;		// Might be more on the way
+
+			if (!e) {
+				printf("Unknown command %02x.\n", pending[0]);
+				memmove(pending, pending + 1, --pending_len);
+				continue;
+			}
+
+			printf("Command: ");
+			print_bytes(pending, pending_len, 16);
+			printf("\nSending %d bytes (%s %.6f)\n", e->reply_len, e->source, e->usec / 1e6);
+
+			pending_len = 0;
+			cursor = e->seq;
+			idle_since = t;
+			if (e->chunk_count) {
+				reply = e;
+				chunk = 0;
+				reply_start = t;
+			}
+		}
+
+		if (!reply && !pending_len && heartbeat_ms && t - idle_since >= heartbeat_ms / 1000.0) {
+			write(mfd, "\xAA", 1);
+			idle_since = t;
+		}
+	}
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdlib.h>
+
+#include "cochran_usbmon.h"
+
+// Payloads closer together than this, in the same direction, dump as one block
+#define BLOCK_GAP 100000
+
+typedef struct dump_t {
+	FILE *out;					// Transcript, or NULL
+	int quiet;
+	int dir;
+	unsigned int last_usec;
+	unsigned int offset;
+	char ascii[17];
+	unsigned int records[3];
+	unsigned long long bytes[3];
+} dump_t;
+
+
+static void end_row(dump_t *d) {
+	int column = d->offset % 16;
+
+	if (!column)
+		return;
+	for (int i = column; i < 16; i++)
+		printf("   %s", i == 8 ? " " : "");
+	printf("  %s\n", d->ascii);
+	d->offset = 0;
+}
+
+
+static void dump_payload(dump_t *d, const usbmon_record_t *rec) {
+	if (d->dir != rec->dir || rec->usec - d->last_usec > BLOCK_GAP) {
+		end_row(d);
+		printf("%u.%06u: %s\n", rec->usec / 1000000, rec->usec % 1000000, rec->dir == USBMON_OUT ? ">" : "<");
+		d->dir = rec->dir;
+		d->offset = 0;
+	}
+
+	for (unsigned int i = 0; i < rec->size; i++) {
+		int column = d->offset % 16;
+		unsigned char c = rec->data[i];
+
+		if (!column)
+			printf("    %08x  ", d->offset);
+		printf("%02x %s", c, column == 7 ? " " : "");
+		d->ascii[column] = (c >= 32 && c < 127 ? c : '.');
+		d->ascii[column + 1] = 0;
+		d->offset++;
+		if (column == 15)
+			printf("  %s\n", d->ascii);
+	}
+}
+
+
+static int record(const usbmon_record_t *rec, void *userdata) {
+	dump_t *d = (dump_t *) userdata;
+
+	d->records[rec->dir]++;
+	d->bytes[rec->dir] += rec->size;
+
+	if (d->out && usbmon_write_record(d->out, rec)) {
+		dprintf(STDERR_FILENO, "%s: Unable to write transcript\n", strerror(errno));
+		return -1;
+	}
+
+	if (!d->quiet) {
+		if (rec->dir == USBMON_CONTROL) {
+			end_row(d);
+			printf("%u.%06u: control %02x %04x\n", rec->usec / 1000000, rec->usec % 1000000, rec->request, rec->value);
+			d->dir = -1;
+		} else {
+			dump_payload(d, rec);
+		}
+	}
+
+	d->last_usec = rec->usec;
+	return 0;
+}
+
+
+void usage(const char *name) {
+	printf("Usage: %s [-b bus] [-d devid] [-o transcript] [-q] <capture>\n", name);
+	printf("Where:  -b <bus>   Only this USB bus\n");
+	printf("        -d <devid> Only this device\n");
+	printf("        -o <file>  Write a binary transcript\n");
+	printf("        -q         No dump, just the totals\n");
+	printf("        <capture>  usbmon text capture or transcript\n");
+}
+
+
+int main(int argc, char *argv[]) {
+	int bus = -1, dev = -1;
+	const char *out_file = 0;
+	dump_t d = { .dir = -1 };
+
+	int c;
+	while ((c = getopt(argc, argv, "b:d:o:q")) != -1) {
+		switch (c) {
+		case 'b':
+			bus = atoi(optarg);
+			break;
+		case 'd':
+			dev = atoi(optarg);
+			break;
+		case 'o':
+			out_file = optarg;
+			break;
+		case 'q':
+			d.quiet = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (out_file) {
+		if (!(d.out = fopen(out_file, "w"))) {
+			dprintf(STDERR_FILENO, "%s: Unable to create %s\n", strerror(errno), out_file);
+			return 1;
+		}
+		fwrite(USBMON_MAGIC, sizeof(USBMON_MAGIC) - 1, 1, d.out);
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int rc = usbmon_parse_file(argv[optind], bus, dev, record, &d);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (!d.quiet)
+		end_row(&d);
+	if (d.out && fclose(d.out)) {
+		dprintf(STDERR_FILENO, "%s: Unable to write %s\n", strerror(errno), out_file);
+		rc = -1;
+	}
+
+	fflush(stdout);
+	dprintf(STDERR_FILENO, "%u out (%llu bytes), %u in (%llu bytes), %u control in %.1fms\n",
+		d.records[USBMON_OUT], d.bytes[USBMON_OUT], d.records[USBMON_IN], d.bytes[USBMON_IN],
+		d.records[USBMON_CONTROL],
+		(end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+	return (rc ? 1 : 0);
+}